@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+#include "asyncLog.h"
+#include "ringBuffer.h"
+
+#define KIND_INT 0
+#define KIND_DOUBLE 1
+#define KIND_TEXT 2
+#define KIND_TELEMETRY 3
+
+/// A single record in a channel ringbuffer
+typedef struct {
+	uint8_t kind;
+	const char * format;
+	char text[ASYNC_LOG_TEXT];
+	union {
+		long long i[4];
+		double d[4];
+		struct asyncLog_telemetry telemetry;
+	} args;
+} asyncLog_record;
+
+/// Records of each channel. Written by the logging thread, read by the background thread.
+static ringBuffer_t channels[ASYNC_LOG_CHANNELS];
+/// Number of records dropped because the channel was full
+static volatile uint32_t dropped[ASYNC_LOG_CHANNELS];
+static FILE * telemetryFile;
+static pthread_t thread;
+static volatile bool running=false;
+/// Status file snapshot: statusReady is set by asyncLog_status() and cleared by the background thread after writing it
+static char statusBuffer[ASYNC_LOG_STATUS_BYTES];
+static uint32_t statusLength;
+static const char * statusFileName;
+static bool statusReady=false;
+
+/// Put a record into the channel or count it as dropped
+static void put(int channel, asyncLog_record * r)
+{
+	assert(channel>=0 && channel<ASYNC_LOG_CHANNELS);
+	if(!running || !ringBuffer_write(&channels[channel], sizeof(asyncLog_record), (uint8_t *)r))
+	{
+		__atomic_fetch_add(&dropped[channel], 1, __ATOMIC_RELAXED);
+	}
+}
+/// Format or write out a record on the background thread
+static void output(asyncLog_record * r)
+{
+	switch(r->kind)
+	{
+	case KIND_INT:
+		printf(r->format, r->args.i[0], r->args.i[1], r->args.i[2], r->args.i[3]);
+		break;
+	case KIND_DOUBLE:
+		printf(r->format, r->args.d[0], r->args.d[1], r->args.d[2], r->args.d[3]);
+		break;
+	case KIND_TEXT:
+		printf(r->format, r->text, r->args.i[0], r->args.i[1], r->args.i[2]);
+		break;
+	case KIND_TELEMETRY:
+		fwrite(&r->args.telemetry, sizeof(r->args.telemetry), 1, telemetryFile);
+		break;
+	}
+}
+/// Replace the status file with the pending snapshot
+static void write_status(void)
+{
+	if(!__atomic_load_n(&statusReady, __ATOMIC_ACQUIRE))
+	{
+		return;
+	}
+	char tmpName[512];
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", statusFileName);
+	FILE * f=fopen(tmpName, "w");
+	if(f==NULL)
+	{
+		perror("status file");
+	}else
+	{
+		fwrite(statusBuffer, 1, statusLength, f);
+		fclose(f);
+		rename(tmpName, statusFileName);
+	}
+	__atomic_store_n(&statusReady, false, __ATOMIC_RELEASE);
+}
+/// Drain all channels. @return true when any record was processed
+static bool drain(void)
+{
+	bool any=false;
+	write_status();
+	asyncLog_record r;
+	for(int i=0;i<ASYNC_LOG_CHANNELS;++i)
+	{
+		while(ringBuffer_read(&channels[i], sizeof(r), (uint8_t *)&r))
+		{
+			output(&r);
+			any=true;
+		}
+		uint32_t n=__atomic_exchange_n(&dropped[i], 0, __ATOMIC_RELAXED);
+		if(n>0)
+		{
+			printf("asyncLog: %u records dropped on channel %d\n", n, i);
+		}
+	}
+	if(any)
+	{
+		fflush(stdout);
+	}
+	return any;
+}
+static void * thread_main(void * arg)
+{
+	while(running)
+	{
+		if(!drain())
+		{
+			usleep(ASYNC_LOG_PERIOD_US);
+		}
+	}
+	drain();
+	return NULL;
+}
+void asyncLog_start(const char * telemetryFileName, uint32_t samplerate)
+{
+	for(int i=0;i<ASYNC_LOG_CHANNELS;++i)
+	{
+		uint32_t size=ASYNC_LOG_RECORDS*sizeof(asyncLog_record)+1;
+		uint8_t * buffer=calloc(size, 1);
+		assert(buffer!=NULL);
+		ringBuffer_create(&channels[i], size, buffer);
+	}
+	if(telemetryFileName!=NULL)
+	{
+		telemetryFile=fopen(telemetryFileName, "wb");
+		if(telemetryFile==NULL)
+		{
+			perror("telemetry file");
+		}else
+		{
+			struct asyncLog_telemetryHeader header;
+			memcpy(header.magic, ASYNC_LOG_TELEMETRY_MAGIC, sizeof(header.magic));
+			header.recordSize=sizeof(struct asyncLog_telemetry);
+			header.samplerate=samplerate;
+			fwrite(&header, sizeof(header), 1, telemetryFile);
+		}
+	}
+	running=true;
+	int err=pthread_create(&thread, NULL, thread_main, NULL);
+	assert(err==0);
+}
+void asyncLog_stop(void)
+{
+	if(!running)
+	{
+		return;
+	}
+	running=false;
+	pthread_join(thread, NULL);
+	if(telemetryFile!=NULL)
+	{
+		fclose(telemetryFile);
+		telemetryFile=NULL;
+	}
+}
+bool asyncLog_telemetryEnabled(void)
+{
+	return telemetryFile!=NULL;
+}
+void asyncLog_int(int channel, const char * format, long long a, long long b, long long c, long long d)
+{
+	asyncLog_record r;
+	r.kind=KIND_INT;
+	r.format=format;
+	r.args.i[0]=a;
+	r.args.i[1]=b;
+	r.args.i[2]=c;
+	r.args.i[3]=d;
+	put(channel, &r);
+}
+void asyncLog_double(int channel, const char * format, double a, double b, double c, double d)
+{
+	asyncLog_record r;
+	r.kind=KIND_DOUBLE;
+	r.format=format;
+	r.args.d[0]=a;
+	r.args.d[1]=b;
+	r.args.d[2]=c;
+	r.args.d[3]=d;
+	put(channel, &r);
+}
+void asyncLog_text(int channel, const char * format, const char * text, long long a, long long b, long long c)
+{
+	asyncLog_record r;
+	r.kind=KIND_TEXT;
+	r.format=format;
+	strncpy(r.text, text, sizeof(r.text)-1);
+	r.text[sizeof(r.text)-1]='\0';
+	r.args.i[0]=a;
+	r.args.i[1]=b;
+	r.args.i[2]=c;
+	put(channel, &r);
+}
+char * asyncLog_statusBuffer(void)
+{
+	return __atomic_load_n(&statusReady, __ATOMIC_ACQUIRE)?NULL:statusBuffer;
+}
+void asyncLog_status(const char * fileName, uint32_t length)
+{
+	statusFileName=fileName;
+	statusLength=length;
+	__atomic_store_n(&statusReady, true, __ATOMIC_RELEASE);
+}
+void asyncLog_telemetry(int channel, uint32_t stream, float buffered, float target, float ratio)
+{
+	if(telemetryFile==NULL)
+	{
+		return;
+	}
+	asyncLog_record r;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	r.kind=KIND_TELEMETRY;
+	r.format=NULL;
+	r.args.telemetry.timeNs=now.tv_sec*1000000000ull+now.tv_nsec;
+	r.args.telemetry.stream=stream;
+	r.args.telemetry.buffered=buffered;
+	r.args.telemetry.target=target;
+	r.args.telemetry.ratio=ratio;
+	put(channel, &r);
+}
@@ -0,0 +1,83 @@
+#ifndef ASYNC_LOG_H_
+#define ASYNC_LOG_H_
+
+/// Asynchronous, allocation free logging for the real time and network threads.
+/// Log calls only copy a fixed size binary record into a preallocated lock-free ringbuffer.
+/// A background thread formats the records with printf and writes telemetry records into a binary file.
+/// Each channel is a single producer ringbuffer so each thread that logs must use its own channel.
+/// When a channel is full the record is dropped and counted.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Channel of the main thread (epoll loop of the server, setup of the client)
+#define ASYNC_LOG_MAIN 0
+/// Channel of the Jack process callback
+#define ASYNC_LOG_JACK 1
+/// Channel of a worker thread
+#define ASYNC_LOG_WORKER 2
+/// Channels of the connection threads of the client: one for each server connection
+#define ASYNC_LOG_CONNECTION(i) (3+(i))
+#define ASYNC_LOG_CONNECTIONS 8
+/// Number of channels
+#define ASYNC_LOG_CHANNELS (3+ASYNC_LOG_CONNECTIONS)
+/// Number of records that fit into a channel
+#define ASYNC_LOG_RECORDS 1024
+/// Maximum length of the text argument of a record (including the terminating zero)
+#define ASYNC_LOG_TEXT 48
+/// The background thread sleeps this long when all channels are empty
+#define ASYNC_LOG_PERIOD_US (10l*1000l)
+/// Maximum size of a status file snapshot
+#define ASYNC_LOG_STATUS_BYTES (64*1024)
+
+/// Telemetry file header magic. The file is a struct asyncLog_telemetryHeader followed by struct asyncLog_telemetry records.
+#define ASYNC_LOG_TELEMETRY_MAGIC "TASJTEL1"
+
+/// Header of the binary telemetry file
+struct asyncLog_telemetryHeader {
+	char magic[8];
+	/// Size of a single record in bytes
+	uint32_t recordSize;
+	/// Samplerate of the playback
+	uint32_t samplerate;
+} __attribute__((packed));
+
+/// A binary telemetry record: state of the buffer control of a stream at a point of time
+struct asyncLog_telemetry {
+	/// CLOCK_MONOTONIC time in nanoseconds
+	uint64_t timeNs;
+	/// Identifier of the stream
+	uint32_t stream;
+	/// Length of buffered audio in seconds
+	float buffered;
+	/// Target length of buffered audio in seconds
+	float target;
+	/// Playback speed ratio
+	float ratio;
+} __attribute__((packed));
+
+/// Allocate the channels and start the background thread.
+/// @param telemetryFile binary telemetry file to create. NULL means telemetry records are dropped without counting.
+/// @param samplerate stored in the telemetry file header
+void asyncLog_start(const char * telemetryFile, uint32_t samplerate);
+/// Stop the background thread after all records were written
+void asyncLog_stop(void);
+/// Is telemetry recording enabled? Useful to skip collecting telemetry data when it is not recorded.
+bool asyncLog_telemetryEnabled(void);
+/// Log a message with up to 4 integer arguments. format must be a string literal (it is formatted later) using %lld conversions.
+void asyncLog_int(int channel, const char * format, long long a, long long b, long long c, long long d);
+/// Log a message with up to 4 floating point arguments. format must be a string literal using %f (or similar) conversions.
+void asyncLog_double(int channel, const char * format, double a, double b, double c, double d);
+/// Log a message with a text and up to 3 integer arguments. format must be a string literal starting with a %s conversion followed by %lld conversions.
+/// text is copied and truncated to ASYNC_LOG_TEXT-1 characters.
+void asyncLog_text(int channel, const char * format, const char * text, long long a, long long b, long long c);
+/// Record a telemetry record
+void asyncLog_telemetry(int channel, uint32_t stream, float buffered, float target, float ratio);
+/// Get the buffer of the next status file snapshot (ASYNC_LOG_STATUS_BYTES). Only one thread may write status snapshots.
+/// @return NULL when the background thread did not write the previous snapshot yet, then this snapshot is skipped
+char * asyncLog_statusBuffer(void);
+/// Hand the snapshot written into the buffer to the background thread, which replaces the file with it (written to fileName.tmp and renamed)
+/// @param fileName must stay valid until asyncLog_stop()
+void asyncLog_status(const char * fileName, uint32_t length);
+
+#endif /* ASYNC_LOG_H_ */
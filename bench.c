@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+#include "ringBuffer.h"
+
+/// Size of the ringbuffer used by the ringBuffer benchmarks
+#define BENCH_RING_BYTES 65536
+/// Largest message size of the ringBuffer benchmarks
+#define BENCH_MAX_BYTES 16384
+
+static FILE * results=NULL;
+
+/// CLOCK_MONOTONIC time in nanoseconds
+static uint64_t bench_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+bool bench_open(const char * fileName)
+{
+	results=strcmp(fileName, "-")==0?stdout:fopen(fileName, "a");
+	if(results==NULL)
+	{
+		perror(fileName);
+		return false;
+	}
+	return true;
+}
+void bench_close(void)
+{
+	if(results!=NULL && results!=stdout)
+	{
+		fclose(results);
+	}
+	results=NULL;
+}
+void bench_run(const char * name, const char * params, uint32_t bytesPerOp, bench_function f, void * arg)
+{
+	/// Calibrate: double the iterations until a run is long enough. The calibration runs also warm up the caches.
+	uint64_t iterations=1;
+	while(true)
+	{
+		uint64_t start=bench_now();
+		f(arg, iterations);
+		if(bench_now()-start>=BENCH_MIN_SECONDS*1e9)
+		{
+			break;
+		}
+		iterations*=2;
+	}
+	uint64_t best=UINT64_MAX;
+	for(int i=0;i<BENCH_REPEATS;++i)
+	{
+		uint64_t start=bench_now();
+		f(arg, iterations);
+		uint64_t ns=bench_now()-start;
+		if(ns<best)
+		{
+			best=ns;
+		}
+	}
+	double nsPerOp=(double)best/iterations;
+	fprintf(results, "bench=%s%s%s iterations=%llu nsPerOp=%.1f", name, params[0]!='\0'?" ":"", params, (unsigned long long)iterations, nsPerOp);
+	if(bytesPerOp>0)
+	{
+		fprintf(results, " mbPerSecond=%.1f", bytesPerOp/nsPerOp*1e3);
+	}
+	fprintf(results, "\n");
+	fflush(results);
+}
+void bench_value(const char * name, const char * params, const char * field, double value)
+{
+	fprintf(results, "bench=%s%s%s %s=%.1f\n", name, params[0]!='\0'?" ":"", params, field, value);
+	fflush(results);
+}
+
+/// State of a ringBuffer benchmark
+typedef struct
+{
+	ringBuffer_t ring;
+	uint32_t bytes;
+	uint8_t data[BENCH_MAX_BYTES];
+} bench_ring;
+
+/// Write a message and read it back
+static void ring_writeRead(void * arg, uint64_t iterations)
+{
+	bench_ring * b=(bench_ring *)arg;
+	for(uint64_t i=0;i<iterations;++i)
+	{
+		ringBuffer_write(&b->ring, b->bytes, b->data);
+		ringBuffer_read(&b->ring, b->bytes, b->data);
+	}
+}
+/// Peek a header sized prefix and the whole message, then drop it like process_messages() does
+static void ring_peek(void * arg, uint64_t iterations)
+{
+	bench_ring * b=(bench_ring *)arg;
+	for(uint64_t i=0;i<iterations;++i)
+	{
+		ringBuffer_write(&b->ring, b->bytes, NULL);
+		ringBuffer_peek(&b->ring, 8, b->data);
+		ringBuffer_peekOffset(&b->ring, 8, b->bytes-8, b->data);
+		ringBuffer_read(&b->ring, b->bytes, NULL);
+	}
+}
+/// Zero copy: fill the continuous write spans in place and consume the continuous read spans in place
+static void ring_access(void * arg, uint64_t iterations)
+{
+	bench_ring * b=(bench_ring *)arg;
+	for(uint64_t i=0;i<iterations;++i)
+	{
+		uint8_t * data;
+		for(uint32_t done=0;done<b->bytes;)
+		{
+			uint32_t n=ringBuffer_accessWriteBuffer(&b->ring, &data, b->bytes-done);
+			memset(data, (int)i, n);
+			ringBuffer_write(&b->ring, n, NULL);
+			done+=n;
+		}
+		for(uint32_t done=0;done<b->bytes;)
+		{
+			uint32_t n=ringBuffer_accessReadBuffer(&b->ring, &data, b->bytes-done);
+			b->data[0]^=data[n-1];
+			ringBuffer_read(&b->ring, n, NULL);
+			done+=n;
+		}
+	}
+}
+void bench_ringBuffer(void)
+{
+	static uint8_t buffer[BENCH_RING_BYTES];
+	static bench_ring b;
+	const uint32_t sizes[]={ 16, 64, 256, 1024, 4096, BENCH_MAX_BYTES };
+	for(size_t i=0;i<sizeof(sizes)/sizeof(sizes[0]);++i)
+	{
+		char params[32];
+		snprintf(params, sizeof(params), "bytes=%u", sizes[i]);
+		b.bytes=sizes[i];
+		/// The positions move through the whole ring, so the copies wrap around the end of the buffer regularly like in real use
+		ringBuffer_create(&b.ring, sizeof(buffer), buffer);
+		bench_run("ringBuffer_writeRead", params, sizes[i], ring_writeRead, &b);
+		ringBuffer_create(&b.ring, sizeof(buffer), buffer);
+		bench_run("ringBuffer_peek", params, sizes[i], ring_peek, &b);
+		ringBuffer_create(&b.ring, sizeof(buffer), buffer);
+		bench_run("ringBuffer_access", params, sizes[i], ring_access, &b);
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+/// Microbenchmarks of the hot paths (jack-tcp-server -B, jack-tcp-client -B and make bench).
+/// Each benchmark is run with a growing number of iterations until one run takes BENCH_MIN_SECONDS,
+/// then BENCH_REPEATS times more and the fastest run is reported, so the results are repeatable on a quiet machine.
+/// The result of a benchmark is a single line of key=value fields, for example:
+/// bench=ringBuffer_writeRead bytes=256 iterations=4194304 nsPerOp=21.3 mbPerSecond=12018.8
+/// Result files of two commits can be compared with diff or joined on the fields before iterations.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Minimum duration of a measured run in seconds
+#define BENCH_MIN_SECONDS (0.05)
+/// Number of measured runs of a benchmark
+#define BENCH_REPEATS 5
+
+/// Body of a benchmark: do the measured operation iterations times
+typedef void (*bench_function)(void * arg, uint64_t iterations);
+
+/// Open the result file. Results are appended so the programs can write into the same file. "-" means stdout.
+/// @return false when the file can not be opened
+bool bench_open(const char * fileName);
+/// Close the result file
+void bench_close(void);
+/// Measure a benchmark and write its result line
+/// @param name name of the benchmark (bench= field)
+/// @param params parameter fields of the benchmark in key=value form separated by spaces. Part of the key of the result.
+/// @param bytesPerOp bytes processed by one operation, used for the mbPerSecond field. 0 omits the field.
+void bench_run(const char * name, const char * params, uint32_t bytesPerOp, bench_function f, void * arg);
+/// Write a result line of a measured value that is not a duration, for example the accuracy of a resampler
+/// @param field name of the value field
+void bench_value(const char * name, const char * params, const char * field, double value);
+/// Benchmarks of ringBuffer.c: write+read, peek and the access buffer functions at various sizes
+void bench_ringBuffer(void);
+
+#endif /* BENCH_H_ */
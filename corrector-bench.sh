@@ -0,0 +1,41 @@
+#!/bin/sh
+
+# Compares the CPU cost of the buffer length correctors of the server: the speex resampler, the WSOLA time-stretcher
+# and the built-in polyphase resampler.
+# Runs a headless server with each corrector and a headless client with a large clock drift so the buffer length
+# has to be corrected often, then prints the status of the stream: correctorCpu is the CPU time of the corrector
+# in percent of the duration of the audio it produced.
+# Usage: ./corrector-bench.sh [secondsPerRun] [driftPpm] [extra server options...]
+
+DURATION=${1:-60}
+[ $# -gt 0 ] && shift
+DRIFT=${1:-20000}
+[ $# -gt 0 ] && shift
+SERVER_OPTIONS="$*"
+SERVER_PORT=18095
+OUT=${OUT:-/tmp/corrector-bench}
+mkdir -p $OUT
+
+for CORRECTOR in resampler wsola polyphase
+do
+	case $CORRECTOR in
+		polyphase) CORRECTOR_OPTIONS="-c resampler -R polyphase";;
+		*) CORRECTOR_OPTIONS="-c $CORRECTOR";;
+	esac
+	rm -f $OUT/$CORRECTOR.status
+	./jack-tcp-server -H -p $SERVER_PORT $CORRECTOR_OPTIONS -s $OUT/$CORRECTOR.status $SERVER_OPTIONS >$OUT/$CORRECTOR.server.log 2>&1 &
+	SERVER=$!
+	sleep 0.5
+	./jack-tcp-client -H 48000 -d $DRIFT -u localhost:$SERVER_PORT >$OUT/$CORRECTOR.client.log 2>&1 &
+	CLIENT=$!
+	sleep $DURATION
+	cp $OUT/$CORRECTOR.status $OUT/$CORRECTOR.final 2>/dev/null
+	kill $CLIENT
+	sleep 0.5
+	kill -INT $SERVER
+	wait $SERVER 2>/dev/null
+	echo "== $CORRECTOR (client drift $DRIFT ppm)"
+	cat $OUT/$CORRECTOR.final 2>/dev/null
+	grep "Report corrector" $OUT/$CORRECTOR.server.log | tail -n 1
+	grep "Network loop" $OUT/$CORRECTOR.server.log
+done
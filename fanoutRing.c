@@ -0,0 +1,179 @@
+#include <string.h>
+#include <time.h>
+#include "fanoutRing.h"
+
+void fanoutRing_create(fanoutRing_t * ring, uint32_t bufferSize, uint8_t * buffer)
+{
+	ring->buffer=buffer;
+	ring->bufferSize=bufferSize;
+	ring->writePos=0;
+	ring->pendingPos=0;
+	for(int i=0;i<FANOUT_MAX_READERS;++i)
+	{
+		ring->readPos[i]=0;
+		ring->active[i]=false;
+	}
+	ring->markCount=0;
+}
+int fanoutRing_readers(fanoutRing_t * ring)
+{
+	int n=0;
+	for(int i=0;i<FANOUT_MAX_READERS;++i)
+	{
+		if(__atomic_load_n(&ring->active[i], __ATOMIC_ACQUIRE))
+		{
+			n++;
+		}
+	}
+	return n;
+}
+uint32_t fanoutRing_availableWrite(fanoutRing_t * ring)
+{
+	uint64_t used=0;
+	for(int i=0;i<FANOUT_MAX_READERS;++i)
+	{
+		if(__atomic_load_n(&ring->active[i], __ATOMIC_ACQUIRE))
+		{
+			uint64_t u=ring->pendingPos-__atomic_load_n(&ring->readPos[i], __ATOMIC_ACQUIRE);
+			if(u>used)
+			{
+				used=u;
+			}
+		}
+	}
+	return used>=ring->bufferSize?0:ring->bufferSize-(uint32_t)used;
+}
+bool fanoutRing_write(fanoutRing_t * ring, uint32_t nBytes, const uint8_t * data)
+{
+	if(fanoutRing_availableWrite(ring)<nBytes)
+	{
+		return false;
+	}
+	if(data==NULL)
+	{
+		ring->pendingPos+=nBytes;
+		return true;
+	}
+	uint32_t at=(uint32_t)(ring->pendingPos%ring->bufferSize);
+	uint32_t first=ring->bufferSize-at;
+	if(first>=nBytes)
+	{
+		memcpy(ring->buffer+at, data, nBytes);
+	}else
+	{
+		memcpy(ring->buffer+at, data, first);
+		memcpy(ring->buffer, data+first, nBytes-first);
+	}
+	ring->pendingPos+=nBytes;
+	return true;
+}
+uint32_t fanoutRing_accessWriteBuffer(fanoutRing_t * ring, uint8_t ** ptrBuffer, uint32_t maxBytes)
+{
+	uint32_t n=fanoutRing_availableWrite(ring);
+	uint32_t at=(uint32_t)(ring->pendingPos%ring->bufferSize);
+	if(n>ring->bufferSize-at)
+	{
+		n=ring->bufferSize-at;
+	}
+	if(n>maxBytes)
+	{
+		n=maxBytes;
+	}
+	*ptrBuffer=ring->buffer+at;
+	return n;
+}
+void fanoutRing_publish(fanoutRing_t * ring)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fanoutRing_mark * mark=&ring->marks[ring->markCount%FANOUT_MARKS];
+	mark->pos=ring->pendingPos;
+	mark->timeNs=now.tv_sec*1000000000ull+now.tv_nsec;
+	__atomic_store_n(&ring->markCount, ring->markCount+1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->writePos, ring->pendingPos, __ATOMIC_RELEASE);
+}
+void fanoutRing_attach(fanoutRing_t * ring, int reader)
+{
+	/// The writer ignores the read position of an inactive reader, so the reader is made active first and its position is then
+	/// moved to a fresh write position until the writer did not publish during the move
+	__atomic_store_n(&ring->readPos[reader], __atomic_load_n(&ring->writePos, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	__atomic_store_n(&ring->active[reader], true, __ATOMIC_SEQ_CST);
+	uint64_t pos;
+	do
+	{
+		pos=__atomic_load_n(&ring->writePos, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&ring->readPos[reader], pos, __ATOMIC_SEQ_CST);
+	}while(__atomic_load_n(&ring->writePos, __ATOMIC_SEQ_CST)!=pos);
+}
+void fanoutRing_detach(fanoutRing_t * ring, int reader)
+{
+	__atomic_store_n(&ring->active[reader], false, __ATOMIC_RELEASE);
+}
+uint32_t fanoutRing_availableRead(fanoutRing_t * ring, int reader)
+{
+	return (uint32_t)(__atomic_load_n(&ring->writePos, __ATOMIC_ACQUIRE)-ring->readPos[reader]);
+}
+bool fanoutRing_peek(fanoutRing_t * ring, int reader, uint32_t offset, uint32_t nBytes, uint8_t * data)
+{
+	if(fanoutRing_availableRead(ring, reader)<offset+nBytes)
+	{
+		return false;
+	}
+	uint32_t at=(uint32_t)((ring->readPos[reader]+offset)%ring->bufferSize);
+	uint32_t first=ring->bufferSize-at;
+	if(first>=nBytes)
+	{
+		memcpy(data, ring->buffer+at, nBytes);
+	}else
+	{
+		memcpy(data, ring->buffer+at, first);
+		memcpy(data+first, ring->buffer, nBytes-first);
+	}
+	return true;
+}
+uint32_t fanoutRing_accessReadBuffer(fanoutRing_t * ring, int reader, uint8_t ** ptrBuffer, uint32_t maxBytes)
+{
+	uint32_t n=fanoutRing_availableRead(ring, reader);
+	uint32_t at=(uint32_t)(ring->readPos[reader]%ring->bufferSize);
+	if(n>ring->bufferSize-at)
+	{
+		n=ring->bufferSize-at;
+	}
+	if(n>maxBytes)
+	{
+		n=maxBytes;
+	}
+	*ptrBuffer=ring->buffer+at;
+	return n;
+}
+void fanoutRing_skip(fanoutRing_t * ring, int reader, uint32_t nBytes)
+{
+	__atomic_store_n(&ring->readPos[reader], ring->readPos[reader]+nBytes, __ATOMIC_RELEASE);
+}
+uint64_t fanoutRing_readPosition(fanoutRing_t * ring, int reader)
+{
+	return ring->readPos[reader];
+}
+uint32_t fanoutRing_marks(fanoutRing_t * ring, fanoutRing_mark * marks)
+{
+	uint64_t end=__atomic_load_n(&ring->markCount, __ATOMIC_ACQUIRE);
+	uint64_t begin=end>FANOUT_MARKS?end-FANOUT_MARKS:0;
+	for(uint64_t i=begin;i<end;++i)
+	{
+		marks[i-begin]=ring->marks[i%FANOUT_MARKS];
+	}
+	/// The writer may have overwritten the oldest marks while they were copied: keep only the ones that are still intact
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	uint64_t after=__atomic_load_n(&ring->markCount, __ATOMIC_ACQUIRE);
+	uint64_t intact=after+1>FANOUT_MARKS?after+1-FANOUT_MARKS:0;
+	if(intact>begin)
+	{
+		if(intact>=end)
+		{
+			return 0;
+		}
+		memmove(marks, marks+(intact-begin), (end-intact)*sizeof(fanoutRing_mark));
+		begin=intact;
+	}
+	return (uint32_t)(end-begin);
+}
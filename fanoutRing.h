@@ -0,0 +1,77 @@
+#ifndef FANOUT_RING_H_
+#define FANOUT_RING_H_
+
+/// Single writer, multiple reader ringbuffer. Data is written once and each reader has its own read cursor,
+/// so one capture can feed several connections. The writer never overwrites data that an attached reader did not read yet:
+/// a reader that falls behind has to skip data itself (see fanoutRing_skip()) or detach.
+/// Positions are monotonic 64 bit byte counts, the buffer index is position modulo bufferSize.
+/// The writer appends with fanoutRing_write() and makes the data visible to the readers with fanoutRing_publish(),
+/// so readers only ever see whole messages.
+
+#include "simulator_types.h"
+
+/// Maximum number of readers
+#define FANOUT_MAX_READERS 8
+/// Number of recent publishes whose position and time are remembered
+#define FANOUT_MARKS 256
+
+/// Position and CLOCK_MONOTONIC time of a publish. Readers use them to drop data at publish boundaries
+/// and to measure how long data waited in the ring.
+typedef struct
+{
+	uint64_t pos;
+	uint64_t timeNs;
+} fanoutRing_mark;
+
+typedef struct
+{
+	uint8_t * buffer;
+	uint32_t bufferSize;
+	/// Published write position. Written by the writer, read by the readers.
+	volatile uint64_t writePos;
+	/// Write position including data not published yet. Used by the writer only.
+	uint64_t pendingPos;
+	/// Read position of each reader. Written by the reader, read by the writer.
+	volatile uint64_t readPos[FANOUT_MAX_READERS];
+	/// The reader is attached. The writer respects its read position only when attached.
+	volatile bool active[FANOUT_MAX_READERS];
+	/// Recent publishes. markCount is the number of publishes, the last one is marks[(markCount-1)%FANOUT_MARKS].
+	fanoutRing_mark marks[FANOUT_MARKS];
+	volatile uint64_t markCount;
+} fanoutRing_t;
+
+/// Initialize an empty ring without readers
+void fanoutRing_create(fanoutRing_t * ring, uint32_t bufferSize, uint8_t * buffer);
+/// Number of attached readers
+int fanoutRing_readers(fanoutRing_t * ring);
+/// Number of bytes that can be written without overwriting data not read by an attached reader
+uint32_t fanoutRing_availableWrite(fanoutRing_t * ring);
+/// Append data. It is not visible to the readers until fanoutRing_publish() is called.
+/// @param data NULL means the data was already written with fanoutRing_accessWriteBuffer() and only the write position is advanced
+/// @return false means there was not enough space and nothing was written
+bool fanoutRing_write(fanoutRing_t * ring, uint32_t nBytes, const uint8_t * data);
+/// Access the continuous free part of the buffer at the write position. See ringBuffer_accessWriteBuffer()
+uint32_t fanoutRing_accessWriteBuffer(fanoutRing_t * ring, uint8_t ** ptrBuffer, uint32_t maxBytes);
+/// Make all written data visible to the readers and remember the position and time of the publish
+void fanoutRing_publish(fanoutRing_t * ring);
+/// Attach a reader. Its read position starts at the current published write position.
+void fanoutRing_attach(fanoutRing_t * ring, int reader);
+/// Detach a reader so it does not hold back the writer anymore
+void fanoutRing_detach(fanoutRing_t * ring, int reader);
+/// Number of published bytes not read by the reader yet
+uint32_t fanoutRing_availableRead(fanoutRing_t * ring, int reader);
+/// Copy nBytes starting offset bytes after the read position of the reader without consuming them
+/// @return false means that much data is not available
+bool fanoutRing_peek(fanoutRing_t * ring, int reader, uint32_t offset, uint32_t nBytes, uint8_t * data);
+/// Access the continuous part of the unread data of the reader. See ringBuffer_accessReadBuffer()
+uint32_t fanoutRing_accessReadBuffer(fanoutRing_t * ring, int reader, uint8_t ** ptrBuffer, uint32_t maxBytes);
+/// Advance the read position of the reader (consume or drop data)
+void fanoutRing_skip(fanoutRing_t * ring, int reader, uint32_t nBytes);
+/// Read position of the reader
+uint64_t fanoutRing_readPosition(fanoutRing_t * ring, int reader);
+/// Copy the recent publish marks that are not being overwritten into marks, oldest first (reader side)
+/// @param marks array of FANOUT_MARKS elements
+/// @return number of marks copied
+uint32_t fanoutRing_marks(fanoutRing_t * ring, fanoutRing_mark * marks);
+
+#endif /* FANOUT_RING_H_ */
@@ -0,0 +1,49 @@
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+#include <stdbool.h>
+#include "headless.h"
+
+static pthread_t thread;
+static volatile bool running=false;
+/// Length of one period in nanoseconds
+static uint64_t periodNs;
+static int (*processCallback)(jack_nframes_t nframes, void *arg);
+
+static void * thread_main(void * arg)
+{
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while(running)
+	{
+		next.tv_nsec+=periodNs;
+		while(next.tv_nsec>=1000000000l)
+		{
+			next.tv_nsec-=1000000000l;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		processCallback(HEADLESS_PERIOD_FRAMES, NULL);
+	}
+	return NULL;
+}
+void headless_start(uint32_t samplerate, float drift_ppm, int (*callback)(jack_nframes_t nframes, void *arg))
+{
+	periodNs=(uint64_t)(HEADLESS_PERIOD_FRAMES*1e9/samplerate/(1.0+drift_ppm*1e-6));
+	processCallback=callback;
+	running=true;
+	int err=pthread_create(&thread, NULL, thread_main, NULL);
+	assert(err==0);
+}
+void headless_stop(void)
+{
+	if(running)
+	{
+		running=false;
+		pthread_join(thread, NULL);
+	}
+}
+pthread_t headless_thread(void)
+{
+	return thread;
+}
@@ -0,0 +1,21 @@
+#ifndef HEADLESS_H_
+#define HEADLESS_H_
+
+/// Headless backend: drive a Jack style process callback from a timer thread instead of a Jack server.
+/// Used for soak tests and benchmarks on machines without audio hardware or Jack server.
+
+#include <pthread.h>
+#include <jack/jack.h>
+
+/// Number of frames processed in one callback in headless mode
+#define HEADLESS_PERIOD_FRAMES 256
+
+/// Start a thread that calls callback with HEADLESS_PERIOD_FRAMES frames in real time according to samplerate.
+/// @param drift_ppm speed difference of the simulated clock from the system clock in parts per million. Used to simulate clock drift between client and server.
+void headless_start(uint32_t samplerate, float drift_ppm, int (*callback)(jack_nframes_t nframes, void *arg));
+/// Stop the callback thread
+void headless_stop(void);
+/// The callback thread, valid after headless_start()
+pthread_t headless_thread(void);
+
+#endif /* HEADLESS_H_ */
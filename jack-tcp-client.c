@@ -13,84 +13,458 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <jack/jack.h>
 #include <jack/ringbuffer.h>
 #include "tcp-protocol.h"
 #include "ringBuffer.h"
+#include "asyncLog.h"
+#include "headless.h"
+#include "fanoutRing.h"
+#include "serverConnection.h"
+#include "opusCodec.h"
+#include "bench.h"
+#include "traceProbes.h"
+#include "rtHardening.h"
 
 /// The Jack audio client instance.
 static jack_client_t *jackClient;
-/// Jack port identifiers used to capture audio data
-jack_port_t * ports[NPORT];
+/// Jack port identifiers used to capture audio data. One group of NPORT ports for each stream.
+jack_port_t * ports[MAX_STREAMS][NPORT];
 
 /// Graceful exit requested by the user - not implemented because just killing the process is good enough.
 static volatile bool exitProgram=false;
-/// Signal that the client is connected to the server and audio frame data has to be put into the tcpStream ringbuffer
-/// It is false while retrying connection and the main thread can safely flush the buffer and put the initializing message before enabling
-/// enqueuing audio data
-static volatile bool running=false;
 
-/// Port names that are connected as source to the recording ports created by this process
-static char source_port_names[][128]={"null-sink Audio/Sink sink:monitor_0", "null-sink Audio/Sink sink:monitor_1"};
+/// Port names that are connected as source to the recording ports created by this process. One group for each stream.
+static char source_port_names[MAX_STREAMS][NPORT][128]={{"null-sink Audio/Sink sink:monitor_0", "null-sink Audio/Sink sink:monitor_1"}};
+/// Number of streams sent on the connection. Each -b option after the first adds a stream.
+static int nStreams=1;
+/// Samplerate of the capture
+static jack_nframes_t samplerate;
 
-/// Data to be sent through the TCP stream. messages are prefixed with struct chunk_header
-/// Written by the jack thread and read on the main thread to copy data into the TCP client stream
-/// In the beginning of the stream the main thread also writes a message before activating the jack input
-ringBuffer_t tcpStream;
+/// Audio messages to be sent to all servers. Messages are prefixed with struct chunk_header
+/// Written by the jack thread once and read by each connection thread with its own read cursor.
+/// The chunks of all streams of a Jack period are published together so a reader always starts at a period boundary.
+static fanoutRing_t capture;
+/// Fan-out ring size for each stream
+#define CAPTURE_RINGBUFFER_BYTES (4*CLIENT_RINGBUFFER_BYTES)
+/// Number of Jack periods that were not captured because a connection did not read the fan-out ring fast enough.
+/// Counted by the Jack thread and the Opus encoder thread, so it is only changed with atomic adds.
+static volatile uint32_t captureDrops=0;
 
-/// Fill struct sockaddr_in type INET address object from name of server and port number. (Includes blocking name resolution using gethostbyname)
-bool mksin (struct sockaddr_in *sinp, const char *host, int port)
+/// Servers to send the captured audio to. Connection i uses reader i of the fan-out ring.
+static serverConnection connections[FANOUT_MAX_READERS];
+static int nConnections=0;
+/// Latency target of the TCP connections (-l). Their kernel queues are sized from it, see socketTuning.h
+static float latencySeconds=SERVER_CONNECTION_LATENCY_SECONDS;
+
+/// Coalescing (-C): number of Jack periods sent in a single audio chunk of each stream. Fewer, larger messages for small Jack periods,
+/// at the cost of delaying the first period of a chunk by the others.
+static int coalescePeriods=1;
+/// Coalescing: largest chunk in frames. A chunk has to fit into the receive buffer of the server comfortably.
+#define COALESCE_MAX_FRAMES (CLIENT_RINGBUFFER_BYTES/4/(NPORT*SAMPLE_SIZE_BYTES))
+/// Coalescing: interleaved frames of each stream collected from the periods so far, their number and the capture time of the first frame
+static jack_default_audio_sample_t coalesceFrames[MAX_STREAMS][COALESCE_MAX_FRAMES*NPORT];
+static uint32_t coalescedFrames=0;
+static uint32_t coalescedPeriods=0;
+static int64_t coalesceTimeNs=0;
+
+/// Synchronized playback: an R_MSG_TIMESTAMP message with the capture time is sent before each audio chunk
+static bool syncTimestamps=false;
+/// Synchronized playback: capture time of the first frame of the current period (CLOCK_MONOTONIC ns), smoothed over the periods
+static int64_t captureTimeNs=0;
+/// Synchronized playback: number of frames of the previous period
+static jack_nframes_t captureFrames=0;
+/// Synchronized playback: the callback time jitter is smoothed by this factor. A larger difference restarts the capture clock.
+#define CAPTURE_TIME_SMOOTHING 16
+#define CAPTURE_TIME_RESET_NS (1000ll*1000*1000)
+
+/// Opus mode: bitrate of the encoded streams in bit/s. 0 means the samples are sent as float.
+static int32_t opusBitrate=0;
+/// Opus mode: captured periods handed over from the Jack thread to the encoder thread.
+/// Each period is a struct opus_period followed by the interleaved frames of stream 0, then stream 1...
+static ringBuffer_t opusInput;
+/// Opus mode: encoder of each stream. Used by the encoder thread only.
+static opusCodec encoders[MAX_STREAMS];
+static pthread_t encoderThread;
+/// Opus mode: the encoder thread polls opusInput with this period
+#define OPUS_ENCODER_POLL_US (2l*1000l)
+/// Opus mode: interval of logging the encoder statistics
+#define OPUS_REPORT_SECONDS 10
+/// Header of a period in opusInput
+struct opus_period {
+	/// Capture time of the first frame (CLOCK_MONOTONIC ns). Valid in synchronized playback mode.
+	int64_t captureTimeNs;
+	uint32_t nframes;
+};
+
+/// Run the microbenchmarks, append the results to this file and exit. Empty means normal operation.
+static char benchFileName[256]="";
+/// Headless mode: samplerate of the simulated capture. 0 means Jack is used.
+static uint32_t headlessSamplerate=0;
+/// Headless mode: clock drift of the simulated capture in parts per million
+static float headlessDrift=0.0f;
+/// Headless mode: test signal is generated into these buffers instead of capturing Jack ports
+static jack_default_audio_sample_t headlessBuffers[NPORT][HEADLESS_PERIOD_FRAMES];
+/// Headless mode: number of frames generated so far
+static uint64_t headlessFrames=0;
+
+/// Headless mode: generate the test signal: HEADLESS_TONE_SECONDS of 440Hz sine then HEADLESS_SILENCE_SECONDS of silence repeated.
+/// Silent gaps exercise the silence handling of the server.
+#define HEADLESS_TONE_SECONDS 2
+#define HEADLESS_SILENCE_SECONDS 1
+static void generate_test_signal(jack_nframes_t nframes)
 {
-	struct hostent *hp;
-	bzero (sinp, sizeof (*sinp));
-	sinp->sin_family = AF_INET;
-	sinp->sin_port = htons (port);
-	if (!(hp = gethostbyname (host))) {
-		fprintf (stderr, "%s: bad host name\n", host);
-		return true;
-	}
-	memcpy (&sinp->sin_addr, hp->h_addr, sizeof (sinp->sin_addr));
-	return false;
+	uint64_t cycle=(HEADLESS_TONE_SECONDS+HEADLESS_SILENCE_SECONDS)*(uint64_t)headlessSamplerate;
+	for(int j=0;j<nframes;++j)
+	{
+		uint64_t at=headlessFrames+j;
+		float v=0.0f;
+		if(at%cycle<HEADLESS_TONE_SECONDS*(uint64_t)headlessSamplerate)
+		{
+			v=0.25f*sinf(2.0f*(float)M_PI*440.0f*(at%headlessSamplerate)/headlessSamplerate);
+		}
+		for(int i=0;i<NPORT;++i)
+		{
+			headlessBuffers[i][j]=v;
+		}
+	}
+	headlessFrames+=nframes;
+}
+/// Get the buffer of a capture port of a stream. In headless mode this is the generated test signal.
+static jack_default_audio_sample_t * get_port_buffer(int stream, int i, jack_nframes_t nframes)
+{
+	if(headlessSamplerate>0)
+	{
+		return headlessBuffers[i];
+	}
+	return (jack_default_audio_sample_t *)jack_port_get_buffer(ports[stream][i], nframes);
 }
 
-/// Set up the fd to be handled non-blocking
-static int setnonblocking(int sockfd)
+/// Synchronized playback: update the capture time of the first frame of the current period.
+/// The callback runs after the period was captured, so the measured time is the callback time minus the period length.
+/// The measurement is smoothed against the time predicted from the previous period, which follows the clock of the capture.
+static void update_capture_time(jack_nframes_t nframes)
 {
-	if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK) ==
-	    -1) {
-		assert(false);
-		return -1;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t measured=now.tv_sec*1000000000ll+now.tv_nsec-nframes*1000000000ll/samplerate;
+	int64_t predicted=captureTimeNs+captureFrames*1000000000ll/samplerate;
+	if(captureTimeNs==0 || llabs(measured-predicted)>CAPTURE_TIME_RESET_NS)
+	{
+		captureTimeNs=measured;
+	}else
+	{
+		captureTimeNs=predicted+(measured-predicted)/CAPTURE_TIME_SMOOTHING;
 	}
-	return 0;
+	captureFrames=nframes;
 }
-/// Jack calls us back for each requested frame for all ports handled by this program
-int jack_process_frames_callback (jack_nframes_t nframes, void *arg)
+
+/// Interleave n frames of the port buffers of a stream starting at frame j into frames
+static void interleave(jack_default_audio_sample_t ** buff, jack_nframes_t j, int n, jack_default_audio_sample_t * frames)
 {
-	uint32_t payload=nframes * SAMPLE_SIZE_BYTES * NPORT;
-	int req=sizeof(struct chunk_header) + payload;
-	if(ringBuffer_availableWrite(&tcpStream) >=req && running)
+	for(int k=0;k<n;++k)
+	{
+		for(int i=0;i<NPORT;++i)
+		{
+			frames[k*NPORT+i]=buff[i][j+k];
+		}
+	}
+}
+/// Opus mode: hand the period over to the encoder thread. Encoding is too slow and irregular for the Jack thread.
+static void opus_capture(jack_nframes_t nframes)
+{
+	struct opus_period period;
+	period.captureTimeNs=captureTimeNs;
+	period.nframes=nframes;
+	if(ringBuffer_availableWrite(&opusInput)<sizeof(period)+nframes*NPORT*SAMPLE_SIZE_BYTES*nStreams)
+	{
+		__atomic_fetch_add(&captureDrops, 1, __ATOMIC_RELAXED);
+		TRACE_PROBE1(capture_drop, 1);
+		return;
+	}
+	ringBuffer_write(&opusInput, (uint32_t)sizeof(period), (uint8_t *)&period);
+	for(int s=0;s<nStreams;++s)
 	{
-		struct chunk_header header;
-		header.type=R_MSG_AUDIO_CHUNK;
-		header.payload=payload;
-		ringBuffer_write(&tcpStream, (uint32_t)sizeof(struct chunk_header), (uint8_t *)&header);
 		jack_default_audio_sample_t * buff[NPORT];
 		for(int i=0;i<NPORT;++i)
 		{
-			buff[i]=(jack_default_audio_sample_t *)jack_port_get_buffer(ports[i], nframes);
+			buff[i]=get_port_buffer(s, i, nframes);
+		}
+		jack_default_audio_sample_t frames[64*NPORT];
+		for(int j=0;j<nframes;j+=64)
+		{
+			int n=nframes-j<64?nframes-j:64;
+			interleave(buff, j, n, frames);
+			ringBuffer_write(&opusInput, n*NPORT*SAMPLE_SIZE_BYTES, (uint8_t *)frames);
 		}
-		for(int j=0;j<nframes;++j)
+	}
+}
+/// Write an audio chunk of each stream into the fan-out ring and publish them
+/// @param timeNs capture time of the first frame for the timestamps of synchronized playback
+/// @param coalesced the frames are in coalesceFrames, otherwise they are the current period in the port buffers
+static void write_chunks(jack_nframes_t nframes, int64_t timeNs, bool coalesced)
+{
+	uint32_t payload=nframes * SAMPLE_SIZE_BYTES * NPORT;
+	int req=(sizeof(struct chunk_header) + payload + (syncTimestamps?sizeof(struct media_timestamp):0))*nStreams;
+	/// The chunks of all streams are written or dropped together so the streams stay aligned
+	if(fanoutRing_availableWrite(&capture) >=req)
+	{
+		for(int s=0;s<nStreams;++s)
 		{
+			if(syncTimestamps)
+			{
+				struct media_timestamp timestamp;
+				timestamp.head.type=R_MSG_MAKE(R_MSG_TIMESTAMP, s);
+				timestamp.head.payload=sizeof(struct media_timestamp)-sizeof(struct chunk_header);
+				timestamp.timeNs=timeNs;
+				fanoutRing_write(&capture, (uint32_t)sizeof(timestamp), (uint8_t *)&timestamp);
+			}
+			struct chunk_header header;
+			header.type=R_MSG_MAKE(R_MSG_AUDIO_CHUNK, s);
+			header.payload=payload;
+			fanoutRing_write(&capture, (uint32_t)sizeof(struct chunk_header), (uint8_t *)&header);
+			if(coalesced)
+			{
+				fanoutRing_write(&capture, payload, (uint8_t *)coalesceFrames[s]);
+				continue;
+			}
+			jack_default_audio_sample_t * buff[NPORT];
 			for(int i=0;i<NPORT;++i)
 			{
-				ringBuffer_write(&tcpStream, SAMPLE_SIZE_BYTES, (uint8_t *)(buff[i]+j));
+				buff[i]=get_port_buffer(s, i, nframes);
+			}
+			/// Interleave a few frames at a time on the stack
+			jack_default_audio_sample_t frames[64*NPORT];
+			for(int j=0;j<nframes;j+=64)
+			{
+				int n=nframes-j<64?nframes-j:64;
+				interleave(buff, j, n, frames);
+				fanoutRing_write(&capture, n*NPORT*SAMPLE_SIZE_BYTES, (uint8_t *)frames);
 			}
 		}
+		fanoutRing_publish(&capture);
+	}else
+	{
+		__atomic_fetch_add(&captureDrops, coalesced?coalescedPeriods:1, __ATOMIC_RELAXED);
+		TRACE_PROBE1(capture_drop, coalesced?coalescedPeriods:1);
 	}
+}
+/// Coalescing: send the collected periods
+static void coalesce_flush(void)
+{
+	if(coalescedFrames>0)
+	{
+		write_chunks(coalescedFrames, coalesceTimeNs, true);
+	}
+	coalescedFrames=0;
+	coalescedPeriods=0;
+}
+/// Write the captured period of all streams into the fan-out ring (or hand it over to the Opus encoder thread)
+static void capture_period(jack_nframes_t nframes)
+{
+	if(syncTimestamps)
+	{
+		update_capture_time(nframes);
+	}
+	if(fanoutRing_readers(&capture)==0)
+	{
+		coalescedFrames=0;
+		coalescedPeriods=0;
+		return;
+	}
+	if(opusBitrate>0)
+	{
+		opus_capture(nframes);
+		return;
+	}
+	if(coalescePeriods<=1 || nframes>COALESCE_MAX_FRAMES)
+	{
+		coalesce_flush();
+		write_chunks(nframes, captureTimeNs, false);
+		return;
+	}
+	if(coalescedFrames+nframes>COALESCE_MAX_FRAMES)
+	{
+		coalesce_flush();
+	}
+	if(coalescedFrames==0)
+	{
+		coalesceTimeNs=captureTimeNs;
+	}
+	for(int s=0;s<nStreams;++s)
+	{
+		jack_default_audio_sample_t * buff[NPORT];
+		for(int i=0;i<NPORT;++i)
+		{
+			buff[i]=get_port_buffer(s, i, nframes);
+		}
+		interleave(buff, 0, nframes, coalesceFrames[s]+coalescedFrames*NPORT);
+	}
+	coalescedFrames+=nframes;
+	coalescedPeriods++;
+	if(coalescedPeriods>=coalescePeriods)
+	{
+		coalesce_flush();
+	}
+}
+/// Jack calls us back for each requested frame for all ports handled by this program
+int jack_process_frames_callback (jack_nframes_t nframes, void *arg)
+{
+	TRACE_PROBE1(process_start, nframes);
+	if(headlessSamplerate>0)
+	{
+		generate_test_signal(nframes);
+	}
+	capture_period(nframes);
+	TRACE_PROBE1(process_end, nframes);
 	return 0;
 }
 
+/// Opus mode: encode the collected frames of all streams and write the packets into the fan-out ring like the Jack thread writes float chunks
+/// @param timeNs capture time of the first frame of the packets
+static void opus_send(float (*frames)[OPUS_FRAME_FRAMES*NPORT], int64_t timeNs)
+{
+	static uint8_t packets[MAX_STREAMS][OPUS_MAX_PACKET_BYTES];
+	int32_t lengths[MAX_STREAMS];
+	uint32_t req=0;
+	for(int s=0;s<nStreams;++s)
+	{
+		lengths[s]=opusCodec_encode(&encoders[s], frames[s], packets[s], OPUS_MAX_PACKET_BYTES);
+		if(lengths[s]<0)
+		{
+			asyncLog_int(ASYNC_LOG_WORKER, "Opus encoder error: %lld\n", lengths[s], 0, 0, 0);
+			return;
+		}
+		req+=sizeof(struct chunk_header)+lengths[s]+(syncTimestamps?sizeof(struct media_timestamp):0);
+	}
+	if(fanoutRing_availableWrite(&capture)<req)
+	{
+		__atomic_fetch_add(&captureDrops, 1, __ATOMIC_RELAXED);
+		TRACE_PROBE1(capture_drop, 1);
+		return;
+	}
+	for(int s=0;s<nStreams;++s)
+	{
+		if(syncTimestamps)
+		{
+			struct media_timestamp timestamp;
+			timestamp.head.type=R_MSG_MAKE(R_MSG_TIMESTAMP, s);
+			timestamp.head.payload=sizeof(struct media_timestamp)-sizeof(struct chunk_header);
+			timestamp.timeNs=timeNs;
+			fanoutRing_write(&capture, (uint32_t)sizeof(timestamp), (uint8_t *)&timestamp);
+		}
+		struct chunk_header header;
+		header.type=R_MSG_MAKE(R_MSG_AUDIO_CHUNK, s);
+		header.payload=lengths[s];
+		fanoutRing_write(&capture, (uint32_t)sizeof(struct chunk_header), (uint8_t *)&header);
+		fanoutRing_write(&capture, lengths[s], packets[s]);
+	}
+	fanoutRing_publish(&capture);
+}
+/// Opus mode: encoder thread. Collects OPUS_FRAME_FRAMES frames of each stream from the periods captured by the Jack thread,
+/// encodes them and writes the packets into the fan-out ring. This thread is the only writer of the fan-out ring in Opus mode.
+static void * opus_encoder_thread(void * arg)
+{
+	static float frames[MAX_STREAMS][OPUS_FRAME_FRAMES*NPORT];
+	uint32_t filled=0;
+	int64_t packetTimeNs=0;
+	rtHardening_prefaultStack();
+	struct timespec lastReport;
+	clock_gettime(CLOCK_MONOTONIC, &lastReport);
+	while(!exitProgram)
+	{
+		struct opus_period period;
+		if(!ringBuffer_peek(&opusInput, (uint32_t)sizeof(period), (uint8_t *)&period)
+				|| ringBuffer_availableRead(&opusInput)<sizeof(period)+period.nframes*NPORT*SAMPLE_SIZE_BYTES*nStreams)
+		{
+			usleep(OPUS_ENCODER_POLL_US);
+			continue;
+		}
+		ringBuffer_read(&opusInput, (uint32_t)sizeof(period), NULL);
+		for(uint32_t done=0;done<period.nframes;)
+		{
+			uint32_t n=period.nframes-done;
+			if(n>OPUS_FRAME_FRAMES-filled)
+			{
+				n=OPUS_FRAME_FRAMES-filled;
+			}
+			if(filled==0)
+			{
+				packetTimeNs=period.captureTimeNs+done*1000000000ll/samplerate;
+			}
+			for(int s=0;s<nStreams;++s)
+			{
+				ringBuffer_peekOffset(&opusInput, (s*period.nframes+done)*NPORT*SAMPLE_SIZE_BYTES, n*NPORT*SAMPLE_SIZE_BYTES, (uint8_t *)&frames[s][filled*NPORT]);
+			}
+			filled+=n;
+			done+=n;
+			if(filled==OPUS_FRAME_FRAMES)
+			{
+				opus_send(frames, packetTimeNs);
+				filled=0;
+			}
+		}
+		ringBuffer_read(&opusInput, period.nframes*NPORT*SAMPLE_SIZE_BYTES*nStreams, NULL);
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(now.tv_sec-lastReport.tv_sec>=OPUS_REPORT_SECONDS)
+		{
+			for(int s=0;s<nStreams;++s)
+			{
+				asyncLog_double(ASYNC_LOG_WORKER, "Opus stream %.0f: %.1f kbit/s encode CPU: %.2f %%\n", s, opusCodec_kbps(&encoders[s]), opusCodec_cpuPercent(&encoders[s]), 0);
+			}
+			lastReport=now;
+		}
+	}
+	return NULL;
+}
+/// Control messages of a server connection: the parameters of all streams
+static uint32_t stream_parameters(uint8_t * buffer, uint32_t size)
+{
+	uint32_t length=0;
+	for(int s=0;s<nStreams && length+sizeof(struct stream_parameters)<=size;++s)
+	{
+		struct stream_parameters params;
+		params.head.type=R_MSG_MAKE(R_MSG_STREAM_PARAMETERS, s);
+		params.head.payload=sizeof(struct stream_parameters) - sizeof(struct chunk_header);
+		params.samplerate=samplerate;
+		params.nchannel=NPORT;
+		params.sampletype=opusBitrate>0?SAMPLE_TYPE_OPUS:SAMPLE_TYPE_FLOAT;
+		memcpy(buffer+length, &params, sizeof(params));
+		length+=sizeof(params);
+	}
+	return length;
+}
+/// Add a server connection from a command line argument
+static void add_connection(const char * arg, bool unixSocket)
+{
+	if(nConnections>=FANOUT_MAX_READERS)
+	{
+		fprintf (stderr, "at most %d servers are supported\n", FANOUT_MAX_READERS);
+		exit(1);
+	}
+	serverConnection * c=&connections[nConnections];
+	if(!serverConnection_parse(c, arg, unixSocket, DEFAULT_PORT))
+	{
+		exit(1);
+	}
+	if(unixSocket)
+	{
+		printf("server %d: same-host shared memory transport socket: %s\n", nConnections, c->unixSocket);
+	}else
+	{
+		for(int i=0;i<c->nServers;++i)
+		{
+			printf("server %d: %s host: %s port: %d\n", nConnections, i==0?"TCP client":"failover", c->servers[i].hostname, c->servers[i].port);
+		}
+	}
+	nConnections++;
+}
+
 /// Jack shutdown callback - with pipewire it is never called in my experience
 /// When Jack shutdown happens there is nothing to do but exit the program.
 static void jack_shutdown (void * arg)
@@ -99,22 +473,84 @@ static void jack_shutdown (void * arg)
 	exit(0);
 }
 
+/// Benchmarks: capture a period of the generated test signal and discard what the connection threads would send
+static void bench_capture(void * arg, uint64_t iterations)
+{
+	jack_nframes_t nframes=*(jack_nframes_t *)arg;
+	for(uint64_t i=0;i<iterations;++i)
+	{
+		capture_period(nframes);
+		fanoutRing_skip(&capture, 0, fanoutRing_availableRead(&capture, 0));
+		ringBuffer_read(&opusInput, ringBuffer_availableRead(&opusInput), NULL);
+	}
+}
+/// Run the microbenchmarks of the client (-B): the body of the Jack process callback with float and Opus streams,
+/// with and without synchronized playback timestamps. The results are appended to fileName. See bench.h
+static void run_benchmarks(const char * fileName)
+{
+	if(!bench_open(fileName))
+	{
+		exit(1);
+	}
+	samplerate=SAMPLERATE;
+	headlessSamplerate=samplerate;
+	generate_test_signal(HEADLESS_PERIOD_FRAMES);
+	asyncLog_start(NULL, samplerate);
+	uint8_t * buffer=calloc(CAPTURE_RINGBUFFER_BYTES*MAX_STREAMS, 1);
+	assert(buffer!=NULL);
+	fanoutRing_create(&capture, CAPTURE_RINGBUFFER_BYTES*MAX_STREAMS, buffer);
+	fanoutRing_attach(&capture, 0);
+	buffer=calloc(CAPTURE_RINGBUFFER_BYTES*MAX_STREAMS, 1);
+	assert(buffer!=NULL);
+	ringBuffer_create(&opusInput, CAPTURE_RINGBUFFER_BYTES*MAX_STREAMS, buffer);
+	const int streams[]={ 1, 4, MAX_STREAMS };
+	const jack_nframes_t periodFrames[]={ 64, HEADLESS_PERIOD_FRAMES };
+	for(int opus=0;opus<2;++opus)
+	{
+		/// Opus mode: only the hand over to the encoder thread is measured, encoding does not run in the Jack thread
+		opusBitrate=opus?1:0;
+		for(int sync=0;sync<2;++sync)
+		{
+			syncTimestamps=sync;
+			for(size_t i=0;i<sizeof(streams)/sizeof(streams[0]);++i)
+			{
+				nStreams=streams[i];
+				for(size_t k=0;k<sizeof(periodFrames)/sizeof(periodFrames[0]);++k)
+				{
+					jack_nframes_t nframes=periodFrames[k];
+					char params[64];
+					snprintf(params, sizeof(params), "opus=%d sync=%d streams=%d frames=%u", opus, sync, nStreams, nframes);
+					bench_run("capture_period", params, nStreams*nframes*NPORT*SAMPLE_SIZE_BYTES, bench_capture, &nframes);
+				}
+			}
+		}
+	}
+	asyncLog_stop();
+	bench_close();
+}
+
 /// Process arguments, open Jack connection, create Jack input ports and connect them to required source ports.
-/// Then in an endless loop open client TCP socket and process connection. Connection is auto-retried after timeout after previous connection failed.
+/// Then start a thread for each server that opens the connection and sends the audio.
 int main(int argc, char *argv[])
 {
-	int n;
 	int c;
-	int sockfd;
-	struct sockaddr_in srv_addr;
-	char hostname[128]="localhost";
-	int port=DEFAULT_PORT;
+	bool sourcesGiven=false;
 
-	char *optstring = "u:b:h";
+	char *optstring = "u:b:hH:d:U:So:B:l:C:P:A:";
 	struct option long_options[] = {
 		{ "help", 0, 0, 'h' },
 		{ "URL", 1, 0, 'u' },
 		{ "baseSourceName", 1, 0, 'b' },
+		{ "headless", 1, 0, 'H' },
+		{ "drift", 1, 0, 'd' },
+		{ "unixSocket", 1, 0, 'U' },
+		{ "sync", 0, 0, 'S' },
+		{ "opus", 1, 0, 'o' },
+		{ "bench", 1, 0, 'B' },
+		{ "latency", 1, 0, 'l' },
+		{ "coalesce", 1, 0, 'C' },
+		{ "realtime", 1, 0, 'P' },
+		{ "affinity", 1, 0, 'A' },
 		{ 0, 0, 0, 0 }
 	};
 	int longopt_index = 0;
@@ -129,26 +565,76 @@ int main(int argc, char *argv[])
 			show_usage++;
 			break;
 		case 'u':
-		{
 			printf("url: %s\n", optarg);
-			char * colon =strchr(optarg, ':');
-			if(colon==NULL)
+			add_connection(optarg, false);
+			break;
+		case 'b':
+		{
+			/// The first -b replaces the default sources of stream 0, the following ones add streams
+			int s=0;
+			if(sourcesGiven)
 			{
-				strncpy(hostname, optarg, sizeof(hostname));
-			}else
+				if(nStreams>=MAX_STREAMS)
+				{
+					fprintf (stderr, "at most %d streams are supported\n", MAX_STREAMS);
+					exit(1);
+				}
+				s=nStreams++;
+			}
+			sourcesGiven=true;
+			for(int i=0;i<NPORT;++i)
 			{
-				*colon='\0';
-				strncpy(hostname, optarg, sizeof(hostname));
-				port=atoi(colon+1);
+				snprintf(source_port_names[s][i], 128, "%s%d", optarg, i);
 			}
+			printf("basename of stream %d: %s\n", s, optarg);
 			break;
 		}
-		case 'b':
-			for(int i=0;i<NPORT;++i)
+		case 'H':
+			headlessSamplerate=atoi(optarg);
+			printf("headless mode samplerate: %d\n", headlessSamplerate);
+			break;
+		case 'd':
+			headlessDrift=atof(optarg);
+			printf("headless mode clock drift: %f ppm\n", headlessDrift);
+			break;
+		case 'U':
+			add_connection(optarg, true);
+			break;
+		case 'S':
+			syncTimestamps=true;
+			printf("synchronized playback timestamps\n");
+			break;
+		case 'o':
+			opusBitrate=atoi(optarg)*1000;
+			printf("Opus bitrate: %d bit/s\n", opusBitrate);
+			break;
+		case 'B':
+			snprintf(benchFileName, sizeof(benchFileName), "%s", optarg);
+			printf("benchmark results: %s\n", optarg);
+			break;
+		case 'l':
+			latencySeconds=atoi(optarg)/1000.0f;
+			printf("connection latency target: %.3f s\n", latencySeconds);
+			break;
+		case 'C':
+			coalescePeriods=atoi(optarg);
+			printf("Jack periods per audio chunk: %d\n", coalescePeriods);
+			break;
+		case 'P':
+			if(!rtHardening_parsePriority(optarg))
 			{
-				snprintf(source_port_names[i], 128, "%s%d", optarg, i);
+				fprintf (stderr, "invalid real-time priority: %s\n", optarg);
+				exit(1);
 			}
-			printf("basename: %s\n", optarg);
+			printf("real-time hardening, network thread priority: %s\n", optarg);
+			break;
+		case 'A':
+			if(!rtHardening_parseAffinity(optarg))
+			{
+				fprintf (stderr, "invalid CPU list: %s\n", optarg);
+				exit(1);
+			}
+			printf("network thread CPUs: %s\n", optarg);
 			break;
 		default:
 			fprintf (stderr, "error\n");
@@ -157,135 +643,116 @@ int main(int argc, char *argv[])
 		}
 	}
 	if (show_usage) {
-		fprintf (stderr, "usage: jack-tcp-client -u serverHost:port [ -b baseSourceName ]\n");
+		fprintf (stderr, "usage: jack-tcp-client -u serverHost:port[,block|drop|disconnect]... [ -b baseSourceName ]... [-H headlessSamplerate [-d driftPpm]] [-U serverUnixSocketPath[,policy]]... [-S] [-o opusKbps] [-B benchResultFile] [-l latencyMs] [-C periodsPerChunk] [-P priority[,fifo|rr]] [-A cpuList]\n");
 		exit (1);
 	}
-
-	printf("TCP client host: %s port: %d\n", hostname, port);
-	for(int i=0;i<NPORT;++i)
+	if(benchFileName[0]!='\0')
 	{
-		printf("Source name: '%s'\n", source_port_names[i]);
+		run_benchmarks(benchFileName);
+		return 0;
+	}
+	if(nConnections==0)
+	{
+		add_connection("localhost", false);
+	}
+	rtHardening_start();
+	for(int s=0;s<nStreams;++s)
+	{
+		for(int i=0;i<NPORT;++i)
+		{
+			printf("Source name of stream %d: '%s'\n", s, source_port_names[s][i]);
+		}
 	}
 
-	jackClient = jack_client_open ("TCP client", JackNullOption, NULL);
-	assert(jackClient != NULL);
+	if(headlessSamplerate>0)
+	{
+		samplerate = headlessSamplerate;
+	}else
+	{
+		jackClient = jack_client_open ("TCP client", JackNullOption, NULL);
+		assert(jackClient != NULL);
 
-	jack_set_process_callback (jackClient, jack_process_frames_callback, NULL);
-	jack_on_shutdown (jackClient, jack_shutdown, NULL);
+		jack_set_process_callback (jackClient, jack_process_frames_callback, NULL);
+		jack_on_shutdown (jackClient, jack_shutdown, NULL);
 
-	assert(!jack_activate (jackClient));
+		assert(!jack_activate (jackClient));
 
-	jack_nframes_t samplerate = jack_get_sample_rate (jackClient);
-	uint8_t * buffer=calloc(CLIENT_RINGBUFFER_BYTES, 1);
+		samplerate = jack_get_sample_rate (jackClient);
+	}
+	asyncLog_start(NULL, samplerate);
+	uint8_t * buffer=calloc(CAPTURE_RINGBUFFER_BYTES*nStreams, 1);
 	assert(buffer!=NULL);
-	ringBuffer_create(&tcpStream, CLIENT_RINGBUFFER_BYTES, buffer);
-
-	for (int i = 0; i < NPORT; i++) {
-		char name[512];
-
-		snprintf (name, sizeof(name), "output_TCP_%d", i+1);
-
-		ports[i] = jack_port_register (jackClient, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
-		if(ports[i]==NULL)
+	fanoutRing_create(&capture, CAPTURE_RINGBUFFER_BYTES*nStreams, buffer);
+	if(opusBitrate>0)
+	{
+		if(samplerate!=OPUS_SAMPLERATE)
 		{
-			fprintf (stderr, "cannot register input port \"%s\"!\n", name);
+			fprintf (stderr, "Opus needs %d Hz capture, the samplerate is %u Hz\n", OPUS_SAMPLERATE, samplerate);
 			exit(1);
 		}
-		int err=jack_connect (jackClient, source_port_names[i], jack_port_name (ports[i]));
-		if(err)
+		for(int s=0;s<nStreams;++s)
 		{
-			fprintf (stderr, "cannot connect input port %s to %s\n", jack_port_name (ports[i]), source_port_names[i]);
+			if(!opusCodec_createEncoder(&encoders[s], opusBitrate))
+			{
+				fprintf (stderr, opusCodec_available()?"cannot create Opus encoder\n":"built without Opus support (make WITH_OPUS=1)\n");
+				exit(1);
+			}
 		}
-	}
-	bool first=true;
-	while(!exitProgram)
-	{
-		if(!first)
+		buffer=calloc(CAPTURE_RINGBUFFER_BYTES*nStreams, 1);
+		assert(buffer!=NULL);
+		ringBuffer_create(&opusInput, CAPTURE_RINGBUFFER_BYTES*nStreams, buffer);
+		pthread_create(&encoderThread, NULL, opus_encoder_thread, NULL);
+		rtHardening_thread(encoderThread, "Opus encoder thread", 0, true);
+		if(coalescePeriods>1)
 		{
-			usleep(1000*1000);
+			printf("Opus packets are 20 ms, -C is ignored\n");
 		}
-		first=false;
-		sockfd = socket(AF_INET, SOCK_STREAM, 0);
-		mksin(&srv_addr, hostname, port);
-		int err=connect(sockfd, (struct sockaddr *)&srv_addr, sizeof(srv_addr));
-		if(err!=0)
-		{
-			perror("connect()");
-			usleep(1000*1000);
-		}else
-		{
-			// Empty ringbuffer. Because running == false it is safe to just read all data the next data will start at the beginning of a frame
-			ringBuffer_read(&tcpStream, ringBuffer_availableRead(&tcpStream), NULL);
-			struct stream_parameters params;
-			params.head.type=R_MSG_STREAM_PARAMETERS;
-			params.head.payload=sizeof(struct stream_parameters) - sizeof(struct chunk_header);
-			params.samplerate=samplerate;
-			params.nchannel=NPORT;
-			params.sampletype=0;
-			ringBuffer_write(&tcpStream, sizeof(struct stream_parameters), (uint8_t *)&params);
-			bool tcpBroken=false;
-			setnonblocking(sockfd);
-			running=true;
-			printf("Connected to server\n");
-			while(!exitProgram && !tcpBroken) {
-				int awr=ringBuffer_availableRead(&tcpStream);
-				while(awr>0)
-				{
-					uint8_t * buf;
-					uint32_t len=ringBuffer_accessReadBuffer(&tcpStream, &buf, awr);
-					ssize_t written = write(sockfd, buf, len);
-					if(written==0)
-					{
-						tcpBroken=true;
-						break;
-					}else if(written<0)
-					{
-						if(errno==EAGAIN)
-						{
-							break;
-						}else
-						{
-							perror("TCP write");
-							tcpBroken=true;
-							break;
-						}
-					}else
-					{
-						ringBuffer_read(&tcpStream, written, NULL);
-					}
-					awr=ringBuffer_availableRead(&tcpStream);
-				}
-				while(true)
-				{
-					uint8_t buf[32];
-					ssize_t nread=read(sockfd, buf, sizeof(buf));
-					if(nread==0)
-					{
-						tcpBroken=true;
-						break;
-					}
-					if(nread<0)
-					{
-						if(errno == EAGAIN)
-						{
-							break;
-						}else
-						{
-							perror("TCP read");
-							tcpBroken=true;
-							break;
-						}
-					}else
-					{
-						// Good - ignore data for now
-					}
-				}
-				usleep(CLIENT_PERIOD_TIME_US);
+	}
+	if(headlessSamplerate>0)
+	{
+		headless_start(samplerate, headlessDrift, jack_process_frames_callback);
+		rtHardening_thread(headless_thread(), "headless capture thread", 1, false);
+	}
+
+	for (int s = 0; s < nStreams && headlessSamplerate==0; s++) {
+		for (int i = 0; i < NPORT; i++) {
+			char name[512];
+
+			if(s==0)
+			{
+				snprintf (name, sizeof(name), "output_TCP_%d", i+1);
+			}else
+			{
+				snprintf (name, sizeof(name), "output_TCP_s%d_%d", s, i+1);
+			}
+
+			ports[s][i] = jack_port_register (jackClient, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+			if(ports[s][i]==NULL)
+			{
+				fprintf (stderr, "cannot register input port \"%s\"!\n", name);
+				exit(1);
+			}
+			int err=jack_connect (jackClient, source_port_names[s][i], jack_port_name (ports[s][i]));
+			if(err)
+			{
+				fprintf (stderr, "cannot connect input port %s to %s\n", jack_port_name (ports[s][i]), source_port_names[s][i]);
 			}
 		}
-		close(sockfd);
-		running=false;
 	}
-	printf("Normal exit\n");
+	for(int i=0;i<nConnections;++i)
+	{
+		connections[i].latencySeconds=latencySeconds;
+		serverConnection_start(&connections[i], &capture, i, ASYNC_LOG_CONNECTION(i), stream_parameters);
+		char name[32];
+		snprintf(name, sizeof(name), "connection %d thread", i);
+		rtHardening_thread(connections[i].thread, name, 0, true);
+	}
+	rtHardening_report();
+	for(int i=0;i<nConnections;++i)
+	{
+		pthread_join(connections[i].thread, NULL);
+	}
+	asyncLog_stop();
+	printf("Normal exit, capture drops: %u\n", __atomic_load_n(&captureDrops, __ATOMIC_RELAXED));
 	return 0;
 }
@@ -0,0 +1,588 @@
+/*
+ * Network impairment emulator: a TCP proxy between jack-tcp-client and jack-tcp-server that delays the client to server
+ * direction with configurable delay, jitter, bandwidth cap and stall bursts.
+ * All random decisions come from a seeded generator so a scenario can be replayed exactly.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+
+#include "tcp-protocol.h"
+#include "ringBuffer.h"
+
+/// Maximum number of proxied connections at the same time
+#define MAX_PAIRS 16
+/// Bytes of data delayed in the proxy for a single connection. When it is full reading from the client stops (TCP backpressure).
+#define QUEUE_BYTES (4*1024*1024)
+/// Bytes of the server to client direction waiting for the client. When it is full reading from the server stops.
+#define BACK_QUEUE_BYTES (256*1024)
+/// Maximum size of a segment read from the client at once
+#define SEGMENT_BYTES 4096
+/// Maximum time to wait in poll when nothing is scheduled
+#define POLL_TIMEOUT_MS 100
+
+#define JITTER_UNIFORM 0
+#define JITTER_NORMAL 1
+#define JITTER_EXPONENTIAL 2
+#define JITTER_PARETO 3
+
+/// Data read from the client is stored in the queue prefixed with this header
+struct segment {
+	/// Time of arrival from the client in nanoseconds (CLOCK_MONOTONIC)
+	uint64_t arrival;
+	/// Time when the segment is forwarded to the server
+	uint64_t release;
+	/// Number of bytes following this header
+	uint32_t length;
+} __attribute__((packed));
+
+/// One proxied connection
+typedef struct {
+	bool used;
+	int clientFd;
+	int serverFd;
+	/// Delayed segments of the client to server direction
+	ringBuffer_t queue;
+	/// Number of bytes of the first segment in the queue already written to the server
+	uint32_t written;
+	/// Data of the server to client direction not written to the client yet. It is not delayed.
+	ringBuffer_t backQueue;
+	/// Release time of the last queued segment. Segments are never reordered.
+	uint64_t lastRelease;
+	/// Statistics
+	uint64_t bytes;
+	uint64_t segments;
+	uint64_t sumDelay;
+	uint64_t maxDelay;
+	uint64_t start;
+} proxyPair;
+
+static proxyPair pairs[MAX_PAIRS];
+static volatile bool exitProgram=false;
+
+/// Impairment parameters. Times in nanoseconds.
+static uint64_t delay=0;
+static uint64_t jitter=0;
+static int jitterDistribution=JITTER_UNIFORM;
+/// Bandwidth cap in bytes per second. 0 means unlimited.
+static double bandwidth=0.0;
+/// Mean interval between stalls and length of a stall. 0 interval means no stalls.
+static uint64_t stallInterval=0;
+static uint64_t stallLength=0;
+static uint64_t seed=1;
+
+/// Current stall window. Data released inside the window is held until its end.
+static uint64_t stallStart=0;
+static uint64_t stallEnd=0;
+static uint32_t stalls=0;
+
+/// xorshift64* pseudo random generator. Deterministic for a given seed.
+static uint64_t random_u64(void)
+{
+	seed^=seed>>12;
+	seed^=seed<<25;
+	seed^=seed>>27;
+	return seed*0x2545F4914F6CDD1Dull;
+}
+/// Uniform random number in (0, 1]
+static double random_uniform(void)
+{
+	return ((random_u64()>>11)+1)*(1.0/9007199254740992.0);
+}
+/// Random jitter according to the selected distribution. The jitter parameter is the maximum (uniform), standard deviation (normal)
+/// or mean (exponential, pareto) of the added delay.
+static uint64_t random_jitter(void)
+{
+	if(jitter==0)
+	{
+		return 0;
+	}
+	double v;
+	switch(jitterDistribution)
+	{
+	case JITTER_NORMAL:
+		v=fabs(sqrt(-2.0*log(random_uniform()))*cos(2.0*M_PI*random_uniform()))*jitter;
+		break;
+	case JITTER_EXPONENTIAL:
+		v=-log(random_uniform())*jitter;
+		break;
+	case JITTER_PARETO:
+		/// Shape 1.5 has mean 3*scale and a heavy tail
+		v=jitter/3.0/pow(random_uniform(), 1.0/1.5);
+		break;
+	default:
+		v=random_uniform()*jitter;
+		break;
+	}
+	return (uint64_t)v;
+}
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+/// Advance the stall schedule so that the current or next stall window ends after t
+static void update_stalls(uint64_t t)
+{
+	if(stallInterval==0)
+	{
+		return;
+	}
+	while(stallEnd<=t)
+	{
+		uint64_t base=stallEnd==0?t:stallEnd;
+		stallStart=base+(uint64_t)(-log(random_uniform())*stallInterval);
+		stallEnd=stallStart+stallLength;
+		stalls++;
+	}
+}
+/// Compute the release time of a segment of length bytes arriving at t
+static uint64_t schedule(proxyPair * p, uint64_t t, uint32_t length)
+{
+	uint64_t release=t+delay+random_jitter();
+	if(bandwidth>0.0)
+	{
+		uint64_t start=release>p->lastRelease?release:p->lastRelease;
+		release=start+(uint64_t)(length/bandwidth*1e9);
+	}
+	if(release<p->lastRelease)
+	{
+		release=p->lastRelease;
+	}
+	update_stalls(release);
+	if(release>=stallStart && release<stallEnd)
+	{
+		release=stallEnd;
+	}
+	p->lastRelease=release;
+	return release;
+}
+/// Print statistics of a connection
+static void report(proxyPair * p)
+{
+	double seconds=(now_ns()-p->start)*1e-9;
+	printf("netem report: seconds=%.1f bytes=%llu segments=%llu meanDelayMs=%.1f maxDelayMs=%.1f stalls=%u kbps=%.1f\n",
+			seconds, (unsigned long long)p->bytes, (unsigned long long)p->segments,
+			p->segments>0?p->sumDelay*1e-6/p->segments:0.0, p->maxDelay*1e-6, stalls,
+			seconds>0.0?p->bytes*8/1000.0/seconds:0.0);
+	fflush(stdout);
+}
+static void close_pair(proxyPair * p)
+{
+	report(p);
+	close(p->clientFd);
+	close(p->serverFd);
+	free(p->queue.buffer);
+	ringBuffer_clear(&p->queue);
+	free(p->backQueue.buffer);
+	ringBuffer_clear(&p->backQueue);
+	p->used=false;
+}
+/// Set up the fd to be handled non-blocking
+static int setnonblocking(int sockfd)
+{
+	if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK) ==
+	    -1) {
+		assert(false);
+		return -1;
+	}
+	return 0;
+}
+/// Connect to the upstream server. @return fd or -1 on error
+static int connect_upstream(const char * host, int port)
+{
+	struct addrinfo hints;
+	struct addrinfo * res;
+	char service[16];
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family=AF_UNSPEC;
+	hints.ai_socktype=SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+	if(getaddrinfo(host, service, &hints, &res)!=0)
+	{
+		fprintf(stderr, "%s: bad host name\n", host);
+		return -1;
+	}
+	int fd=-1;
+	for(struct addrinfo * ai=res;ai!=NULL;ai=ai->ai_next)
+	{
+		fd=socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(fd>=0 && connect(fd, ai->ai_addr, ai->ai_addrlen)==0)
+		{
+			break;
+		}
+		if(fd>=0)
+		{
+			close(fd);
+			fd=-1;
+		}
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+/// Read available data from the client and queue it with its release time. @return false when the connection is closed
+static bool read_client(proxyPair * p)
+{
+	while(ringBuffer_availableWrite(&p->queue)>=sizeof(struct segment)+SEGMENT_BYTES)
+	{
+		uint8_t data[SEGMENT_BYTES];
+		ssize_t n=read(p->clientFd, data, sizeof(data));
+		if(n==0)
+		{
+			return false;
+		}
+		if(n<0)
+		{
+			return errno==EAGAIN;
+		}
+		struct segment s;
+		s.arrival=now_ns();
+		s.release=schedule(p, s.arrival, n);
+		s.length=n;
+		ringBuffer_write(&p->queue, sizeof(s), (uint8_t *)&s);
+		ringBuffer_write(&p->queue, n, data);
+	}
+	return true;
+}
+/// Forward the released segments to the server. @return false when the connection is broken
+static bool write_server(proxyPair * p, uint64_t now)
+{
+	struct segment s;
+	while(ringBuffer_peek(&p->queue, sizeof(s), (uint8_t *)&s))
+	{
+		if(s.release>now)
+		{
+			return true;
+		}
+		while(p->written<s.length)
+		{
+			uint8_t chunk[SEGMENT_BYTES];
+			uint32_t len=s.length-p->written;
+			ringBuffer_peekOffset(&p->queue, sizeof(s)+p->written, len, chunk);
+			ssize_t n=write(p->serverFd, chunk, len);
+			if(n<0)
+			{
+				return errno==EAGAIN;
+			}
+			p->written+=n;
+		}
+		ringBuffer_read(&p->queue, sizeof(s)+s.length, NULL);
+		p->written=0;
+		uint64_t d=now-s.arrival;
+		p->bytes+=s.length;
+		p->segments++;
+		p->sumDelay+=d;
+		if(d>p->maxDelay)
+		{
+			p->maxDelay=d;
+		}
+	}
+	return true;
+}
+/// Write the queued server to client data to the client. @return false when the connection is broken
+static bool write_client(proxyPair * p)
+{
+	uint8_t * data;
+	uint32_t l;
+	while((l=ringBuffer_accessReadBuffer(&p->backQueue, &data, ringBuffer_availableRead(&p->backQueue)))>0)
+	{
+		ssize_t n=write(p->clientFd, data, l);
+		if(n<0)
+		{
+			return errno==EAGAIN;
+		}
+		ringBuffer_read(&p->backQueue, n, NULL);
+	}
+	return true;
+}
+/// Forward data from the server to the client without impairment. Bytes the client does not accept at once are queued,
+/// so the message framing of the control messages is kept. @return false when the connection is closed
+static bool read_server(proxyPair * p)
+{
+	while(ringBuffer_availableWrite(&p->backQueue)>0)
+	{
+		uint8_t * data;
+		uint32_t l=ringBuffer_accessWriteBuffer(&p->backQueue, &data, ringBuffer_availableWrite(&p->backQueue));
+		if(l==0)
+		{
+			break;
+		}
+		ssize_t n=read(p->serverFd, data, l);
+		if(n==0)
+		{
+			return false;
+		}
+		if(n<0)
+		{
+			return errno==EAGAIN;
+		}
+		ringBuffer_write(&p->backQueue, n, NULL);
+		if(!write_client(p))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+/// Linux SIGNAL handler to gracefully handle ctrl-c
+void intHandler(int dummy) {
+	exitProgram=true;
+}
+/// Parse parameters, listen for clients, connect each of them to the server and proxy the data.
+int main(int argc, char *argv[])
+{
+	int listenPort=DEFAULT_PORT+1;
+	char hostname[128]="localhost";
+	int port=DEFAULT_PORT;
+	int c;
+
+	char *optstring = "hl:u:d:j:J:r:i:s:S:";
+	struct option long_options[] = {
+		{ "help", 0, 0, 'h' },
+		{ "listen", 1, 0, 'l' },
+		{ "URL", 1, 0, 'u' },
+		{ "delay", 1, 0, 'd' },
+		{ "jitter", 1, 0, 'j' },
+		{ "distribution", 1, 0, 'J' },
+		{ "bandwidth", 1, 0, 'r' },
+		{ "stallInterval", 1, 0, 'i' },
+		{ "stallLength", 1, 0, 's' },
+		{ "seed", 1, 0, 'S' },
+		{ 0, 0, 0, 0 }
+	};
+	int longopt_index = 0;
+	int show_usage = 0;
+	while ((c = getopt_long (argc, argv, optstring, long_options, &longopt_index)) != -1) {
+		switch (c) {
+		case 'h':
+			show_usage++;
+			break;
+		case 'l':
+			listenPort=atoi(optarg);
+			break;
+		case 'u':
+		{
+			char * colon =strchr(optarg, ':');
+			if(colon!=NULL)
+			{
+				*colon='\0';
+				port=atoi(colon+1);
+			}
+			snprintf(hostname, sizeof(hostname), "%s", optarg);
+			break;
+		}
+		case 'd':
+			delay=(uint64_t)(atof(optarg)*1e6);
+			break;
+		case 'j':
+			jitter=(uint64_t)(atof(optarg)*1e6);
+			break;
+		case 'J':
+			if(strcmp(optarg, "uniform")==0)
+			{
+				jitterDistribution=JITTER_UNIFORM;
+			}else if(strcmp(optarg, "normal")==0)
+			{
+				jitterDistribution=JITTER_NORMAL;
+			}else if(strcmp(optarg, "exponential")==0)
+			{
+				jitterDistribution=JITTER_EXPONENTIAL;
+			}else if(strcmp(optarg, "pareto")==0)
+			{
+				jitterDistribution=JITTER_PARETO;
+			}else
+			{
+				show_usage++;
+			}
+			break;
+		case 'r':
+			bandwidth=atof(optarg)*1000.0/8.0;
+			break;
+		case 'i':
+			stallInterval=(uint64_t)(atof(optarg)*1e6);
+			break;
+		case 's':
+			stallLength=(uint64_t)(atof(optarg)*1e6);
+			break;
+		case 'S':
+			seed=strtoull(optarg, NULL, 0);
+			if(seed==0)
+			{
+				seed=1;
+			}
+			break;
+		default:
+			fprintf (stderr, "error\n");
+			show_usage++;
+			break;
+		}
+	}
+	if (show_usage) {
+		fprintf (stderr, "usage: jack-tcp-netem [-l listenPort] [-u serverHost:port] [-d delayMs] [-j jitterMs] [-J uniform|normal|exponential|pareto]"
+				" [-r bandwidthKbps] [-i stallIntervalMs -s stallLengthMs] [-S seed]\n");
+		exit (1);
+	}
+	printf("netem: listen %d forward to %s:%d delay %.1f ms jitter %.1f ms bandwidth %.1f kbps stall every %.1f ms for %.1f ms seed %llu\n",
+			listenPort, hostname, port, delay*1e-6, jitter*1e-6, bandwidth*8/1000.0, stallInterval*1e-6, stallLength*1e-6,
+			(unsigned long long)seed);
+
+	signal(SIGINT, intHandler);
+	signal(SIGTERM, intHandler);
+	signal(SIGPIPE, SIG_IGN);
+
+	int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse=1;
+	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(listenPort);
+	int err=bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr));
+	if(err!=0)
+	{
+		perror("bind()");
+		exit(1);
+	}
+	listen(listen_sock, 16);
+
+	while(!exitProgram)
+	{
+		struct pollfd fds[1+2*MAX_PAIRS];
+		proxyPair * owners[1+2*MAX_PAIRS];
+		int nfds=0;
+		fds[nfds].fd=listen_sock;
+		fds[nfds].events=POLLIN;
+		owners[nfds++]=NULL;
+		uint64_t now=now_ns();
+		uint64_t next=now+POLL_TIMEOUT_MS*1000000ull;
+		for(int i=0;i<MAX_PAIRS;++i)
+		{
+			proxyPair * p=&pairs[i];
+			if(!p->used)
+			{
+				continue;
+			}
+			fds[nfds].fd=p->clientFd;
+			fds[nfds].events=ringBuffer_availableWrite(&p->queue)>=sizeof(struct segment)+SEGMENT_BYTES?POLLIN:0;
+			if(ringBuffer_availableRead(&p->backQueue)>0)
+			{
+				fds[nfds].events|=POLLOUT;
+			}
+			owners[nfds++]=p;
+			fds[nfds].fd=p->serverFd;
+			fds[nfds].events=ringBuffer_availableWrite(&p->backQueue)>0?POLLIN:0;
+			owners[nfds++]=p;
+			struct segment s;
+			if(ringBuffer_peek(&p->queue, sizeof(s), (uint8_t *)&s))
+			{
+				if(s.release<=now)
+				{
+					fds[nfds-1].events|=POLLOUT;
+				}else if(s.release<next)
+				{
+					next=s.release;
+				}
+			}
+		}
+		int timeout=(int)((next-now+999999)/1000000);
+		if(poll(fds, nfds, timeout)<0)
+		{
+			continue;
+		}
+		if(fds[0].revents & POLLIN)
+		{
+			int fd=accept(listen_sock, NULL, NULL);
+			proxyPair * p=NULL;
+			for(int i=0;i<MAX_PAIRS && fd>=0;++i)
+			{
+				if(!pairs[i].used)
+				{
+					p=&pairs[i];
+					break;
+				}
+			}
+			int serverFd=p!=NULL?connect_upstream(hostname, port):-1;
+			if(serverFd<0)
+			{
+				fprintf(stderr, "netem: can not accept connection\n");
+				if(fd>=0)
+				{
+					close(fd);
+				}
+			}else
+			{
+				memset(p, 0, sizeof(*p));
+				p->used=true;
+				p->clientFd=fd;
+				p->serverFd=serverFd;
+				p->start=now_ns();
+				setnonblocking(fd);
+				setnonblocking(serverFd);
+				uint8_t * buffer=malloc(QUEUE_BYTES);
+				assert(buffer!=NULL);
+				ringBuffer_create(&p->queue, QUEUE_BYTES, buffer);
+				buffer=malloc(BACK_QUEUE_BYTES);
+				assert(buffer!=NULL);
+				ringBuffer_create(&p->backQueue, BACK_QUEUE_BYTES, buffer);
+				printf("netem: connection proxied\n");
+			}
+		}
+		now=now_ns();
+		for(int i=1;i<nfds;++i)
+		{
+			proxyPair * p=owners[i];
+			if(!p->used)
+			{
+				continue;
+			}
+			bool ok=true;
+			if(fds[i].fd==p->clientFd)
+			{
+				if(fds[i].revents & (POLLIN|POLLHUP|POLLERR))
+				{
+					ok=read_client(p);
+				}
+				if(fds[i].revents & POLLOUT)
+				{
+					ok=ok && write_client(p);
+				}
+			}else
+			{
+				if(fds[i].revents & (POLLIN|POLLHUP|POLLERR))
+				{
+					ok=read_server(p);
+				}
+				ok=ok && write_server(p, now);
+			}
+			if(!ok)
+			{
+				close_pair(p);
+			}
+		}
+	}
+	for(int i=0;i<MAX_PAIRS;++i)
+	{
+		if(pairs[i].used)
+		{
+			close_pair(&pairs[i]);
+		}
+	}
+	close(listen_sock);
+	return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * Replay a stream capture file of jack-tcp-server (-w) into a server: each recorded client connection is opened again
+ * and the recorded bytes are sent at their recorded arrival times, optionally accelerated.
+ * Messages of the server are read and discarded.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+
+#include "tcp-protocol.h"
+#include "streamCapture.h"
+
+/// Maximum number of replayed connections open at the same time
+#define MAX_CONNECTIONS 64
+/// Largest record that is replayed. Larger records are skipped.
+#define MAX_RECORD_BYTES (1024*1024)
+
+/// A replayed connection
+typedef struct {
+	bool used;
+	/// Identifier of the connection in the capture file
+	uint32_t connection;
+	int fd;
+	uint64_t bytes;
+} replayConnection;
+
+static replayConnection connections[MAX_CONNECTIONS];
+static volatile bool exitProgram=false;
+static uint8_t data[MAX_RECORD_BYTES];
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+/// Connect to the server. @return fd or -1 on error
+static int connect_server(const char * host, int port)
+{
+	struct addrinfo hints;
+	struct addrinfo * res;
+	char service[16];
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family=AF_UNSPEC;
+	hints.ai_socktype=SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+	if(getaddrinfo(host, service, &hints, &res)!=0)
+	{
+		fprintf(stderr, "%s: bad host name\n", host);
+		return -1;
+	}
+	int fd=-1;
+	for(struct addrinfo * ai=res;ai!=NULL;ai=ai->ai_next)
+	{
+		fd=socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(fd>=0 && connect(fd, ai->ai_addr, ai->ai_addrlen)==0)
+		{
+			break;
+		}
+		if(fd>=0)
+		{
+			close(fd);
+			fd=-1;
+		}
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+/// Find the replayed connection of a capture connection identifier. @return NULL when it is not open
+static replayConnection * find_connection(uint32_t connection)
+{
+	for(int i=0;i<MAX_CONNECTIONS;++i)
+	{
+		if(connections[i].used && connections[i].connection==connection)
+		{
+			return &connections[i];
+		}
+	}
+	return NULL;
+}
+static void close_connection(replayConnection * c)
+{
+	printf("replay: connection %u closed, %llu bytes sent\n", c->connection, (unsigned long long)c->bytes);
+	close(c->fd);
+	c->used=false;
+}
+/// Read and discard the messages of the server (clock synchronization requests, flow control)
+static void drain_server(void)
+{
+	for(int i=0;i<MAX_CONNECTIONS;++i)
+	{
+		uint8_t buf[256];
+		while(connections[i].used && recv(connections[i].fd, buf, sizeof(buf), MSG_DONTWAIT)>0)
+		{
+		}
+	}
+}
+/// Wait until the given CLOCK_MONOTONIC time, reading the messages of the server meanwhile
+static void wait_until(uint64_t t)
+{
+	while(!exitProgram)
+	{
+		drain_server();
+		uint64_t now=now_ns();
+		if(now>=t)
+		{
+			return;
+		}
+		uint64_t wait=t-now<1000000ull?t-now:1000000ull;
+		struct timespec ts={ 0, (long)wait };
+		nanosleep(&ts, NULL);
+	}
+}
+/// Linux SIGNAL handler to gracefully handle ctrl-c
+void intHandler(int dummy) {
+	exitProgram=true;
+}
+/// Parse parameters and replay the capture file
+int main(int argc, char *argv[])
+{
+	char hostname[128]="localhost";
+	int port=DEFAULT_PORT;
+	double speed=1.0;
+	int64_t only=-1;
+	bool list=false;
+	int c;
+
+	char *optstring = "hu:x:c:l";
+	struct option long_options[] = {
+		{ "help", 0, 0, 'h' },
+		{ "URL", 1, 0, 'u' },
+		{ "speed", 1, 0, 'x' },
+		{ "connection", 1, 0, 'c' },
+		{ "list", 0, 0, 'l' },
+		{ 0, 0, 0, 0 }
+	};
+	int longopt_index = 0;
+	int show_usage = 0;
+	while ((c = getopt_long (argc, argv, optstring, long_options, &longopt_index)) != -1) {
+		switch (c) {
+		case 'h':
+			show_usage++;
+			break;
+		case 'u':
+		{
+			char * colon =strchr(optarg, ':');
+			if(colon!=NULL)
+			{
+				*colon='\0';
+				port=atoi(colon+1);
+			}
+			snprintf(hostname, sizeof(hostname), "%s", optarg);
+			break;
+		}
+		case 'x':
+			speed=atof(optarg);
+			break;
+		case 'c':
+			only=atoll(optarg);
+			break;
+		case 'l':
+			list=true;
+			break;
+		default:
+			fprintf (stderr, "error\n");
+			show_usage++;
+			break;
+		}
+	}
+	if (show_usage || optind!=argc-1 || speed<0.0) {
+		fprintf (stderr, "usage: jack-tcp-replay [-u serverHost:port] [-x speed] [-c connection] [-l] captureFile\n");
+		exit (1);
+	}
+	FILE * file=fopen(argv[optind], "rb");
+	if(file==NULL)
+	{
+		perror(argv[optind]);
+		exit(1);
+	}
+	struct streamCapture_header header;
+	if(fread(&header, sizeof(header), 1, file)!=1 || memcmp(header.magic, STREAM_CAPTURE_MAGIC, sizeof(header.magic))!=0
+			|| header.recordSize!=sizeof(struct streamCapture_record))
+	{
+		fprintf(stderr, "%s: not a stream capture file\n", argv[optind]);
+		exit(1);
+	}
+
+	signal(SIGINT, intHandler);
+	signal(SIGTERM, intHandler);
+	signal(SIGPIPE, SIG_IGN);
+
+	if(!list)
+	{
+		printf("replay: %s to %s:%d speed %.2f\n", argv[optind], hostname, port, speed);
+	}
+	uint64_t start=now_ns();
+	uint64_t records=0;
+	uint64_t bytes=0;
+	uint64_t maxLateNs=0;
+	uint64_t lastNs=0;
+	struct streamCapture_record record;
+	while(!exitProgram && fread(&record, sizeof(record), 1, file)==1)
+	{
+		if(record.length>sizeof(data))
+		{
+			fprintf(stderr, "replay: skipping record of %u bytes\n", record.length);
+			fseek(file, record.length, SEEK_CUR);
+			continue;
+		}
+		if(record.length>0 && fread(data, record.length, 1, file)!=1)
+		{
+			fprintf(stderr, "replay: truncated record\n");
+			break;
+		}
+		lastNs=record.timeNs;
+		if(list)
+		{
+			if(record.type==STREAM_CAPTURE_CONNECT)
+			{
+				printf("connection %u: %.*s connected at %.3f s\n", record.connection, (int)record.length, (const char *)data, record.timeNs*1e-9);
+			}else if(record.type==STREAM_CAPTURE_CLOSE || record.type==STREAM_CAPTURE_LOST)
+			{
+				printf("connection %u: closed at %.3f s%s\n", record.connection, record.timeNs*1e-9,
+						record.type==STREAM_CAPTURE_LOST?", recording incomplete":"");
+			}
+			records++;
+			bytes+=record.type==STREAM_CAPTURE_DATA?record.length:0;
+			continue;
+		}
+		if(only>=0 && record.connection!=(uint32_t)only)
+		{
+			continue;
+		}
+		/// Speed 0 replays as fast as the server reads
+		if(speed>0.0)
+		{
+			uint64_t due=start+(uint64_t)(record.timeNs/speed);
+			wait_until(due);
+			uint64_t late=now_ns()-due;
+			if(late>maxLateNs)
+			{
+				maxLateNs=late;
+			}
+		}
+		replayConnection * r=find_connection(record.connection);
+		switch(record.type)
+		{
+		case STREAM_CAPTURE_CONNECT:
+		{
+			for(int i=0;i<MAX_CONNECTIONS && r==NULL;++i)
+			{
+				if(!connections[i].used)
+				{
+					r=&connections[i];
+				}
+			}
+			int fd=r!=NULL?connect_server(hostname, port):-1;
+			if(fd<0)
+			{
+				fprintf(stderr, "replay: can not open connection %u\n", record.connection);
+				break;
+			}
+			memset(r, 0, sizeof(*r));
+			r->used=true;
+			r->connection=record.connection;
+			r->fd=fd;
+			printf("replay: connection %u (%.*s) opened\n", record.connection, (int)record.length, (const char *)data);
+			break;
+		}
+		case STREAM_CAPTURE_DATA:
+			/// Blocking write: a slow server delays the replay like it would hold back a real client
+			for(uint32_t done=0;r!=NULL && done<record.length;)
+			{
+				ssize_t n=write(r->fd, data+done, record.length-done);
+				if(n<=0)
+				{
+					fprintf(stderr, "replay: connection %u: %s\n", record.connection, strerror(errno));
+					close_connection(r);
+					r=NULL;
+					break;
+				}
+				done+=n;
+				r->bytes+=n;
+				bytes+=n;
+			}
+			break;
+		case STREAM_CAPTURE_LOST:
+			fprintf(stderr, "replay: the recording of connection %u is incomplete\n", record.connection);
+			/* fall through */
+		case STREAM_CAPTURE_CLOSE:
+			if(r!=NULL)
+			{
+				close_connection(r);
+			}
+			break;
+		}
+		records++;
+	}
+	fclose(file);
+	for(int i=0;i<MAX_CONNECTIONS;++i)
+	{
+		if(connections[i].used)
+		{
+			close_connection(&connections[i]);
+		}
+	}
+	printf("replay report: records=%llu bytes=%llu seconds=%.1f wallSeconds=%.1f maxLateMs=%.1f\n", (unsigned long long)records,
+			(unsigned long long)bytes, lastNs*1e-9, list?0.0:(now_ns()-start)*1e-9, maxLateNs*1e-6);
+	return 0;
+}
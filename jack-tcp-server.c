@@ -1,6 +1,7 @@
 /* 
  * Open a TCP server and create a jack connection for each incoming TCP connection
  */
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -9,6 +10,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -16,6 +20,9 @@
 #include <getopt.h>
 #include <assert.h>
 #include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <sys/resource.h>
 
 #include <speex/speex_resampler.h>
 #include "speex/speex_preprocess.h"
@@ -24,20 +31,201 @@
 #include "tcp-protocol.h"
 #include "linked_list.h"
 #include "ringBuffer.h"
+#include "jitterEstimator.h"
+#include "asyncLog.h"
+#include "headless.h"
+#include "shmRing.h"
+#include "uringLoop.h"
+#include "fanoutRing.h"
+#include "serverConnection.h"
+#include "opusCodec.h"
+#include "timeStretch.h"
+#include "polyphaseResampler.h"
+#include "socketTuning.h"
+#include "bench.h"
+#include "streamCapture.h"
+#include "traceProbes.h"
+#include "recordingTap.h"
+#include "rtHardening.h"
+
+/// Adaptive buffer mode: target is this percentile of measured jitter plus JITTER_MARGIN_SECONDS
+#define JITTER_PERCENTILE (0.99f)
+/// Adaptive buffer mode: safety margin added to the measured jitter
+#define JITTER_MARGIN_SECONDS (0.05f)
+/// Adaptive buffer mode: interval of updating the target buffer length
+#define RETARGET_INTERVAL_SECONDS (1.0f)
+/// Adaptive buffer mode: when the target decreases it is decreased by at most this ratio in each update. Increase is applied immediately.
+#define RETARGET_MAX_DECREASE (0.05f)
+/// Server audio ringbuffers are sized to hold twice the target buffer length but at least twice this length
+#define MIN_RINGBUFFER_SECONDS (0.25f)
+/// Samples below this absolute value are considered silent (-60dBFS)
+#define SILENCE_THRESHOLD (0.001f)
+/// Silence is dropped or inserted only after the input was silent for this long
+#define SILENCE_MIN_RUN_SECONDS (0.01f)
+/// The stream becomes idle (resampling and copying is skipped) after the input was silent for this long
+#define IDLE_MIN_RUN_SECONDS (0.2f)
+/// Silence is dropped when the buffer is longer than target*(1+band) and inserted when it is shorter than target*(1-band)
+#define SILENCE_CORRECTION_BAND (0.05f)
+/// Interval of rewriting the status file
+#define STATUS_INTERVAL_SECONDS (1.0f)
+/// Synchronized playback: interval of the clock synchronization requests sent to a client
+#define SYNC_REQUEST_SECONDS (0.5f)
+/// Control messages sent to a connection: bytes of a message the socket did not take at once are kept for the next loop iteration
+#define CONTROL_PENDING_BYTES 256
+/// Synchronized playback: the clock offset is taken from the response with the shortest round trip of this many responses
+#define SYNC_WINDOW 8
+/// Synchronized playback: a change of the clock offset is applied gradually, only this part of it with each response
+#define SYNC_OFFSET_SMOOTHING 8
+/// Synchronized playback: smoothing factor of the playout error (applied at each resampling step)
+#define SYNC_ERROR_SMOOTHING (0.01)
+/// Synchronized playback: playback speed correction per second of playout error and its limit
+#define SYNC_GAIN (0.5)
+#define SYNC_MAX_CORRECTION (0.01)
+/// Synchronized playback: a larger playout error is corrected at once by dropping input frames or inserting silence
+#define SYNC_HARD_ERROR_SECONDS (0.02)
+/// Passthrough of streams at the local samplerate: copied frames kept to prime the resampler when the copy ends.
+/// Half of the filter length of the speex resampler at quality 10, more than the history of the polyphase resampler.
+#define PASSTHROUGH_HISTORY_FRAMES 128
+/// Flow control: the client is asked to drop audio when more than this ratio above the target length is buffered (the speed control band)
+#define FLOW_EXCESS_BAND (0.2f)
+/// Flow control: minimum interval of R_MSG_FLOW messages of a stream
+#define FLOW_INTERVAL_SECONDS (0.5f)
+
+/// Size of one interleaved audio frame in bytes
+#define FRAME_BYTES (NPORT*SAMPLE_SIZE_BYTES)
+
+/// Same-host transport: descriptors accepted in the handshake message. A client sends 2, the rest are closed.
+#define SHM_MAX_RECEIVED_FDS 8
 
 /// Epoll events list size that is maximum to process at once. Program is intended to serve 1 client so 32 is way too much but costs nothing.
 #define MAX_EVENTS      32
+/// io_uring loop: submission queue size
+#define URING_ENTRIES 256
+/// io_uring loop: number and size of the provided receive buffers
+#define URING_BUFFER_COUNT 1024
+#define URING_BUFFER_SIZE 4096
+/// io_uring loop: maximum number of clients whose messages are processed together after a wakeup
+#define URING_BATCH_SIZE 256
+/// io_uring loop: user data of the multishot poll on the epoll fd (listening sockets and same-host clients)
+#define URING_EPOLL_USERDATA 1
+/// io_uring loop: user data of cancel requests. Their completions are ignored.
+#define URING_CANCEL_USERDATA 0
+/// Relay mode: size of the ring of messages forwarded to the downstream servers
+#define RELAY_RINGBUFFER_BYTES (4*CLIENT_RINGBUFFER_BYTES*MAX_STREAMS)
 
 /// Each connected client stores one of this structure
 typedef struct tcpClient_str{
 	/// connected clients are organized into a linked list
 	linked_list list;
+    /// Unique identifier of the client. Used in telemetry records.
+    uint32_t id;
+    /// TCP socket of the client. Unix socket of a same-host shared memory client.
     int fd;
+    /// Same-host shared memory transport: eventfd signalled by the client when data was written into shm. -1 for TCP clients.
+    int eventFd;
+    /// The client uses the same-host shared memory transport instead of TCP
+    bool shm;
+    /// Same-host shared memory transport: the ring written by the client. Valid when eventFd>=0.
+    shmRing_t shmRing;
+    /// The client was shut down. The structure is freed after the current batch of epoll events was processed.
+    bool closed;
+    /// io_uring loop: a multishot recv is armed for fd. The structure is not freed until its last completion arrived.
+    bool uringArmed;
+    /// io_uring loop: data was received in the current wakeup and messages are going to be processed
+    bool uringBatched;
+    /// Stream capture (-w): the received bytes of the connection are recorded. Cleared when a record was dropped.
+    bool capturing;
+    /// Stream capture: a record of the connection was dropped so its recording ended early
+    bool captureLost;
+    /// Recording tap (-o): the name of the stream was handed to the recording. Used by the Jack thread only.
+    bool recordingOpen;
+    /// Multiplexed streams: the connection receives the messages and plays stream 0 itself.
+    /// Additional streams of the connection are separate clients with their own pipeline and ports (fd is -1 for them).
+    /// streams[id] is NULL until R_MSG_STREAM_PARAMETERS of the stream arrived. streams[0] is not used.
+    struct tcpClient_str * streams[MAX_STREAMS];
+    /// Multiplexed streams: the connection of an additional stream and the id of the stream. NULL for connections.
+    struct tcpClient_str * connection;
+    uint32_t streamId;
+    /// Relay mode: stream id of this stream on the downstream connections. -1 when the stream is not forwarded.
+    int relayStream;
+    /// Relay mode: the R_MSG_TIMESTAMP of the next audio chunk. It is forwarded together with the chunk or dropped with it.
+    struct media_timestamp relayTimestamp;
+    bool relayTimestampPending;
+    /// Synchronized playback: the stream carries R_MSG_TIMESTAMP messages. Each frame is played at its capture time plus bufferSeconds.
+    /// On a connection it also means that clock synchronization requests are sent.
+    bool sync;
+    /// Synchronized playback: capture time of the next audio chunk (sender clock). Valid when chunkTimePending.
+    int64_t chunkTimeNs;
+    bool chunkTimePending;
+    /// Synchronized playback: number of frames written into and consumed from audioOriginal, and the capture time (sender clock)
+    /// of the input frame anchorFrame. Valid when anchorValid.
+    uint64_t inputFrames;
+    uint64_t consumedFrames;
+    uint64_t anchorFrame;
+    int64_t anchorTimeNs;
+    bool anchorValid;
+    /// Synchronized playback: smoothed playout error in seconds. Positive means the stream is played late.
+    double syncError;
+    /// Clock synchronization of a connection: sender clock minus local clock in nanoseconds. Valid when clockSynced.
+    int64_t clockOffsetNs;
+    bool clockSynced;
+    /// Clock synchronization of a connection: the last SYNC_WINDOW responses (round trip time and offset)
+    int64_t syncRtt[SYNC_WINDOW];
+    int64_t syncOffset[SYNC_WINDOW];
+    uint32_t syncResponses;
+    /// Clock synchronization of a connection: time of the last request (CLOCK_MONOTONIC)
+    struct timespec lastTimeRequest;
+    /// Control messages of a connection (time requests and flow control) not yet taken by the socket
+    uint8_t controlPending[CONTROL_PENDING_BYTES];
+    uint32_t controlPendingBytes;
+    /// Flow control: time of the last R_MSG_FLOW message, the excess it reported and the number of R_MSG_FLOW messages sent
+    struct timespec lastFlow;
+    uint32_t flowExcess;
+    uint32_t flowMessages;
     char name[256];
     volatile bool started;
+    /// Playback was started early by fast-start mode and the buffer is still being grown to the target length by playing slow
+    bool growing;
+    /// Time when the first audio chunk of this client arrived (CLOCK_MONOTONIC). Used to log time to first audio.
+    struct timespec firstAudio;
+    /// Target length of the audio buffer in seconds. Playback speed is controlled to maintain this length.
+    /// Fixed bufferSeconds or continuously retargeted from the measured jitter in adaptive mode.
+    float targetSeconds;
+    /// Arrival jitter of audio chunks from this client
+    jitterEstimator jitter;
+    /// Time of the last target update (CLOCK_MONOTONIC)
+    struct timespec lastRetarget;
+    /// Playback speed ratio currently set in the resampler. See client_set_rate()
+    double rateRatio;
+    /// The stream is silent for a long time: resampling is skipped and silence is counted in idleFrames instead of writing zeros to "audio"
+    volatile bool idle;
+    /// Number of silent frames to be played after the content of the "audio" buffer. Increased by the network thread, consumed by the Jack thread.
+    volatile uint32_t idleFrames;
+    /// Fraction of an output frame not yet added to idleFrames
+    double idleRemainder;
+    /// Number of consecutive silent input samples (per channel) processed by resample()
+    uint32_t silentRun;
+    /// Number of silent input samples (per channel) dropped to decrease the buffer length
+    uint32_t trimmedSamples;
+    /// Number of silent samples (per channel) inserted to increase the buffer length
+    uint32_t insertedSamples;
+    /// Number of audio chunks dropped because audioOriginal was full
+    uint32_t overflowChunks;
+    /// Minimum and maximum of the buffered audio length since playback started
+    float minBuffered;
+    float maxBuffered;
+    /// Number of Jack periods when the audio buffer did not contain enough samples and silence was played instead. Written by the Jack thread.
+    volatile uint32_t underruns;
     /// Buffer to store data received from the TCP socket without modification. This stream contains messages prefixed with struct chunk_header
     /// The messages are parsed by process_messages()
     ringBuffer_t rb;
+    /// Incremental parser: header of the message being received. Its bytes were already consumed from rb when parseHeaderValid is set.
+    struct chunk_header parseHeader;
+    bool parseHeaderValid;
+    /// Incremental parser: the payload of the float audio chunk being received is written straight into audioOriginal of this stream
+    /// instead of waiting in rb for the whole message. payloadRemaining bytes of it are still missing. NULL when no payload is streamed.
+    struct tcpClient_str * payloadStream;
+    uint32_t payloadRemaining;
     /// Buffer to store audio frames converted to local samplerate. This is source of playback through Jack
     ringBuffer_t audio;
     /// Buffer to store audio frames in the samplerate of the client how it was sent.
@@ -47,11 +235,27 @@ typedef struct tcpClient_str{
     jack_port_t * ports[NPORT];
     /// Sample rate of the client source. Set by the R_MSG_STREAM_PARAMETERS message that has to arrive before the first audio frame.
     uint32_t samplerate;
+    /// Encoding of the audio chunks (SAMPLE_TYPE_...). Set by the R_MSG_STREAM_PARAMETERS message.
+    uint32_t sampletype;
+    /// Opus streams: the decoder. Packets are decoded by process_messages() into audioOriginal.
+    opusCodec decoder;
+    /// The stream has the local samplerate and plays at nominal speed: resample() copies the frames without the resampler
+    bool passthrough;
+    /// Passthrough: the last copied frames, a circular buffer with the oldest frame at passthroughHistoryPos. See client_prime_resampler()
+    float passthroughHistory[PASSTHROUGH_HISTORY_FRAMES*NPORT];
+    uint32_t passthroughHistoryPos;
+    /// Pitch preserving corrector (-c wsola): time-stretcher used instead of the resampler when the stream has the local samplerate
+    timeStretch stretch;
+    /// Thread CPU time used by the resampler or the time-stretcher in nanoseconds and the number of frames they produced
+    uint64_t correctorNs;
+    uint64_t correctorFrames;
     /// Count the samples written into the audio stream. Just for debugging purpose.
     uint32_t countSamples;
     /// Resampler that does resampling of input audio data from tcpClient.samplerate to local samplerate.
     /// When the "audio" buffer is too long or too short then playback speed is corrected with 1-3% by changing the input samplerate.
 	SpeexResamplerState * resampler_state;
+	/// Built-in resampler used instead of resampler_state with -R polyphase
+	polyphaseResampler polyphase;
 } tcpClient;
 
 /// This object is stored into the epoll event.ptr field. used to check whether the event originates from the listening server port.
@@ -63,6 +267,9 @@ typedef struct {
 static pthread_mutex_t tcpClients_list_lock = PTHREAD_MUTEX_INITIALIZER;
 /// Linked list of all connected clients
 static linked_list * tcpClients;
+/// Clients that were shut down. They are freed after processing the current batch of epoll events because
+/// a client may have more than one fd in a batch.
+static linked_list * closedClients;
 
 /// epoll fd - a single epoll instance is used to handle all networking
 static int epfd;
@@ -72,6 +279,95 @@ static jack_client_t *jackClient;
 static volatile bool exitProgram=false;
 /// local samplerate of the jackClient Jack connection.
 uint32_t samplerate;
+/// Target buffer length in seconds when adaptive mode is off. Initial target in adaptive mode.
+static float bufferSeconds=SERVER_BUFFER_SECONDS;
+/// Adaptive mode: retarget buffer length of each client from its measured network jitter
+static bool adaptiveBuffer=false;
+/// Adaptive mode: lower bound of the target buffer length
+static float minBufferSeconds=0.05f;
+/// Adaptive mode: upper bound of the target buffer length
+static float maxBufferSeconds=2.0f;
+/// Headless mode: no Jack server is used. The process callback is driven by a timer thread and output is discarded.
+/// Useful for soak tests with the network impairment emulator.
+static bool headless=false;
+/// Headless mode: samplerate of the simulated playback
+#define HEADLESS_SAMPLERATE 48000
+/// Headless mode: port buffers
+static jack_default_audio_sample_t headlessBuffers[NPORT][HEADLESS_PERIOD_FRAMES];
+/// Headless mode: clock drift of the simulated playback in parts per million
+static float headlessDrift=0.0f;
+/// Same-host shared memory transport: listen on this Unix socket path. Empty means disabled.
+static char shmSocketName[108]="";
+/// Receive TCP clients with the io_uring loop instead of epoll. Falls back to epoll when io_uring is not available.
+static bool useIoUring=false;
+/// io_uring loop instance
+static uringLoop_t uring;
+/// Number of network loop wakeups and network system calls (epoll_wait, read). Logged at exit to compare the loops.
+static uint64_t networkWakeups=0;
+static uint64_t networkSyscalls=0;
+/// Bytes of audio chunk payloads received and the bytes copied by the network thread on their way from the socket into the "audio"
+/// ringbuffers (the receive from the socket included). Logged at exit as copies per byte.
+static uint64_t audioPayloadBytes=0;
+static uint64_t audioCopyBytes=0;
+/// Identifier of the next connected client
+static uint32_t nextClientId=0;
+/// Binary telemetry of buffer control is written to this file. Empty means telemetry is disabled.
+static char telemetryFileName[256]="";
+/// Per client status (target buffer length, jitter, etc.) is written to this file periodically. Empty means no status file.
+static char statusFileName[256]="";
+/// Fast-start mode: start playback when this much audio is buffered and grow the buffer to the target length by playing slow.
+/// 0 means fast-start is disabled and playback starts when the target length is buffered.
+static float fastStartSeconds=0.0f;
+/// Fast-start mode: playback speed is slowed down by this ratio while the buffer is grown to the target length
+static float fastStartGrowth=0.02f;
+/// Quality of the resampler of new streams [0,10], 10 is best. Changed by the benchmarks only.
+static int resamplerQuality=10;
+/// Resample with the built-in polyphase resampler instead of speex (-R polyphase)
+static bool usePolyphase=false;
+/// Run the microbenchmarks, append the results to this file and exit. Empty means normal operation.
+static char benchFileName[256]="";
+/// Stream capture: record the bytes received from the clients into this file. Empty means no capture.
+static char captureFileName[256]="";
+/// Recording tap: record the played audio into WAV files in this directory. Empty means no recording.
+static char recordDirectory[256]="";
+/// Recording tap: record the mix of all streams instead of each stream, and the length of the files
+static bool recordMix=false;
+static uint32_t recordRotateSeconds=3600;
+/// Recording tap: set when the recording runs. The Jack thread may already run before.
+static volatile bool recording=false;
+/// Recording tap: longest Jack period of the mixed recording
+#define RECORD_MIX_MAX_FRAMES 8192
+/// Recording tap: mix of the current period and the number of frames played since start. Used by the Jack thread only.
+static jack_default_audio_sample_t recordMixFrames[RECORD_MIX_MAX_FRAMES*NPORT];
+static uint64_t playbackFrames=0;
+/// Relay mode: downstream servers that receive the messages of all streams unchanged
+static serverConnection relayTargets[FANOUT_MAX_READERS];
+static int nRelayTargets=0;
+/// Relay mode: the streams are only forwarded, not played. Jack is not used and audio is not resampled.
+static bool noPlayback=false;
+/// Relay mode: messages forwarded to the downstream servers, prefixed with struct chunk_header.
+/// Written once by the network thread and read by each downstream connection thread with its own read cursor.
+static fanoutRing_t relay;
+/// Relay mode: messages were written into the relay ring and are going to be published after the current batch
+static bool relayPending=false;
+/// Relay mode: messages not forwarded because a downstream connection did not read the relay ring fast enough
+static uint32_t relayDrops=0;
+/// Relay mode: stream slots of the downstream connections. relayStreams[i] is forwarded as stream i, NULL means the slot is free.
+/// relayParams[i] is its last R_MSG_STREAM_PARAMETERS message, sent by a downstream connection after it (re)connected.
+/// Both are written by the network thread and read by the downstream connection threads holding relayLock.
+static tcpClient * relayStreams[MAX_STREAMS];
+static struct stream_parameters relayParams[MAX_STREAMS];
+static pthread_mutex_t relayLock = PTHREAD_MUTEX_INITIALIZER;
+/// End of the period currently played by the Jack thread (CLOCK_MONOTONIC ns). Used to compute the playout time of buffered audio.
+static volatile int64_t playbackPeriodEndNs=0;
+/// Opus streams: the packet being decoded and the decoded frames when they do not fit into audioOriginal continuously.
+/// Used by the network thread only.
+static uint8_t opusPacket[OPUS_MAX_PACKET_BYTES];
+static float opusFrames[OPUS_MAX_FRAMES*NPORT];
+/// Correct the buffer length of streams that have the local samplerate with the pitch preserving time-stretcher instead of the resampler
+static bool stretchCorrector=false;
+/// Output of the time-stretcher. Used by the network thread only.
+static float stretchFrames[TIME_STRETCH_HOP*NPORT];
 /// Connect the output to these ports when the output ports are created.
 static char port_target_names[][128]={"Built-in Audio Analog Stereo:playback_FL", "Built-in Audio Analog Stereo:playback_FR"};
 
@@ -106,10 +402,41 @@ static int setnonblocking(int sockfd)
 	}
 	return 0;
 }
+/// find the minimum value of two helper function.
+static uint32_t min_u32(uint32_t a, uint32_t b)
+{
+	return a<b?a:b;
+}
+/// Current time of CLOCK_MONOTONIC in nanoseconds
+static int64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000ll+now.tv_nsec;
+}
+/// Get the buffer of an output port of the client. In headless mode all ports share a scratch buffer and output is discarded.
+static jack_default_audio_sample_t * get_port_buffer(tcpClient * c, int i, jack_nframes_t nframes)
+{
+	if(headless)
+	{
+		assert(nframes<=HEADLESS_PERIOD_FRAMES);
+		return headlessBuffers[i];
+	}
+	return jack_port_get_buffer(c->ports[i], nframes);
+}
 /// Jack calls us back for each requested frame for all ports handled by this program
 int jack_process_frames_callback (jack_nframes_t nframes, void *arg)
 {
-	pthread_mutex_lock (&tcpClients_list_lock);
+	TRACE_PROBE1(process_start, nframes);
+	TRACE_MUTEX_LOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
+	__atomic_store_n(&playbackPeriodEndNs, now_ns()+nframes*1000000000ll/samplerate, __ATOMIC_RELEASE);
+	/// Recording tap: the played frames of each stream or their mix are copied into the lock-free queue of the recording
+	bool mix=recording && recordMix && nframes<=RECORD_MIX_MAX_FRAMES;
+	bool mixed=false;
+	if(mix)
+	{
+		memset(recordMixFrames, 0, nframes*FRAME_BYTES);
+	}
 	linked_list * curr=tcpClients;
 	while(curr!=NULL)
 	{
@@ -119,35 +446,171 @@ int jack_process_frames_callback (jack_nframes_t nframes, void *arg)
 			jack_default_audio_sample_t * buff[NPORT];
 			for(int i=0;i<NPORT;++i)
 			{
-				buff[i]=jack_port_get_buffer(c->ports[i], nframes);
+				buff[i]=get_port_buffer(c, i, nframes);
+			}
+			bool tap=false;
+			if(recording && !recordMix)
+			{
+				if(!c->recordingOpen)
+				{
+					c->recordingOpen=recordingTap_open(c->id, c->name);
+				}
+				tap=recordingTap_begin(c->id, playbackFrames, nframes);
+			}
+			mixed|=mix;
+			/// Deinterleave the continuous spans of the ringbuffer into the port buffers
+			uint32_t frames=min_u32(nframes, ringBuffer_availableRead(&c->audio)/FRAME_BYTES);
+			uint32_t done=0;
+			while(done<frames)
+			{
+				uint8_t * data;
+				uint32_t n=ringBuffer_accessReadBuffer(&c->audio, &data, (frames-done)*FRAME_BYTES)/FRAME_BYTES;
+				if(n==0)
+				{
+					break;
+				}
+				const jack_default_audio_sample_t * samples=(const jack_default_audio_sample_t *)data;
+				for(uint32_t j=0;j<n;++j)
+				{
+					for(int i=0;i<NPORT;++i)
+					{
+						buff[i][done+j]=samples[j*NPORT+i];
+					}
+				}
+				if(tap)
+				{
+					recordingTap_append(samples, n*NPORT);
+				}
+				if(mix)
+				{
+					for(uint32_t j=0;j<n*NPORT;++j)
+					{
+						recordMixFrames[done*NPORT+j]+=samples[j];
+					}
+				}
+				ringBuffer_read(&c->audio, n*FRAME_BYTES, NULL);
+				done+=n;
 			}
-			for(int j=0;j<nframes;++j)
+			frames=done;
+			if(frames<nframes)
 			{
+				/// The rest of the period is silence: pending frames of an idle stream or an underrun
+				uint32_t missing=nframes-frames;
 				for(int i=0;i<NPORT;++i)
 				{
-					ringBuffer_read(&c->audio, SAMPLE_SIZE_BYTES, (uint8_t *)(buff[i]+j));
+					memset(buff[i]+frames, 0, missing*SAMPLE_SIZE_BYTES);
+				}
+				uint32_t idle=min_u32(missing, __atomic_load_n(&c->idleFrames, __ATOMIC_ACQUIRE));
+				__atomic_fetch_sub(&c->idleFrames, idle, __ATOMIC_ACQ_REL);
+				if(idle<missing)
+				{
+					c->underruns++;
+				}
+				if(tap)
+				{
+					recordingTap_append(NULL, missing*NPORT);
 				}
 			}
 		}
 		curr=curr->next;
 	}
-	pthread_mutex_unlock(&tcpClients_list_lock);
+	TRACE_MUTEX_UNLOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
+	if(mixed && recordingTap_begin(RECORDING_MIX_STREAM, playbackFrames, nframes))
+	{
+		recordingTap_append(recordMixFrames, nframes*NPORT);
+	}
+	playbackFrames+=nframes;
+	TRACE_PROBE1(process_end, nframes);
 	return 0;
 }
+/// CPU time used by the calling thread in nanoseconds
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+/// Current time of CLOCK_MONOTONIC in seconds
+static double now_seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec+now.tv_nsec*1e-9;
+}
+/// Seconds elapsed since the given CLOCK_MONOTONIC time
+static float elapsed_seconds(const struct timespec * since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (float)(now.tv_sec-since->tv_sec)+(now.tv_nsec-since->tv_nsec)*1e-9f;
+}
+/// CPU time used by the resampler or the time-stretcher of the client in percent of the duration of the audio they produced
+static double client_corrector_cpu(tcpClient * client)
+{
+	if(client->correctorFrames==0)
+	{
+		return 0.0;
+	}
+	return client->correctorNs*1e-7/((double)client->correctorFrames/samplerate);
+}
+/// Length of audio buffered for playback of the client in seconds
+static float client_buffered_seconds(tcpClient * client)
+{
+	uint32_t fill=ringBuffer_availableRead(&(client->audio));
+	return (((float)fill)/NPORT/SAMPLE_SIZE_BYTES+client->idleFrames)/samplerate;
+}
 /// Shut down a client and free all resources that was allocated for the client.
-/// Also remove the tcpClient struct from the linked list and free the client structure itself.
+/// Also remove the tcpClient struct from the linked list. The client structure itself is freed later by free_closed_clients().
 static void client_shutdown (tcpClient * tcp)
 {
-	printf("client_shutdown ...\n");
+	asyncLog_int(ASYNC_LOG_MAIN, "client_shutdown ...\n", 0, 0, 0, 0);
 	assert(tcp!=NULL);
-	epoll_ctl(epfd, EPOLL_CTL_DEL, tcp->fd, NULL);
-	close(tcp->fd);
-	for (int i = 0; i < NPORT; i++) {
+	assert(!tcp->closed);
+	TRACE_PROBE2(client_shutdown, tcp->id, tcp->underruns);
+	for(int i=1;i<MAX_STREAMS;++i)
+	{
+		if(tcp->streams[i]!=NULL)
+		{
+			client_shutdown(tcp->streams[i]);
+		}
+	}
+	if(tcp->connection!=NULL)
+	{
+		tcp->connection->streams[tcp->streamId]=NULL;
+	}
+	if(tcp->relayStream>=0)
+	{
+		TRACE_MUTEX_LOCK(&relayLock, TRACE_LOCK_RELAY);
+		relayStreams[tcp->relayStream]=NULL;
+		TRACE_MUTEX_UNLOCK(&relayLock, TRACE_LOCK_RELAY);
+	}
+	if(tcp->uringArmed)
+	{
+		uringLoop_cancel(&uring, (uintptr_t)tcp, URING_CANCEL_USERDATA);
+	}else if(tcp->fd>=0)
+	{
+		epoll_ctl(epfd, EPOLL_CTL_DEL, tcp->fd, NULL);
+	}
+	if(tcp->fd>=0)
+	{
+		close(tcp->fd);
+	}
+	if(tcp->eventFd>=0)
+	{
+		epoll_ctl(epfd, EPOLL_CTL_DEL, tcp->eventFd, NULL);
+		close(tcp->eventFd);
+		munmap(tcp->shmRing.header, tcp->shmRing.mappingSize);
+	}
+	for (int i = 0; i < NPORT && !headless && !noPlayback; i++) {
 		jack_port_unregister(jackClient, tcp->ports[i]);
 	}
-	pthread_mutex_lock(&tcpClients_list_lock);
+	if(tcp->capturing || tcp->captureLost)
+	{
+		streamCapture_record(tcp->id, tcp->captureLost?STREAM_CAPTURE_LOST:STREAM_CAPTURE_CLOSE, NULL, 0);
+	}
+	TRACE_MUTEX_LOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
 	linked_list_remove(&tcpClients, &(tcp->list));
-	pthread_mutex_unlock(&tcpClients_list_lock);
+	TRACE_MUTEX_UNLOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
 	if(tcp->rb.buffer!=NULL)
 	{
 		free(tcp->rb.buffer);
@@ -163,8 +626,36 @@ static void client_shutdown (tcpClient * tcp)
 		free(tcp->audioOriginal.buffer);
 		tcp->audioOriginal.buffer=NULL;
 	}
-	printf("client_shutdown done %s\n", tcp->name);
-	free(tcp);
+	if(tcp->decoder.state!=NULL)
+	{
+		asyncLog_double(ASYNC_LOG_MAIN, "Report Opus: %.1f kbit/s decode CPU: %.2f %%\n", opusCodec_kbps(&tcp->decoder), opusCodec_cpuPercent(&tcp->decoder), 0, 0);
+		opusCodec_destroy(&tcp->decoder);
+	}
+	polyphaseResampler_destroy(&tcp->polyphase);
+	asyncLog_text(ASYNC_LOG_MAIN, "Report %s: underruns: %lld overflow chunks: %lld jitter: %lld ms\n", tcp->name, tcp->underruns, tcp->overflowChunks,
+			(long long)(jitterEstimator_percentile(&tcp->jitter, JITTER_PERCENTILE)*1000.0f));
+	asyncLog_int(ASYNC_LOG_MAIN, "Report flow control messages: %lld\n", tcp->flowMessages, 0, 0, 0);
+	asyncLog_double(ASYNC_LOG_MAIN, "Report buffered min: %f max: %f target: %f\n", tcp->minBuffered, tcp->maxBuffered, tcp->targetSeconds, 0);
+	asyncLog_double(ASYNC_LOG_MAIN, "Report corrector CPU: %.3f %% stretched: %.0f frames\n", client_corrector_cpu(tcp), tcp->stretch.stretchedFrames, 0, 0);
+	asyncLog_text(ASYNC_LOG_MAIN, "client_shutdown done %s\n", tcp->name, 0, 0, 0);
+	tcp->closed=true;
+	linked_list_add(&closedClients, &(tcp->list));
+}
+/// Free the clients that were shut down
+/// @param all also free clients that still have an armed io_uring request (only when the io_uring instance was closed)
+static void free_closed_clients(bool all)
+{
+	linked_list * c=closedClients;
+	while(c!=NULL)
+	{
+		linked_list * next=c->next;
+		if(all || !((tcpClient *)c)->uringArmed)
+		{
+			linked_list_remove(&closedClients, c);
+			free(c);
+		}
+		c=next;
+	}
 }
 /// Jack shutdown callback - with pipewire it is never called in my experience
 /// When Jack shutdown happens there is nothing to do but exit the program.
@@ -173,19 +664,66 @@ static void jack_shutdown (void * arg)
 	printf("jack_shutdown\n");
 	exit(0);
 }
-/// Create a client object by tcp client socked fd
-/// Initialize all fields and add the client to the tcpClients list and to the epoll structure.
+/// Size of an audio ringbuffer in bytes that can hold twice the given buffer length at the given samplerate. The size is a multiple of a frame.
+/// Short lengths are rounded up to MIN_RINGBUFFER_SECONDS so there is always room for a few network chunks.
+static uint32_t audio_buffer_bytes(float seconds, uint32_t rate)
+{
+	if(seconds<MIN_RINGBUFFER_SECONDS)
+	{
+		seconds=MIN_RINGBUFFER_SECONDS;
+	}
+	return ((uint32_t)(seconds*2*rate))*NPORT*SAMPLE_SIZE_BYTES;
+}
+/// Reallocate a ringbuffer when it is smaller than bytes or much bigger than necessary. Content is kept.
+/// @param locked the buffer is read by the Jack thread so swapping the buffer must be done holding tcpClients_list_lock
+static void resize_ring(ringBuffer_t * rb, uint32_t bytes, bool locked)
+{
+	if(bytes>rb->bufferSize || bytes*4<rb->bufferSize)
+	{
+		uint8_t * buffer=calloc(bytes, 1);
+		assert(buffer!=NULL);
+		uint8_t * old=rb->buffer;
+		if(locked)
+		{
+			TRACE_MUTEX_LOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
+		}
+		bool moved=ringBuffer_moveTo(rb, bytes, buffer);
+		if(locked)
+		{
+			TRACE_MUTEX_UNLOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
+		}
+		free(moved?old:buffer);
+	}
+}
+/// Adapt the size of the audio ringbuffers of the client to its target buffer length
+static void client_resize_buffers(tcpClient * client)
+{
+	resize_ring(&client->audio, audio_buffer_bytes(client->targetSeconds, samplerate), true);
+	resize_ring(&client->audioOriginal, audio_buffer_bytes(client->targetSeconds, client->samplerate), false);
+}
+/// Create the playback pipeline of a stream: initialize all fields, allocate the audio buffers and add the client to the tcpClients list.
 /// Also open output Jack ports and connect their output to the desired port (port_target_names)
-static void openClient(int fd, struct sockaddr_in * cli_addr)
+/// @return NULL when the Jack ports can not be registered
+static tcpClient * client_create(const char * name)
 {
-	char buf[128];
 	tcpClient * tcp = (tcpClient *)calloc(sizeof(tcpClient), 1);
 	assert(tcp!=NULL);
-	tcp->fd=fd;
-	snprintf(tcp->name, sizeof(tcp->name), "TCP_%s_%d\n", buf,
-		       ntohs(cli_addr->sin_port));
+	tcp->fd=-1;
+	tcp->eventFd=-1;
+	tcp->relayStream=-1;
+	tcp->id=nextClientId++;
+	snprintf(tcp->name, sizeof(tcp->name), "%s", name);
+	TRACE_PROBE1(client_create, tcp->id);
+	tcp->targetSeconds=bufferSeconds;
+	tcp->rateRatio=1.0;
+	jitterEstimator_init(&tcp->jitter);
+	clock_gettime(CLOCK_MONOTONIC, &tcp->lastRetarget);
+	if(stretchCorrector)
+	{
+		timeStretch_init(&tcp->stretch);
+	}
 
-	for (int i = 0; i < NPORT; i++) {
+	for (int i = 0; i < NPORT && !headless && !noPlayback; i++) {
 		char name[512];
 
 		snprintf (name, sizeof(name), "input_%s_%d", tcp->name, i+1);
@@ -193,8 +731,14 @@ static void openClient(int fd, struct sockaddr_in * cli_addr)
 		tcp->ports[i] = jack_port_register (jackClient, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 		if(tcp->ports[i]==NULL)
 		{
-			fprintf (stderr, "cannot register input port \"%s\"!\n", name);
-			client_shutdown(tcp);
+			/// The client is not in tcpClients yet, so the Jack thread does not use the ports registered so far
+			asyncLog_text(ASYNC_LOG_MAIN, "%s: cannot register input port\n", tcp->name, 0, 0, 0);
+			for(int j=0;j<i;++j)
+			{
+				jack_port_unregister(jackClient, tcp->ports[j]);
+			}
+			free(tcp);
+			return NULL;
 		}
 		int err=jack_connect (jackClient, jack_port_name (tcp->ports[i]), port_target_names[i]);
 		if(err)
@@ -203,26 +747,47 @@ static void openClient(int fd, struct sockaddr_in * cli_addr)
 		}
 	}
 	{
-	uint8_t *buffer=calloc(CLIENT_RINGBUFFER_BYTES, 1);
+	uint32_t bytes=audio_buffer_bytes(tcp->targetSeconds, samplerate);
+	uint8_t *buffer=calloc(bytes, 1);
 	assert(buffer!=NULL);
-	ringBuffer_create(&(tcp->rb), CLIENT_RINGBUFFER_BYTES, buffer);
+	ringBuffer_create(&(tcp->audio), bytes, buffer);
 	}
 	{
-	uint8_t *buffer=calloc(SERVER_RINGBUFFER_BYTES, 1);
+	uint32_t bytes=audio_buffer_bytes(tcp->targetSeconds, SAMPLERATE);
+	uint8_t *buffer=calloc(bytes, 1);
 	assert(buffer!=NULL);
-	ringBuffer_create(&(tcp->audio), SERVER_RINGBUFFER_BYTES, buffer);
+	ringBuffer_create(&(tcp->audioOriginal), bytes, buffer);
 	}
+	TRACE_MUTEX_LOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
+	linked_list_add(&tcpClients, &(tcp->list));
+	TRACE_MUTEX_UNLOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
+	return tcp;
+}
+/// Create a client object by tcp client socked fd (or Unix socket fd of a same-host shared memory client)
+/// The connection plays stream 0. Add the fd to the epoll structure or to the io_uring loop.
+static void openClient(int fd, const char * name, bool shm)
+{
+	tcpClient * tcp = client_create(name);
+	if(tcp==NULL)
 	{
-	uint8_t *buffer=calloc(SERVER_RINGBUFFER_BYTES, 1);
+		close(fd);
+		return;
+	}
+	uint8_t *buffer=calloc(CLIENT_RINGBUFFER_BYTES, 1);
 	assert(buffer!=NULL);
-	ringBuffer_create(&(tcp->audioOriginal), SERVER_RINGBUFFER_BYTES, buffer);
+	tcp->fd=fd;
+	tcp->shm=shm;
+	ringBuffer_create(&(tcp->rb), CLIENT_RINGBUFFER_BYTES, buffer);
+	tcp->capturing=streamCapture_enabled() && streamCapture_record(tcp->id, STREAM_CAPTURE_CONNECT, (const uint8_t *)tcp->name, strlen(tcp->name));
+	if(useIoUring && !shm && uringLoop_recv(&uring, fd, (uintptr_t)tcp))
+	{
+		tcp->uringArmed=true;
+	}else
+	{
+		epoll_ctl_add(epfd, fd,
+			      EPOLLIN | EPOLLET | EPOLLRDHUP |
+			      EPOLLHUP, tcp);
 	}
-	pthread_mutex_lock(&tcpClients_list_lock);
-	linked_list_add(&tcpClients, &(tcp->list));
-	pthread_mutex_unlock(&tcpClients_list_lock);
-	epoll_ctl_add(epfd, fd,
-		      EPOLLIN | EPOLLET | EPOLLRDHUP |
-		      EPOLLHUP, tcp);
 }
 
 /// Linux SIGNAL handler to gracefully handle ctrl-c
@@ -231,23 +796,296 @@ void intHandler(int dummy) {
 }
 /// Count all received audio bytes for debugging purpose
 static uint32_t receivedAudioBytes=0;
-/// find the minimum value of two helper function.
-static uint32_t min_u32(uint32_t a, uint32_t b)
+/// Are all samples below SILENCE_THRESHOLD?
+static bool is_silent(const float * samples, uint32_t n)
 {
-	return a<b?a:b;
+	for(uint32_t i=0;i<n;++i)
+	{
+		if(fabsf(samples[i])>=SILENCE_THRESHOLD)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+/// Set the playback speed of the client: the resampler handles the input as if its samplerate was ratio*client->samplerate
+static void client_set_rate(tcpClient * client, double ratio)
+{
+	client->rateRatio=ratio;
+	if(client->polyphase.coefficients!=NULL)
+	{
+		polyphaseResampler_setRate(&client->polyphase, ratio*client->samplerate, samplerate);
+		return;
+	}
+	speex_resampler_set_rate(client->resampler_state, (uint32_t)(ratio*client->samplerate), samplerate);
+}
+/// Synchronized playback: the connection that received the stream. It holds the clock synchronization state.
+static tcpClient * client_connection(tcpClient * client)
+{
+	return client->connection!=NULL?client->connection:client;
+}
+/// Synchronized playback: playout error of the newest resampled frame in seconds. Positive means it is going to be played later than scheduled.
+/// A frame is scheduled at its capture time converted to the local clock plus bufferSeconds, so all servers play it at the same time.
+/// @return false when the error is not known yet (no timestamp or no clock synchronization yet)
+static bool client_sync_error(tcpClient * client, double * error)
+{
+	tcpClient * connection=client_connection(client);
+	if(!client->anchorValid || !connection->clockSynced)
+	{
+		return false;
+	}
+	int64_t captureNs=client->anchorTimeNs+((int64_t)(client->consumedFrames-client->anchorFrame))*1000000000ll/client->samplerate;
+	int64_t scheduledNs=captureNs-connection->clockOffsetNs+(int64_t)(bufferSeconds*1e9);
+	int64_t playoutNs=__atomic_load_n(&playbackPeriodEndNs, __ATOMIC_ACQUIRE)+(int64_t)(client_buffered_seconds(client)*1e9);
+	*error=(playoutNs-scheduledNs)*1e-9;
+	return true;
+}
+/// Synchronized playback: update the playout error and set the playback speed to remove it. The target buffer length is the length
+/// that would play the newest frame at its scheduled time.
+/// @return false when the error is not known yet
+static bool control_sync(tcpClient * client, float seconds)
+{
+	double error;
+	if(!client_sync_error(client, &error))
+	{
+		return false;
+	}
+	client->syncError=client->started?client->syncError+(error-client->syncError)*SYNC_ERROR_SMOOTHING:error;
+	client->targetSeconds=seconds-(float)client->syncError;
+	double correction=client->syncError*SYNC_GAIN;
+	if(correction>SYNC_MAX_CORRECTION)
+	{
+		correction=SYNC_MAX_CORRECTION;
+	}else if(correction<-SYNC_MAX_CORRECTION)
+	{
+		correction=-SYNC_MAX_CORRECTION;
+	}
+	client_set_rate(client, 1.0+correction);
+	return true;
+}
+/// Check the current buffered length of samples and update resampler to control the buffer length around the target length.
+/// Also start playback when enough data is buffered.
+static void control_buffer_length(tcpClient * client)
+{
+	float seconds=client_buffered_seconds(client);
+	bool synced=client->sync && control_sync(client, seconds);
+	float target=client->targetSeconds;
+
+	if(client->countSamples>48000)
+	{
+		// Log length of buffer to stdout ~every second once.
+		asyncLog_double(ASYNC_LOG_MAIN, "Seconds buffered: %f target: %f\n", seconds, target, 0, 0);
+		if(synced)
+		{
+			asyncLog_double(ASYNC_LOG_MAIN, "Sync error: %.3f ms rate: %f\n", client->syncError*1000.0, client->rateRatio, 0, 0);
+		}
+		asyncLog_text(ASYNC_LOG_MAIN, "%s underruns: %lld trimmed: %lld inserted: %lld\n", client->name, client->underruns,
+				client->trimmedSamples, client->insertedSamples);
+		client->countSamples=0;
+	}
+	if(client->growing && seconds>=target)
+	{
+		client->growing=false;
+		asyncLog_int(ASYNC_LOG_MAIN, "Fast-start: target buffer length reached\n", 0, 0, 0, 0);
+	}
+	if(client->sync)
+	{
+		/// Synchronized playback: speed was set by control_sync()
+	}else if(client->growing)
+	{
+		/// Fast-start: play slow until the target buffer length is reached
+		client_set_rate(client, 1.0-fastStartGrowth);
+	}else if(seconds>target*1.4)
+	{
+		client_set_rate(client, 1.03);
+	}else if(seconds>target*1.2)
+	{
+		client_set_rate(client, 1.01);
+	}
+	else if(seconds<target*.6)
+	{
+		client_set_rate(client, 0.97);
+	}else if(seconds<target*.8)
+	{
+		client_set_rate(client, 0.99);
+	}else
+	{
+		client_set_rate(client, 1.0);
+	}
+	asyncLog_telemetry(ASYNC_LOG_MAIN, client->id, seconds, target, client->rateRatio);
+	if(client->started)
+	{
+		if(seconds<client->minBuffered || client->minBuffered==0.0f)
+		{
+			client->minBuffered=seconds;
+		}
+		if(seconds>client->maxBuffered)
+		{
+			client->maxBuffered=seconds;
+		}
+	}
+
+	/// Start playback when desired buffer length was reached.
+	/// In fast-start mode start much earlier and grow the buffer while playing.
+	if(!client->started)
+	{
+		if(client->sync)
+		{
+			/// Synchronized playback: start when the newest frame would be played at its scheduled time
+			client->started=synced && client->syncError>=0.0;
+		}else if(fastStartSeconds>0.0f && seconds>=fastStartSeconds && seconds<target)
+		{
+			client->growing=true;
+			client->started=true;
+		}else if(seconds>=target)
+		{
+			client->started=true;
+		}
+		if(client->started)
+		{
+			TRACE_PROBE1(client_start, client->id);
+			asyncLog_double(ASYNC_LOG_MAIN, "Playback started. Time to first audio: %.1f ms\n", elapsed_seconds(&client->firstAudio)*1000.0f, 0, 0, 0);
+		}
+	}
+}
+/// Audio returned on an idle stream: pending silent frames are written into the audio ringbuffer as zeros
+/// so they are played in the correct order before the new audio samples.
+static void client_leave_idle(tcpClient * client)
+{
+	TRACE_MUTEX_LOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
+	uint32_t bytes=client->idleFrames*NPORT*SAMPLE_SIZE_BYTES;
+	uint32_t available=ringBuffer_availableWrite(&(client->audio))/NPORT/SAMPLE_SIZE_BYTES*NPORT*SAMPLE_SIZE_BYTES;
+	if(bytes>available)
+	{
+		client->trimmedSamples+=(bytes-available)/NPORT/SAMPLE_SIZE_BYTES;
+		bytes=available;
+	}
+	while(bytes>0)
+	{
+		uint8_t * data;
+		uint32_t n=ringBuffer_accessWriteBuffer(&(client->audio), &data, bytes);
+		memset(data, 0, n);
+		ringBuffer_write(&(client->audio), n, NULL);
+		bytes-=n;
+	}
+	client->idleFrames=0;
+	client->idle=false;
+	TRACE_MUTEX_UNLOCK(&tcpClients_list_lock, TRACE_LOCK_CLIENTS);
+}
+/// Synchronized playback: correct a large playout error at once. A late stream drops input frames, an early stream gets silence inserted.
+/// @return true when frames were dropped or inserted
+static bool client_sync_correct(tcpClient * client)
+{
+	if(fabs(client->syncError)<SYNC_HARD_ERROR_SECONDS)
+	{
+		return false;
+	}
+	if(client->syncError>0.0)
+	{
+		uint32_t frames=min_u32((uint32_t)(client->syncError*client->samplerate), ringBuffer_availableRead(&(client->audioOriginal))/FRAME_BYTES);
+		if(frames==0)
+		{
+			return false;
+		}
+		ringBuffer_read(&(client->audioOriginal), frames*FRAME_BYTES, NULL);
+		client->consumedFrames+=frames;
+		client->trimmedSamples+=frames;
+		client->syncError-=((double)frames)/client->samplerate;
+	}else
+	{
+		uint32_t frames=min_u32((uint32_t)(-client->syncError*samplerate), ringBuffer_availableWrite(&(client->audio))/FRAME_BYTES);
+		if(frames==0)
+		{
+			return false;
+		}
+		if(client->idle)
+		{
+			__atomic_fetch_add(&client->idleFrames, frames, __ATOMIC_RELEASE);
+		}else
+		{
+			uint32_t bytes=frames*FRAME_BYTES;
+			while(bytes>0)
+			{
+				uint8_t * data;
+				uint32_t n=ringBuffer_accessWriteBuffer(&(client->audio), &data, bytes);
+				memset(data, 0, n);
+				ringBuffer_write(&(client->audio), n, NULL);
+				bytes-=n;
+			}
+		}
+		client->insertedSamples+=frames;
+		client->syncError+=((double)frames)/samplerate;
+	}
+	return true;
+}
+/// Passthrough: keep the frames copied by resample(), the newest PASSTHROUGH_HISTORY_FRAMES of them are used by client_prime_resampler()
+static void client_keep_history(tcpClient * client, const float * frames, uint32_t n)
+{
+	if(n>PASSTHROUGH_HISTORY_FRAMES)
+	{
+		frames+=(n-PASSTHROUGH_HISTORY_FRAMES)*NPORT;
+		n=PASSTHROUGH_HISTORY_FRAMES;
+	}
+	uint32_t first=min_u32(n, PASSTHROUGH_HISTORY_FRAMES-client->passthroughHistoryPos);
+	memcpy(client->passthroughHistory+client->passthroughHistoryPos*NPORT, frames, first*FRAME_BYTES);
+	memcpy(client->passthroughHistory, frames+first*NPORT, (n-first)*FRAME_BYTES);
+	client->passthroughHistoryPos=(client->passthroughHistoryPos+n)%PASSTHROUGH_HISTORY_FRAMES;
+}
+/// Passthrough ends: prime the resampler with the last copied frames, so its first output frame is the next input frame
+/// and its filter sees the real past input. Without this the resampler would start from silence and the switch would click.
+/// @return false when the input is shorter than the lookahead of the resampler: the copy goes on for now
+static bool client_prime_resampler(tcpClient * client)
+{
+	float frames[2*PASSTHROUGH_HISTORY_FRAMES*NPORT];
+	uint32_t older=PASSTHROUGH_HISTORY_FRAMES-client->passthroughHistoryPos;
+	memcpy(frames, client->passthroughHistory+client->passthroughHistoryPos*NPORT, older*FRAME_BYTES);
+	memcpy(frames+older*NPORT, client->passthroughHistory, client->passthroughHistoryPos*FRAME_BYTES);
+	if(client->polyphase.coefficients!=NULL)
+	{
+		polyphaseResampler_prime(&client->polyphase, frames+(PASSTHROUGH_HISTORY_FRAMES-POLYPHASE_HISTORY)*NPORT);
+		return true;
+	}
+	/// speex can not be given a history. After skip_zeros() at 1:1 its output frame i is input frame i, so the history is resampled
+	/// and its output dropped. The lookahead the filter needs is taken from the next input and stays in the resampler like in normal operation.
+	if(ringBuffer_availableRead(&(client->audioOriginal))<PASSTHROUGH_HISTORY_FRAMES*FRAME_BYTES)
+	{
+		return false;
+	}
+	ringBuffer_peek(&(client->audioOriginal), PASSTHROUGH_HISTORY_FRAMES*FRAME_BYTES, (uint8_t *)&(frames[PASSTHROUGH_HISTORY_FRAMES*NPORT]));
+	float dropped[PASSTHROUGH_HISTORY_FRAMES*NPORT];
+	spx_uint32_t in_len=2*PASSTHROUGH_HISTORY_FRAMES;
+	spx_uint32_t out_len=PASSTHROUGH_HISTORY_FRAMES;
+	speex_resampler_set_rate(client->resampler_state, client->samplerate, samplerate);
+	speex_resampler_reset_mem(client->resampler_state);
+	speex_resampler_skip_zeros(client->resampler_state);
+	speex_resampler_process_interleaved_float(client->resampler_state, frames, &in_len, dropped, &out_len);
+	uint32_t consumed=in_len>PASSTHROUGH_HISTORY_FRAMES?in_len-PASSTHROUGH_HISTORY_FRAMES:0;
+	ringBuffer_read(&(client->audioOriginal), consumed*FRAME_BYTES, NULL);
+	client->consumedFrames+=consumed;
+	client_set_rate(client, client->rateRatio);
+	return true;
 }
 /// Size maximum number of float samples when resampling input and output buffer.
-/// The value could be anything in theory but it may have effect on performance.
-/// Buffers are allocated on stack that limits the maximum value
+/// The value could be anything in theory but it may have effect on performance: the buffer length is controlled after each step.
+/// The samples are processed in place in the ringbuffers. Stack buffers of this size are only used when a frame is split by the end of a ringbuffer.
 #define RESAMPLE_BUFFER_SIZE 128
 /// Process all data in audioOriginal and write the resampled data into "audio"
 /// Run until source is empty or target is full
+/// The input is read in place from the continuous spans of audioOriginal and the output is written in place into the continuous spans of "audio".
 static void resample(tcpClient * client)
 {
 	float input_frame[RESAMPLE_BUFFER_SIZE];
 	float output_frame[RESAMPLE_BUFFER_SIZE];
+	TRACE_PROBE2(resample_start, client->id, ringBuffer_availableRead(&(client->audioOriginal))/FRAME_BYTES);
 	while(true)
 	{
+		/// Pitch preserving corrector: while the time-stretcher holds input that was not played yet it has to process the following input too
+		bool stretch=stretchCorrector && client->samplerate==samplerate;
+		bool stretchBusy=stretch && timeStretch_busy(&client->stretch);
+		if(client->sync && client->started && !stretchBusy && client_sync_correct(client))
+		{
+			continue;
+		}
 		uint32_t avrb=ringBuffer_availableRead(&(client->audioOriginal));
 		uint32_t avwb=ringBuffer_availableWrite(&(client->audio));
 		spx_uint32_t in_len=min_u32(RESAMPLE_BUFFER_SIZE/NPORT, avrb/NPORT/sizeof(float));
@@ -256,160 +1094,1460 @@ static void resample(tcpClient * client)
 		if(out_len<1||in_len<1)
 		{
 			// printf("resample ret\n");
+			TRACE_PROBE1(resample_end, client->id);
 			return;
 		}
-		/// Read data but do not advance read pointer: we don't yet know the number of samples actually processed
-		ringBuffer_peek(&(client->audioOriginal), in_len*NPORT*sizeof(float), (uint8_t *)&(input_frame[0]));
-		assert(client->resampler_state!=NULL);
-		int err=speex_resampler_process_interleaved_float(client->resampler_state,
-										 &(input_frame[0]), // const spx_int16_t *in,
-										 &in_len, //spx_uint32_t *in_len,
-										 &(output_frame[0]), //spx_int16_t *out,
-										 &out_len //spx_uint32_t *out_len
-						);
-		/// Consume the processed data. The data is already read we just adjust the pointer without copying data
-		ringBuffer_read(&(client->audioOriginal), in_len*NPORT*sizeof(float), NULL);
-		/// Write the created samples into the output
-		ringBuffer_write(&(client->audio), out_len*NPORT*sizeof(float), (uint8_t *)&(output_frame[0]));
-		client->countSamples+=out_len/NPORT;
-
-		/// Check the current buffered length of samples and update resampler to control the buffer length around the target length.
-		uint32_t fill=ringBuffer_availableRead(&(client->audio));
-		float seconds=((float)fill)/NPORT/SAMPLE_SIZE_BYTES/samplerate;
-
-		if(client->countSamples>48000)
+		/// Use the data in place but do not advance read pointer: we don't yet know the number of samples actually processed
+		uint8_t * span;
+		const float * input=input_frame;
+		if(ringBuffer_accessReadBuffer(&(client->audioOriginal), &span, in_len*FRAME_BYTES)/FRAME_BYTES>=in_len)
+		{
+			input=(const float *)span;
+		}else
+		{
+			ringBuffer_peek(&(client->audioOriginal), in_len*FRAME_BYTES, (uint8_t *)&(input_frame[0]));
+			audioCopyBytes+=in_len*FRAME_BYTES;
+		}
+		float * output=output_frame;
+		if(ringBuffer_accessWriteBuffer(&(client->audio), &span, out_len*FRAME_BYTES)/FRAME_BYTES>=out_len)
+		{
+			output=(float *)span;
+		}
+		/// Latency correction during silence: drop silent input when the buffer is too long and insert silence when it is too short.
+		/// This is inaudible and costs no resampler CPU. Only done inside a silent run so the decay of sounds is not cut.
+		/// Synchronized streams follow their playout schedule instead (see client_sync_correct()).
+		bool silent=is_silent(input, in_len*NPORT);
+		if(silent && client->started && !client->sync && !stretchBusy && client->silentRun>=SILENCE_MIN_RUN_SECONDS*client->samplerate)
+		{
+			float seconds=client_buffered_seconds(client);
+			if(seconds>client->targetSeconds*(1.0f+SILENCE_CORRECTION_BAND))
+			{
+				ringBuffer_read(&(client->audioOriginal), in_len*NPORT*sizeof(float), NULL);
+				client->consumedFrames+=in_len;
+				client->silentRun+=in_len;
+				client->trimmedSamples+=in_len;
+				continue;
+			}else if(seconds<client->targetSeconds*(1.0f-SILENCE_CORRECTION_BAND))
+			{
+				if(client->idle)
+				{
+					__atomic_fetch_add(&client->idleFrames, out_len, __ATOMIC_RELEASE);
+				}else
+				{
+					memset(output, 0, out_len*NPORT*sizeof(float));
+					ringBuffer_write(&(client->audio), out_len*NPORT*sizeof(float), output==output_frame?(uint8_t *)&(output_frame[0]):NULL);
+				}
+				client->insertedSamples+=out_len;
+				continue;
+			}
+		}
+		/// Idle stream fast path: after a long silent run the resampler is skipped and only the number of silent output frames is counted.
+		/// The Jack thread plays these frames as zero-filled periods without touching the audio ringbuffer.
+		if(silent && client->started && !stretchBusy && (client->idle || client->silentRun>=IDLE_MIN_RUN_SECONDS*client->samplerate))
+		{
+			client->idle=true;
+			ringBuffer_read(&(client->audioOriginal), in_len*NPORT*sizeof(float), NULL);
+			client->consumedFrames+=in_len;
+			client->silentRun+=in_len;
+			client->idleRemainder+=((double)in_len)*samplerate/(client->rateRatio*client->samplerate);
+			uint32_t frames=(uint32_t)client->idleRemainder;
+			client->idleRemainder-=frames;
+			__atomic_fetch_add(&client->idleFrames, frames, __ATOMIC_RELEASE);
+			client->countSamples+=frames;
+			control_buffer_length(client);
+			continue;
+		}
+		if(client->idle)
+		{
+			client_leave_idle(client);
+		}
+		if(stretch)
 		{
-			// Log length of buffer to stdout ~every second once.
-			printf("Seconds buffered: %f\n", seconds);
-			client->countSamples=0;
+			/// The time-stretcher copies at nominal speed and stretches while the speed is corrected, in hops of TIME_STRETCH_HOP frames
+			uint32_t frames=min_u32(in_len, timeStretch_space(&client->stretch));
+			timeStretch_write(&client->stretch, input, frames);
+			ringBuffer_read(&(client->audioOriginal), frames*FRAME_BYTES, NULL);
+			client->silentRun=silent?client->silentRun+frames:0;
+			uint64_t start=thread_cpu_ns();
+			uint32_t n=timeStretch_process(&client->stretch, client->rateRatio, stretchFrames, min_u32(TIME_STRETCH_HOP, avwb/FRAME_BYTES), &client->consumedFrames);
+			client->correctorNs+=thread_cpu_ns()-start;
+			client->correctorFrames+=n;
+			ringBuffer_write(&(client->audio), n*FRAME_BYTES, (uint8_t *)&(stretchFrames[0]));
+			client->countSamples+=n;
+			control_buffer_length(client);
+			if(frames==0 && n==0)
+			{
+				/// The stretcher is full and waits for space in "audio"
+				TRACE_PROBE1(resample_end, client->id);
+				return;
+			}
+			continue;
 		}
-		if(seconds>SERVER_BUFFER_SECONDS*1.4)
+		/// Matching samplerates at nominal speed: the frames are copied and the resampler is skipped.
+		/// The resampler delays its output by half of its filter length, so the copy is started only in a silent run
+		/// where skipping the delayed frames is not audible. A speed correction switches back to the resampler at once,
+		/// primed with the copied frames so the output continues without a gap.
+		bool direct=client->samplerate==samplerate && client->rateRatio==1.0;
+		if(direct && !client->passthrough && client->silentRun>=SILENCE_MIN_RUN_SECONDS*client->samplerate)
 		{
-			speex_resampler_set_rate(client->resampler_state, (uint32_t)(1.03*client->samplerate), samplerate);
-		}else if(seconds>SERVER_BUFFER_SECONDS*1.2)
+			client->passthrough=true;
+			memset(client->passthroughHistory, 0, sizeof(client->passthroughHistory));
+			client->passthroughHistoryPos=0;
+		}else if(!direct && client->passthrough && client_prime_resampler(client))
 		{
-			speex_resampler_set_rate(client->resampler_state, (uint32_t)(1.01*client->samplerate), samplerate);
+			client->passthrough=false;
+			continue;
 		}
-		else if(seconds<SERVER_BUFFER_SECONDS*.6)
+		if(client->passthrough)
 		{
-			speex_resampler_set_rate(client->resampler_state, (uint32_t)(0.97*client->samplerate), samplerate);
-		}else if(seconds<SERVER_BUFFER_SECONDS*.8)
+			uint32_t frames=min_u32(in_len, out_len);
+			memcpy(output, input, frames*FRAME_BYTES);
+			client_keep_history(client, input, frames);
+			audioCopyBytes+=frames*FRAME_BYTES;
+			ringBuffer_read(&(client->audioOriginal), frames*FRAME_BYTES, NULL);
+			client->consumedFrames+=frames;
+			client->silentRun=silent?client->silentRun+frames:0;
+			ringBuffer_write(&(client->audio), frames*FRAME_BYTES, output==output_frame?(uint8_t *)&(output_frame[0]):NULL);
+			client->countSamples+=frames;
+			client->correctorFrames+=frames;
+			control_buffer_length(client);
+			continue;
+		}
+		uint64_t start=thread_cpu_ns();
+		int err=0;
+		if(client->polyphase.coefficients!=NULL)
 		{
-			speex_resampler_set_rate(client->resampler_state, (uint32_t)(0.99*client->samplerate), samplerate);
+			polyphaseResampler_process(&client->polyphase, input, &in_len, output, &out_len);
 		}else
 		{
-			speex_resampler_set_rate(client->resampler_state, client->samplerate, samplerate);
+			assert(client->resampler_state!=NULL);
+			err=speex_resampler_process_interleaved_float(client->resampler_state,
+										 input, // const spx_int16_t *in,
+										 &in_len, //spx_uint32_t *in_len,
+										 output, //spx_int16_t *out,
+										 &out_len //spx_uint32_t *out_len
+						);
 		}
-
-		/// Start playback when desired buffer length was reached
-		if(!client->started && seconds>=SERVER_BUFFER_SECONDS)
+		client->correctorNs+=thread_cpu_ns()-start;
+		client->correctorFrames+=out_len;
+		TRACE_PROBE3(resample_batch, client->id, in_len, out_len);
+		/// Consume the processed data. The data is already read we just adjust the pointer without copying data
+		ringBuffer_read(&(client->audioOriginal), in_len*NPORT*sizeof(float), NULL);
+		client->consumedFrames+=in_len;
+		client->silentRun=silent?client->silentRun+in_len:0;
+		/// Publish the created samples. They are already in place unless the stack buffer was used.
+		if(output==output_frame)
 		{
-			client->started=true;
+			audioCopyBytes+=out_len*FRAME_BYTES;
 		}
+		ringBuffer_write(&(client->audio), out_len*NPORT*sizeof(float), output==output_frame?(uint8_t *)&(output_frame[0]):NULL);
+		client->countSamples+=out_len/NPORT;
+
+		control_buffer_length(client);
 
 		/// Log resampler error - in case it actually happens the logging should be improved
 		if(err!=0)
 		{
-			printf("speex_resampler_process_interleaved_float error: %d", err);
+			asyncLog_int(ASYNC_LOG_MAIN, "speex_resampler_process_interleaved_float error: %lld\n", err, 0, 0, 0);
 		}
 	}
 }
-/// Read the raw tcp stream in "rb" buffer and parse messages and process them.
-/// Audio data messages result in putting remote audio data (remote samplerate) to audioOriginal buffer.
-/// @return true means there was an error in the stream and client was disposed
-static bool process_messages(tcpClient * client)
+/// Adaptive mode: update the target buffer length from the measured jitter and adapt the ringbuffer sizes to the new target.
+/// Increase is applied at once, decrease is done in small steps so a single calm period does not remove all safety margin.
+static void client_retarget(tcpClient * client)
+{
+	if(elapsed_seconds(&client->lastRetarget)<RETARGET_INTERVAL_SECONDS)
+	{
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &client->lastRetarget);
+	float target=jitterEstimator_percentile(&client->jitter, JITTER_PERCENTILE)+JITTER_MARGIN_SECONDS;
+	float lowest=client->targetSeconds*(1.0f-RETARGET_MAX_DECREASE);
+	if(target<lowest)
+	{
+		target=lowest;
+	}
+	if(target<minBufferSeconds)
+	{
+		target=minBufferSeconds;
+	}
+	if(target>maxBufferSeconds)
+	{
+		target=maxBufferSeconds;
+	}
+	client->targetSeconds=target;
+	client_resize_buffers(client);
+}
+/// Format the status of all clients into a snapshot for the status file, one line per client. The asyncLog background thread writes the file.
+/// The file is written under a temporary name and renamed so that readers always see a complete file.
+static void write_status(void)
 {
-	uint32_t ar=ringBuffer_availableRead(&(client->rb));
-	while(ar>=sizeof(struct chunk_header))
+	/// The network thread only formats the snapshot, the background thread of asyncLog writes the file
+	char * buffer=asyncLog_statusBuffer();
+	if(buffer==NULL)
+	{
+		return;
+	}
+	uint32_t length=0;
+	for(linked_list * curr=tcpClients;curr!=NULL;curr=curr->next)
 	{
-		struct chunk_header header;
-		ringBuffer_peek(&(client->rb), (uint32_t)sizeof(struct chunk_header), (uint8_t *)&header );
-		if(ar>=header.payload+sizeof(struct chunk_header))
+		tcpClient * c=(tcpClient *)curr;
+		int n=snprintf(buffer+length, ASYNC_LOG_STATUS_BYTES-length, "%s started=%d buffered=%.3f target=%.3f jitter=%.3f underruns=%u trimmed=%u inserted=%u overflows=%u minBuffered=%.3f maxBuffered=%.3f sync=%d syncError=%.6f codec=%s kbps=%.1f codecCpu=%.2f correctorCpu=%.3f flowMessages=%u\n",
+				c->name, c->started, client_buffered_seconds(c), c->targetSeconds,
+				jitterEstimator_percentile(&c->jitter, JITTER_PERCENTILE), c->underruns,
+				c->trimmedSamples, c->insertedSamples, c->overflowChunks, c->minBuffered, c->maxBuffered, c->sync, c->syncError,
+				c->sampletype==SAMPLE_TYPE_OPUS?"opus":"float",
+				c->sampletype==SAMPLE_TYPE_OPUS?opusCodec_kbps(&c->decoder):c->samplerate*FRAME_BYTES*8e-3, opusCodec_cpuPercent(&c->decoder), client_corrector_cpu(c), c->flowMessages);
+		if(n<0 || (uint32_t)n>=ASYNC_LOG_STATUS_BYTES-length)
 		{
-			// Message fully received
-			// pa_log("TCP server msg received: %d %d", header.type, header.payload);
-			ringBuffer_read(&(client->rb), (uint32_t)sizeof(struct chunk_header), NULL );
-			switch(header.type)
-			{
-			case R_MSG_AUDIO_CHUNK:
+			break;
+		}
+		length+=n;
+	}
+	asyncLog_status(statusFileName, length);
+}
+/// Payload size of the messages of a fixed size, 0 for the messages of variable size
+static uint32_t message_payload_size(uint32_t type)
+{
+	switch(type)
+	{
+	case R_MSG_STREAM_PARAMETERS:
+		return sizeof(struct stream_parameters)-sizeof(struct chunk_header);
+	case R_MSG_TIMESTAMP:
+		return sizeof(struct media_timestamp)-sizeof(struct chunk_header);
+	case R_MSG_TIME_RESPONSE:
+		return sizeof(struct time_sync)-sizeof(struct chunk_header);
+	}
+	return 0;
+}
+/// Multiplexed streams: get the client that plays the stream of a message
+/// @param create create the pipeline of a new stream (when its R_MSG_STREAM_PARAMETERS arrived)
+/// @return NULL when the stream id is invalid, the stream was not set up by R_MSG_STREAM_PARAMETERS or its pipeline can not be created
+static tcpClient * client_stream(tcpClient * client, uint32_t streamId, bool create)
+{
+	if(streamId==0)
+	{
+		return client;
+	}
+	if(streamId>=MAX_STREAMS)
+	{
+		return NULL;
+	}
+	if(client->streams[streamId]==NULL && create)
+	{
+		char name[300];
+		snprintf(name, sizeof(name), "%s_s%u", client->name, streamId);
+		client->streams[streamId]=client_create(name);
+		if(client->streams[streamId]==NULL)
+		{
+			return NULL;
+		}
+		client->streams[streamId]->connection=client;
+		client->streams[streamId]->streamId=streamId;
+		asyncLog_text(ASYNC_LOG_MAIN, "%s: new stream\n", name, 0, 0, 0);
+	}
+	return client->streams[streamId];
+}
+/// Relay mode: assign a downstream stream slot to the stream and remember its parameters for downstream connections that connect later
+static void relay_parameters_update(tcpClient * stream, const struct stream_parameters * params)
+{
+	TRACE_MUTEX_LOCK(&relayLock, TRACE_LOCK_RELAY);
+	for(int i=0;i<MAX_STREAMS && stream->relayStream<0;++i)
+	{
+		if(relayStreams[i]==NULL)
+		{
+			relayStreams[i]=stream;
+			stream->relayStream=i;
+			asyncLog_text(ASYNC_LOG_MAIN, "%s: relayed as stream %lld\n", stream->name, i, 0, 0);
+		}
+	}
+	if(stream->relayStream>=0)
+	{
+		relayParams[stream->relayStream]=*params;
+		relayParams[stream->relayStream].head.type=R_MSG_MAKE(R_MSG_STREAM_PARAMETERS, stream->relayStream);
+	}else
+	{
+		asyncLog_text(ASYNC_LOG_MAIN, "%s: all relay streams are used, not relayed\n", stream->name, 0, 0, 0);
+	}
+	TRACE_MUTEX_UNLOCK(&relayLock, TRACE_LOCK_RELAY);
+}
+/// Relay mode: control messages of a downstream connection: the parameters of all relayed streams
+static uint32_t relay_parameters(uint8_t * buffer, uint32_t size)
+{
+	uint32_t length=0;
+	TRACE_MUTEX_LOCK(&relayLock, TRACE_LOCK_RELAY);
+	for(int i=0;i<MAX_STREAMS && length+sizeof(struct stream_parameters)<=size;++i)
+	{
+		if(relayStreams[i]!=NULL)
+		{
+			memcpy(buffer+length, &relayParams[i], sizeof(struct stream_parameters));
+			length+=sizeof(struct stream_parameters);
+		}
+	}
+	TRACE_MUTEX_UNLOCK(&relayLock, TRACE_LOCK_RELAY);
+	return length;
+}
+/// Relay mode: copy a message of the stream into the relay ring without decoding it. The header was already consumed,
+/// the payload is copied from the receive buffer of the connection directly into the ring that is shared by all downstream connections.
+/// @param payload NULL or a modified payload to forward instead of the one in the receive buffer
+static void relay_forward(tcpClient * client, tcpClient * stream, struct chunk_header header, const uint8_t * payload)
+{
+	/// A timestamp applies to the chunk that follows it: both are forwarded or both are dropped
+	bool timestamp=R_MSG_TYPE(header.type)==R_MSG_AUDIO_CHUNK && stream->relayTimestampPending;
+	if(R_MSG_TYPE(header.type)==R_MSG_AUDIO_CHUNK)
+	{
+		stream->relayTimestampPending=false;
+	}
+	if(stream->relayStream<0 || fanoutRing_readers(&relay)==0)
+	{
+		return;
+	}
+	if(fanoutRing_availableWrite(&relay)<sizeof(struct chunk_header)+header.payload+(timestamp?sizeof(struct media_timestamp):0))
+	{
+		relayDrops+=timestamp?2:1;
+		return;
+	}
+	if(timestamp)
+	{
+		stream->relayTimestamp.head.type=R_MSG_MAKE(R_MSG_TIMESTAMP, stream->relayStream);
+		fanoutRing_write(&relay, (uint32_t)sizeof(struct media_timestamp), (uint8_t *)&stream->relayTimestamp);
+	}
+	header.type=R_MSG_MAKE(R_MSG_TYPE(header.type), stream->relayStream);
+	fanoutRing_write(&relay, (uint32_t)sizeof(struct chunk_header), (uint8_t *)&header);
+	if(payload!=NULL)
+	{
+		fanoutRing_write(&relay, header.payload, payload);
+		relayPending=true;
+		return;
+	}
+	uint32_t offset=0;
+	while(offset<header.payload)
+	{
+		uint8_t * data;
+		uint32_t n=fanoutRing_accessWriteBuffer(&relay, &data, header.payload-offset);
+		ringBuffer_peekOffset(&(client->rb), offset, n, data);
+		fanoutRing_write(&relay, n, NULL);
+		offset+=n;
+	}
+	relayPending=true;
+}
+/// Relay mode: make the messages forwarded in the current network loop wakeup visible to the downstream connections
+static void relay_publish(void)
+{
+	if(relayPending)
+	{
+		relayPending=false;
+		fanoutRing_publish(&relay);
+	}
+}
+/// Clock synchronization: process the response to a request. The offset of the response with the shortest round trip of the last
+/// SYNC_WINDOW responses is used: a response that was delayed on the way (for example behind queued audio) gives a wrong offset.
+static void client_clock_update(tcpClient * client, const struct time_sync * response)
+{
+	int64_t t4=now_ns();
+	uint32_t i=client->syncResponses++%SYNC_WINDOW;
+	client->syncRtt[i]=(t4-response->t1)-(response->t3-response->t2);
+	client->syncOffset[i]=((response->t2-response->t1)+(response->t3-t4))/2;
+	uint32_t n=min_u32(client->syncResponses, SYNC_WINDOW);
+	uint32_t best=0;
+	for(uint32_t j=1;j<n;++j)
+	{
+		if(client->syncRtt[j]<client->syncRtt[best])
+		{
+			best=j;
+		}
+	}
+	client->clockOffsetNs=client->clockSynced?client->clockOffsetNs+(client->syncOffset[best]-client->clockOffsetNs)/SYNC_OFFSET_SMOOTHING:client->syncOffset[best];
+	client->clockSynced=true;
+}
+/// Send the pending part of the control messages of a connection without blocking.
+/// A failed write is detected by the receive path.
+static void client_flush_control(tcpClient * c)
+{
+	if(c->controlPendingBytes==0 || c->fd<0)
+	{
+		return;
+	}
+	ssize_t n=send(c->fd, c->controlPending, c->controlPendingBytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if(n>0)
+	{
+		c->controlPendingBytes-=(uint32_t)n;
+		memmove(c->controlPending, c->controlPending+n, c->controlPendingBytes);
+	}
+}
+/// Send a control message to a connection without blocking. The bytes the socket does not take are kept and sent
+/// by client_flush_control(), so a short write does not break the framing of the messages.
+/// @return false when the message was not sent or queued: the socket and the pending bytes are full or the connection is closed
+static bool client_send_control(tcpClient * c, const void * message, uint32_t bytes)
+{
+	client_flush_control(c);
+	if(c->fd<0)
+	{
+		return false;
+	}
+	ssize_t n=0;
+	if(c->controlPendingBytes==0)
+	{
+		n=send(c->fd, message, bytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(n==(ssize_t)bytes)
+		{
+			return true;
+		}
+		if(n<0)
+		{
+			if(errno!=EAGAIN && errno!=EWOULDBLOCK)
+			{
+				return false;
+			}
+			n=0;
+		}
+	}
+	if(bytes-(uint32_t)n>CONTROL_PENDING_BYTES-c->controlPendingBytes)
+	{
+		/// Only reached when nothing of the message was sent: a message is smaller than the pending buffer
+		return false;
+	}
+	memcpy(c->controlPending+c->controlPendingBytes, (const uint8_t *)message+n, bytes-(uint32_t)n);
+	c->controlPendingBytes+=bytes-(uint32_t)n;
+	return true;
+}
+/// Clock synchronization: send a request to each connection that sends timestamps every SYNC_REQUEST_SECONDS.
+/// A request that can not be sent is tried again in the next loop iteration.
+static void send_time_requests(void)
+{
+	for(linked_list * curr=tcpClients;curr!=NULL;curr=curr->next)
+	{
+		tcpClient * c=(tcpClient *)curr;
+		client_flush_control(c);
+		if(c->sync && c->fd>=0 && elapsed_seconds(&c->lastTimeRequest)>=SYNC_REQUEST_SECONDS)
+		{
+			struct time_sync request;
+			memset(&request, 0, sizeof(request));
+			request.head.type=R_MSG_TIME_REQUEST;
+			request.head.payload=sizeof(struct time_sync)-sizeof(struct chunk_header);
+			request.t1=now_ns();
+			if(client_send_control(c, &request, sizeof(request)))
+			{
+				clock_gettime(CLOCK_MONOTONIC, &c->lastTimeRequest);
+			}
+		}
+	}
+}
+/// Flow control: tell the clients about streams that have more audio buffered than they can use, so the clients drop audio
+/// before sending it instead of the server throwing it away. Also sent once when the backlog is gone.
+/// Not used for synchronized streams (their backlog follows the capture times) and relayed streams (the downstream servers need the audio).
+static void send_flow_control(void)
+{
+	for(linked_list * curr=tcpClients;curr!=NULL;curr=curr->next)
+	{
+		tcpClient * c=(tcpClient *)curr;
+		tcpClient * connection=client_connection(c);
+		if(noPlayback || !c->started || c->sync || c->relayStream>=0 || c->samplerate==0 || connection->fd<0 || elapsed_seconds(&c->lastFlow)<FLOW_INTERVAL_SECONDS)
+		{
+			continue;
+		}
+		float backlog=client_buffered_seconds(c)+(float)(ringBuffer_availableRead(&(c->audioOriginal))/FRAME_BYTES)/c->samplerate;
+		uint32_t excess=backlog>c->targetSeconds*(1.0f+FLOW_EXCESS_BAND)?(uint32_t)((backlog-c->targetSeconds)*c->samplerate):0;
+		if(excess==0 && c->flowExcess==0)
+		{
+			continue;
+		}
+		struct flow_control flow;
+		flow.head.type=R_MSG_MAKE(R_MSG_FLOW, c->streamId);
+		flow.head.payload=sizeof(struct flow_control)-sizeof(struct chunk_header);
+		flow.excessFrames=excess;
+		flow.overflowChunks=c->overflowChunks;
+		/// A message that can not be sent is tried again in the next loop iteration
+		if(!client_send_control(connection, &flow, sizeof(flow)))
+		{
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &c->lastFlow);
+		c->flowExcess=excess;
+		c->flowMessages++;
+	}
+}
+/// Stream capture: record bytes received from the client before they are processed
+static void client_capture(tcpClient * client, const uint8_t * data, uint32_t n)
+{
+	if(client->capturing && !streamCapture_record(client->id, STREAM_CAPTURE_DATA, data, n))
+	{
+		client->capturing=false;
+		client->captureLost=true;
+		asyncLog_text(ASYNC_LOG_MAIN, "%s: stream capture dropped data, recording of the client ended\n", client->name, 0, 0, 0);
+	}
+}
+/// An audio chunk of the stream arrived: update the jitter estimate and in adaptive mode the target buffer length
+static void client_chunk_arrived(tcpClient * stream, uint32_t frames)
+{
+	if(stream->samplerate>0)
+	{
+		jitterEstimator_update(&stream->jitter, now_seconds(), ((double)frames)/stream->samplerate);
+		if(adaptiveBuffer && !noPlayback && !stream->sync)
+		{
+			client_retarget(stream);
+		}
+	}
+}
+/// Incremental parser: start receiving the payload of a float audio chunk straight into audioOriginal of the stream.
+/// Only when the chunk is played locally without relaying (those need the whole message in rb) and the whole payload fits:
+/// the overflow of a full audioOriginal is handled by the whole message path.
+/// @return false means the message is processed when it was fully received into rb
+static bool client_payload_start(tcpClient * client, tcpClient * stream, struct chunk_header header)
+{
+	if(noPlayback || stream->sampletype!=SAMPLE_TYPE_FLOAT || stream->samplerate==0 || stream->relayStream>=0
+			|| ringBuffer_availableWrite(&(stream->audioOriginal))<header.payload)
+	{
+		return false;
+	}
+	if(stream->firstAudio.tv_sec==0 && stream->firstAudio.tv_nsec==0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &stream->firstAudio);
+	}
+	if(stream->chunkTimePending)
+	{
+		stream->chunkTimePending=false;
+		stream->anchorFrame=stream->inputFrames;
+		stream->anchorTimeNs=stream->chunkTimeNs;
+		stream->anchorValid=true;
+	}
+	audioPayloadBytes+=header.payload;
+	client->payloadStream=stream;
+	client->payloadRemaining=header.payload;
+	return true;
+}
+/// Incremental parser: write received bytes of the streamed payload straight into audioOriginal.
+/// Only possible when rb is empty, otherwise the bytes in rb come first.
+/// @return number of bytes of data consumed, the rest belongs to the following messages
+static uint32_t client_payload_write(tcpClient * client, uint8_t * data, uint32_t n)
+{
+	if(client->payloadStream==NULL || ringBuffer_availableRead(&(client->rb))>0)
+	{
+		return 0;
+	}
+	n=min_u32(n, client->payloadRemaining);
+	ringBuffer_write(&(client->payloadStream->audioOriginal), n, data);
+	audioCopyBytes+=n;
+	client->payloadRemaining-=n;
+	return n;
+}
+/// Incremental parser: the streamed payload is complete, account the chunk and resample it
+static void client_payload_end(tcpClient * client)
+{
+	tcpClient * stream=client->payloadStream;
+	uint32_t frames=client->parseHeader.payload/FRAME_BYTES;
+	client->payloadStream=NULL;
+	client->parseHeaderValid=false;
+	client_chunk_arrived(stream, frames);
+	stream->inputFrames+=frames;
+	resample(stream);
+}
+/// Parse the raw tcp stream in "rb" buffer incrementally and process the messages.
+/// The header of a message is decoded once. The payload of float audio chunks is moved into audioOriginal as it arrives
+/// (or received straight into it by the receive paths, see client_payload_write()), other messages are processed when fully received.
+/// Audio data messages result in putting remote audio data (remote samplerate) to audioOriginal buffer of the stream.
+/// In relay mode the messages are also copied into the relay ring. Without local playback audio is not buffered or resampled.
+/// @return true means there was an error in the stream and client was disposed
+static bool process_messages(tcpClient * client)
+{
+	while(true)
+	{
+		uint32_t ar=ringBuffer_availableRead(&(client->rb));
+		if(client->payloadStream!=NULL)
+		{
+			/// Move the payload bytes that were received into rb before the header was decoded
+			uint32_t n=min_u32(ar, client->payloadRemaining);
+			while(n>0)
+			{
+				uint8_t * data;
+				uint32_t m=ringBuffer_accessWriteBuffer(&(client->payloadStream->audioOriginal), &data, n);
+				ringBuffer_read(&(client->rb), m, data );
+				ringBuffer_write(&(client->payloadStream->audioOriginal), m, NULL);
+				audioCopyBytes+=m;
+				client->payloadRemaining-=m;
+				n-=m;
+			}
+			if(client->payloadRemaining>0)
+			{
+				break;
+			}
+			client_payload_end(client);
+			continue;
+		}
+		if(!client->parseHeaderValid)
+		{
+			if(ar<sizeof(struct chunk_header))
+			{
+				break;
+			}
+			ringBuffer_read(&(client->rb), (uint32_t)sizeof(struct chunk_header), (uint8_t *)&client->parseHeader );
+			client->parseHeaderValid=true;
+			TRACE_PROBE3(message, client->id, client->parseHeader.type, client->parseHeader.payload);
+			ar-=sizeof(struct chunk_header);
+		}
+		struct chunk_header header=client->parseHeader;
+		uint32_t fixedPayload=message_payload_size(R_MSG_TYPE(header.type));
+		if(fixedPayload>0 && header.payload!=fixedPayload)
+		{
+			/// The fixed size messages are read with the size of their struct, another payload would desynchronize the parser
+			asyncLog_int(ASYNC_LOG_MAIN, "Invalid payload size %lld of message type %lld\n", header.payload, R_MSG_TYPE(header.type), 0, 0);
+			client_shutdown(client);
+			return true;
+		}
+		tcpClient * stream=client_stream(client, R_MSG_STREAM(header.type), R_MSG_TYPE(header.type)==R_MSG_STREAM_PARAMETERS);
+		if(stream==NULL)
+		{
+			asyncLog_int(ASYNC_LOG_MAIN, "Unknown or rejected stream: %lld\n", R_MSG_STREAM(header.type), 0, 0, 0);
+			client_shutdown(client);
+			return true;
+		}
+		if(R_MSG_TYPE(header.type)==R_MSG_AUDIO_CHUNK && client_payload_start(client, stream, header))
+		{
+			continue;
+		}
+		if(ar<header.payload)
+		{
+			/// In case the message is not fully received yet then exit processing loop: the message will be processed when process_messages is next called
+			break;
+		}
+		// Message fully received
+		client->parseHeaderValid=false;
+		switch(R_MSG_TYPE(header.type))
+		{
+		case R_MSG_AUDIO_CHUNK:
+		{
+			if(stream->firstAudio.tv_sec==0 && stream->firstAudio.tv_nsec==0)
+			{
+				clock_gettime(CLOCK_MONOTONIC, &stream->firstAudio);
+			}
+			audioPayloadBytes+=header.payload;
+			uint32_t frames=header.payload/FRAME_BYTES;
+			bool opus=stream->sampletype==SAMPLE_TYPE_OPUS;
+			if(opus)
+			{
+				if(header.payload>OPUS_MAX_PACKET_BYTES)
+				{
+					asyncLog_int(ASYNC_LOG_MAIN, "Opus packet too long: %lld\n", header.payload, 0, 0, 0);
+					client_shutdown(client);
+					return true;
+				}
+				ringBuffer_peek(&(client->rb), header.payload, opusPacket);
+				audioCopyBytes+=header.payload;
+				int32_t n=opusCodec_packetFrames(opusPacket, header.payload);
+				frames=n>0 && n<=OPUS_MAX_FRAMES?(uint32_t)n:0;
+			}
+			client_chunk_arrived(stream, frames);
+			relay_forward(client, stream, header, NULL);
+			if(noPlayback)
+			{
+				ringBuffer_read(&(client->rb), header.payload, NULL );
+				break;
+			}
+			bool timestamped=stream->chunkTimePending;
+			stream->chunkTimePending=false;
+			int aw=ringBuffer_availableWrite(&(stream->audioOriginal));
+			if(aw>=frames*FRAME_BYTES)
+			{
+				if(timestamped)
+				{
+					stream->anchorFrame=stream->inputFrames;
+					stream->anchorTimeNs=stream->chunkTimeNs;
+					stream->anchorValid=true;
+				}
+				if(opus)
+				{
+					/// Decode straight into audioOriginal when the frames fit continuously, otherwise through opusFrames
+					ringBuffer_read(&(client->rb), header.payload, NULL );
+					uint8_t * data;
+					float * pcm=opusFrames;
+					if(ringBuffer_accessWriteBuffer(&(stream->audioOriginal), &data, frames*FRAME_BYTES)==frames*FRAME_BYTES)
+					{
+						pcm=(float *)data;
+					}
+					int32_t n=opusCodec_decode(&stream->decoder, opusPacket, header.payload, pcm, frames);
+					if(n<0)
+					{
+						asyncLog_int(ASYNC_LOG_MAIN, "Opus decoder error: %lld\n", n, 0, 0, 0);
+						n=0;
+					}
+					frames=(uint32_t)n;
+					ringBuffer_write(&(stream->audioOriginal), frames*FRAME_BYTES, pcm==opusFrames?(uint8_t *)opusFrames:NULL);
+				}else
+				{
+					uint32_t remaining=header.payload;
+					uint8_t * data;
+					while(remaining>0)
+					{
+						int n=ringBuffer_accessWriteBuffer(&(stream->audioOriginal), &data, remaining);
+						ringBuffer_read(&(client->rb), n, data );
+						ringBuffer_write(&(stream->audioOriginal), n, NULL);
+						audioCopyBytes+=n;
+						remaining-=n;
+					}
+				}
+				stream->inputFrames+=frames;
+				receivedAudioBytes+=header.payload;
+				while(receivedAudioBytes>44100)
+				{
+//						printf("Received %d bytes audio \n", receivedAudioBytes);
+					receivedAudioBytes-=44100;
+				}
+				resample(stream);
+			}else
+			{
+				// Overflow - just omit data
+				stream->overflowChunks++;
+				ringBuffer_read(&(client->rb), header.payload, NULL );
+			}
+			break;
+		}
+		case R_MSG_STREAM_PARAMETERS:
+		{
+			struct stream_parameters params;
+			params.head=header;
+			ringBuffer_peek(&(client->rb), (uint32_t)sizeof(struct stream_parameters)-sizeof(struct chunk_header), ((uint8_t *)&params)+sizeof(struct chunk_header) );
+			if(nRelayTargets>0)
+			{
+				relay_parameters_update(stream, &params);
+				relay_forward(client, stream, header, NULL);
+			}
+			ringBuffer_read(&(client->rb), (uint32_t)sizeof(struct stream_parameters)-sizeof(struct chunk_header), NULL );
+			stream->samplerate=(uint32_t)(params.samplerate);
+			stream->sampletype=params.sampletype;
+			int err;
+			asyncLog_int(ASYNC_LOG_MAIN, "Sample rate: %lld %lld sample type: %lld\n", stream->samplerate, samplerate, stream->sampletype, 0);
+			if(stream->sampletype!=SAMPLE_TYPE_FLOAT && (stream->sampletype!=SAMPLE_TYPE_OPUS || stream->samplerate!=OPUS_SAMPLERATE))
+			{
+				asyncLog_int(ASYNC_LOG_MAIN, "Unsupported sample type: %lld samplerate: %lld\n", stream->sampletype, stream->samplerate, 0, 0);
+				client_shutdown(client);
+				return true;
+			}
+			if(noPlayback)
+			{
+				break;
+			}
+			opusCodec_destroy(&stream->decoder);
+			if(stream->sampletype==SAMPLE_TYPE_OPUS && !opusCodec_createDecoder(&stream->decoder))
+			{
+				if(opusCodec_available())
+				{
+					asyncLog_int(ASYNC_LOG_MAIN, "Cannot create Opus decoder\n", 0, 0, 0, 0);
+				}else
+				{
+					asyncLog_int(ASYNC_LOG_MAIN, "Opus stream received but built without Opus support\n", 0, 0, 0, 0);
+				}
+				client_shutdown(client);
+				return true;
+			}
+			polyphaseResampler_destroy(&stream->polyphase);
+			if(usePolyphase)
+			{
+				if(!polyphaseResampler_create(&stream->polyphase, stream->samplerate, samplerate))
+				{
+					asyncLog_int(ASYNC_LOG_MAIN, "Cannot create polyphase resampler\n", 0, 0, 0, 0);
+					client_shutdown(client);
+					return true;
+				}
+				break;
+			}
+			if(stream->resampler_state!=NULL)
+			{
+				speex_resampler_destroy(stream->resampler_state);
+			}
+			stream->resampler_state=speex_resampler_init( NPORT, //spx_uint32_t nb_channels,
+												stream->samplerate, //spx_uint32_t in_rate,
+		                                          samplerate, //spx_uint32_t out_rate,
+		                                          resamplerQuality, // int quality [0,10] 10 is best,
+		                                          &err// int *err
+							);
+			assert(stream->resampler_state!=NULL);
+			break;
+		}
+		case R_MSG_TIMESTAMP:
+		{
+			struct media_timestamp timestamp;
+			timestamp.head=header;
+			ringBuffer_read(&(client->rb), (uint32_t)sizeof(struct media_timestamp)-sizeof(struct chunk_header), ((uint8_t *)&timestamp)+sizeof(struct chunk_header) );
+			stream->sync=true;
+			client->sync=true;
+			stream->chunkTimeNs=timestamp.timeNs;
+			stream->chunkTimePending=true;
+			if(client->clockSynced)
+			{
+				/// Relay mode: downstream servers synchronize to the clock of the relay
+				timestamp.timeNs-=client->clockOffsetNs;
+				stream->relayTimestamp=timestamp;
+				stream->relayTimestampPending=true;
+			}
+			break;
+		}
+		case R_MSG_TIME_RESPONSE:
+		{
+			struct time_sync response;
+			response.head=header;
+			ringBuffer_read(&(client->rb), (uint32_t)sizeof(struct time_sync)-sizeof(struct chunk_header), ((uint8_t *)&response)+sizeof(struct chunk_header) );
+			client_clock_update(client, &response);
+			break;
+		}
+		default:
+			asyncLog_int(ASYNC_LOG_MAIN, "Unknown header type: %lld\n", header.type, 0, 0, 0);
+			client_shutdown(client);
+			return true;
+			break;
+		}
+	}
+	return false;
+}
+/// Same-host transport: receive the memfd and the eventfd from the client and map the shared ring.
+/// @return false on error. true also when the file descriptors did not arrive yet (eventFd is still -1 then).
+static bool shm_attach(tcpClient * client)
+{
+	char byte;
+	struct iovec iov={ &byte, 1 };
+	/// Room for more descriptors than expected: they are received and closed instead of being passed on by the kernel in the next message
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(SHM_MAX_RECEIVED_FDS*sizeof(int))];
+	} control;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control.buf;
+	msg.msg_controllen=sizeof(control.buf);
+	ssize_t n=recvmsg(client->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if(n<0 && errno==EAGAIN)
+	{
+		return true;
+	}
+	/// The memfd of the ring and the eventfd. Any other received descriptor is closed.
+	int fds[2]={ -1, -1 };
+	int nfd=0;
+	for(struct cmsghdr * cmsg=n>0?CMSG_FIRSTHDR(&msg):NULL;cmsg!=NULL;cmsg=CMSG_NXTHDR(&msg, cmsg))
+	{
+		if(cmsg->cmsg_level!=SOL_SOCKET || cmsg->cmsg_type!=SCM_RIGHTS)
+		{
+			continue;
+		}
+		int count=(cmsg->cmsg_len-CMSG_LEN(0))/sizeof(int);
+		for(int i=0;i<count;++i)
+		{
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg)+i*sizeof(int), sizeof(int));
+			if(nfd<2)
+			{
+				fds[nfd]=fd;
+			}else
+			{
+				close(fd);
+			}
+			nfd++;
+		}
+	}
+	struct stat st;
+	void * mapping=MAP_FAILED;
+	/// The memfd has to be sealed against shrinking: a client that truncates it after the handshake would make the network thread die of SIGBUS
+	int seals=fds[0]>=0?fcntl(fds[0], F_GET_SEALS):-1;
+	if(n==1 && nfd==2 && !(msg.msg_flags & MSG_CTRUNC) && seals>=0 && (seals & F_SEAL_SHRINK)!=0
+			&& fstat(fds[0], &st)==0 && st.st_size>=(off_t)sizeof(shmRing_header))
+	{
+		mapping=mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	}
+	if(fds[0]>=0)
+	{
+		close(fds[0]);
+	}
+	if(mapping==MAP_FAILED || !shmRing_attach(&client->shmRing, mapping, st.st_size))
+	{
+		asyncLog_text(ASYNC_LOG_MAIN, "%s: invalid shared memory handshake\n", client->name, 0, 0, 0);
+		if(mapping!=MAP_FAILED)
+		{
+			munmap(mapping, st.st_size);
+		}
+		if(fds[1]>=0)
+		{
+			close(fds[1]);
+		}
+		return false;
+	}
+	client->eventFd=fds[1];
+	setnonblocking(client->eventFd);
+	epoll_ctl_add(epfd, client->eventFd, EPOLLIN | EPOLLET, client);
+	asyncLog_text(ASYNC_LOG_MAIN, "%s: shared memory attached\n", client->name, 0, 0, 0);
+	return true;
+}
+/// Same-host transport: copy data from the shared ring into "rb" (or the streamed audio payload into audioOriginal) and process the messages
+static void shm_read_input(tcpClient * client)
+{
+	if(client->eventFd<0)
+	{
+		if(!shm_attach(client))
+		{
+			client_shutdown(client);
+			return;
+		}
+		if(client->eventFd<0)
+		{
+			return;
+		}
+	}
+	uint64_t count;
+	if(read(client->eventFd, &count, sizeof(count))<0 && errno!=EAGAIN)
+	{
+		client_shutdown(client);
+		return;
+	}
+	if(!shmRing_isValid(&client->shmRing))
+	{
+		asyncLog_text(ASYNC_LOG_MAIN, "%s: shared memory ring corrupted\n", client->name, 0, 0, 0);
+		client_shutdown(client);
+		return;
+	}
+	while(true)
+	{
+		uint32_t awW=ringBuffer_availableWrite(&(client->rb));
+		uint8_t * data;
+		uint32_t n=shmRing_accessReadBuffer(&client->shmRing, &data, awW);
+		if(n==0)
+		{
+			break;
+		}
+		client_capture(client, data, n);
+		uint32_t direct=client_payload_write(client, data, n);
+		ringBuffer_write(&(client->rb), n-direct, data+direct);
+		audioCopyBytes+=n-direct;
+		shmRing_skip(&client->shmRing, n);
+		if(process_messages(client))
+		{
+			return;
+		}
+	}
+	/// The client never sends on the Unix socket after the handshake: readable means closed
+	char byte;
+	if(recv(client->fd, &byte, 1, MSG_DONTWAIT | MSG_PEEK)==0)
+	{
+		asyncLog_int(ASYNC_LOG_MAIN, "Shutdown:\n", 0, 0, 0, 0);
+		client_shutdown(client);
+	}
+}
+/// Read available data of the client connection and process the received messages
+static void client_read_input(tcpClient * client)
+{
+	if(client->shm)
+	{
+		shm_read_input(client);
+		return;
+	}
+	for (;;) {
+		uint8_t * buffer;
+		int l;
+		tcpClient * stream=ringBuffer_availableRead(&(client->rb))==0?client->payloadStream:NULL;
+		if(stream!=NULL)
+		{
+			/// Zero copy receive: read the rest of the streamed audio chunk payload straight into audioOriginal
+			l=ringBuffer_accessWriteBuffer(&(stream->audioOriginal), &buffer, client->payloadRemaining);
+		}else
+		{
+			uint32_t awW=ringBuffer_availableWrite(&(client->rb));
+			if(awW<1)
+			{
+				break;
+			}
+			l=ringBuffer_accessWriteBuffer(&(client->rb), &buffer, awW);
+		}
+		int n = read(client->fd, buffer, l);
+		networkSyscalls++;
+		if(n==0)
+		{
+			/// End of file: the client closed the connection. errno is not set by read() in this case.
+			asyncLog_int(ASYNC_LOG_MAIN, "Shutdown:\n", 0, 0, 0, 0);
+			client_shutdown(client);
+			break;
+		}else if (n < 0 /* || errno == EAGAIN */ )
+		{
+			if(errno!=EAGAIN)
+			{
+				asyncLog_int(ASYNC_LOG_MAIN, "Shutdown 2 %lld:\n", errno, 0, 0, 0);
+				client_shutdown(client);
+			}
+			break;
+		} else {
+			if(stream!=NULL)
 			{
-				int aw=ringBuffer_availableWrite(&(client->audioOriginal));
-				if(aw>=header.payload)
-				{
-					uint32_t remaining=header.payload;
-					uint8_t * data;
-					while(remaining>0)
-					{
-						int n=ringBuffer_accessWriteBuffer(&(client->audioOriginal), &data, remaining);
-						ringBuffer_read(&(client->rb), n, data );
-						ringBuffer_write(&(client->audioOriginal), n, NULL);
-						remaining-=n;
-					}
-					receivedAudioBytes+=header.payload;
-					while(receivedAudioBytes>44100)
-					{
-//						printf("Received %d bytes audio \n", receivedAudioBytes);
-						receivedAudioBytes-=44100;
-					}
-					resample(client);
-				}else
+				ringBuffer_write(&(stream->audioOriginal), n, NULL);
+				client->payloadRemaining-=n;
+			}else
+			{
+				ringBuffer_write(&(client->rb), n, NULL);
+			}
+			audioCopyBytes+=n;
+			client_capture(client, buffer, n);
+			if(process_messages(client))
+			{
+				break;
+			}
+		}
+	}
+}
+/// Accept connections and read client data for a batch of epoll events
+static void handle_epoll_events(struct epoll_event * events, int nfds, tcpServer * server, tcpServer * shmServer)
+{
+	int conn_sock;
+	struct sockaddr_in cli_addr;
+	socklen_t socklen = sizeof(cli_addr);
+	for (int i = 0; i < nfds; i++) {
+		if (events[i].data.ptr == server) {
+			/* handle new connection */
+			conn_sock =
+			    accept(server->fd,
+				   (struct sockaddr *)&cli_addr,
+				   &socklen);
+			if(conn_sock>=0)
+			{
+				char addr[128];
+				char name[256];
+				setnonblocking(conn_sock);
+				/// The receive queue holds at most about the target buffer length of a stream, a server that falls behind pushes back on the client
+				if(!socketTuning_apply(conn_sock, false, bufferSeconds, samplerate*FRAME_BYTES))
 				{
-					// Overflow - just omit data
-					ringBuffer_read(&(client->rb), header.payload, NULL );
+					asyncLog_int(ASYNC_LOG_MAIN, "socket tuning failed: %lld\n", errno, 0, 0, 0);
 				}
-				break;
+				inet_ntop(AF_INET, &cli_addr.sin_addr, addr, sizeof(addr));
+				snprintf(name, sizeof(name), "TCP_%s_%d", addr, ntohs(cli_addr.sin_port));
+				openClient(conn_sock, name, false);
 			}
-			case R_MSG_STREAM_PARAMETERS:
-			{
-				struct stream_parameters params;
-				ringBuffer_read(&(client->rb), (uint32_t)sizeof(struct stream_parameters)-sizeof(struct chunk_header), ((uint8_t *)&params)+sizeof(struct chunk_header) );
-				client->samplerate=(uint32_t)(params.samplerate);
-				int err;
-				printf("Sample rate: %d %d\n", client->samplerate, samplerate);
-				client->resampler_state=speex_resampler_init( NPORT, //spx_uint32_t nb_channels,
-													client->samplerate, //spx_uint32_t in_rate,
-			                                          samplerate, //spx_uint32_t out_rate,
-			                                          10, // int quality [0,10] 10 is best,
-			                                          &err// int *err
-								);
-				assert(client->resampler_state!=NULL);
-				break;
+		} else if (events[i].data.ptr == shmServer) {
+			/* handle new same-host shared memory connections */
+			while((conn_sock=accept(shmServer->fd, NULL, NULL))>=0)
+			{
+				char name[64];
+				setnonblocking(conn_sock);
+				snprintf(name, sizeof(name), "SHM_%u", nextClientId);
+				openClient(conn_sock, name, true);
+			}
+		} else if (events[i].events & EPOLLIN) {
+			tcpClient * client = events[i].data.ptr;
+			if(client!=NULL && !client->closed)
+			{
+				client_read_input(client);
 			}
-			default:
-				printf("Unknown header type: %d", header.type);
+		} else if (events[i].events & (EPOLLRDHUP | EPOLLHUP)) {
+			tcpClient * client = events[i].data.ptr;
+			if(client!=NULL && !client->closed)
+			{
 				client_shutdown(client);
-				return true;
-				break;
 			}
+		}
+	}
+}
+/// io_uring loop: append received data to "rb" of the client (the streamed audio payload to audioOriginal) and remember the client for processing
+/// @return false when the client was shut down
+static bool uring_receive(tcpClient * client, uint8_t * data, uint32_t n, tcpClient ** batch, uint32_t * nBatch)
+{
+	client_capture(client, data, n);
+	/// The kernel copied the data into the provided buffer
+	audioCopyBytes+=n;
+	uint32_t direct=client_payload_write(client, data, n);
+	data+=direct;
+	n-=direct;
+	if(ringBuffer_availableWrite(&(client->rb))<n && process_messages(client))
+	{
+		return false;
+	}
+	if(!ringBuffer_write(&(client->rb), n, data))
+	{
+		asyncLog_text(ASYNC_LOG_MAIN, "%s: message does not fit into the receive buffer\n", client->name, 0, 0, 0);
+		client_shutdown(client);
+		return false;
+	}
+	audioCopyBytes+=n;
+	if(!client->uringBatched)
+	{
+		if(*nBatch==URING_BATCH_SIZE)
+		{
+			batch[0]->uringBatched=false;
+			if(!batch[0]->closed)
+			{
+				process_messages(batch[0]);
+			}
+			memmove(batch, batch+1, (URING_BATCH_SIZE-1)*sizeof(tcpClient *));
+			(*nBatch)--;
+		}
+		client->uringBatched=true;
+		batch[(*nBatch)++]=client;
+	}
+	return true;
+}
+/// io_uring loop: wait for completions and handle all of them. Received data is collected into "rb" of the clients first
+/// and the messages of each client are processed once per wakeup. Events of the epoll fd (listening sockets, same-host clients)
+/// are handled by the epoll code.
+static void uring_process_events(struct epoll_event * events, tcpServer * server, tcpServer * shmServer)
+{
+	tcpClient * batch[URING_BATCH_SIZE];
+	uint32_t nBatch=0;
+	uringLoop_completion c;
+	TRACE_PROBE(loop_sleep);
+	if(!uringLoop_wait(&uring, 250))
+	{
+		perror("io_uring_enter()");
+		exitProgram=true;
+		return;
+	}
+	TRACE_PROBE1(loop_wake, -1);
+	networkWakeups++;
+	while(uringLoop_next(&uring, &c))
+	{
+		if(c.userData==URING_CANCEL_USERDATA)
+		{
+			continue;
+		}
+		if(c.userData==URING_EPOLL_USERDATA)
+		{
+			int nfds;
+			do {
+				nfds=epoll_wait(epfd, events, MAX_EVENTS, 0);
+				networkSyscalls++;
+				handle_epoll_events(events, nfds, server, shmServer);
+			} while(nfds==MAX_EVENTS);
+			if(!c.more)
+			{
+				uringLoop_poll(&uring, epfd, URING_EPOLL_USERDATA);
+			}
+			continue;
+		}
+		tcpClient * client=(tcpClient *)(uintptr_t)c.userData;
+		if(!c.more)
+		{
+			client->uringArmed=false;
+		}
+		if(client->closed)
+		{
+			uringLoop_releaseBuffer(&uring, c.bufferId);
+			continue;
+		}
+		if(c.res>0)
+		{
+			bool ok=uring_receive(client, c.data, c.res, batch, &nBatch);
+			uringLoop_releaseBuffer(&uring, c.bufferId);
+			if(ok && !c.more && uringLoop_recv(&uring, client->fd, (uintptr_t)client))
+			{
+				client->uringArmed=true;
+			}
+		}else if(c.res==-ENOBUFS && !c.more && uringLoop_recv(&uring, client->fd, (uintptr_t)client))
+		{
+			/// All provided buffers were in use: they are given back after this batch, receive again
+			client->uringArmed=true;
+		}else if(!c.more)
+		{
+			asyncLog_int(ASYNC_LOG_MAIN, "Shutdown %lld:\n", -c.res, 0, 0, 0);
+			client_shutdown(client);
+		}
+	}
+	for(uint32_t i=0;i<nBatch;++i)
+	{
+		batch[i]->uringBatched=false;
+		if(!batch[i]->closed)
+		{
+			process_messages(batch[i]);
+		}
+	}
+}
+/// Benchmarks: state of a synthetic connection driven like the network loop and the Jack thread drive real ones
+typedef struct
+{
+	tcpClient * clients[64];
+	int nClients;
+	/// Frames of an audio chunk or of a Jack period
+	uint32_t frames;
+	/// A chunk of 440 Hz sine, so the silence paths are not taken
+	float chunk[1024*NPORT];
+} bench_state;
+/// Benchmarks: create a connection that plays a stream of the given samplerate. Its stream parameters are processed by process_messages().
+static tcpClient * bench_connection(uint32_t inRate)
+{
+	tcpClient * client=client_create("bench");
+	assert(client!=NULL);
+	uint8_t *buffer=calloc(CLIENT_RINGBUFFER_BYTES, 1);
+	assert(buffer!=NULL);
+	ringBuffer_create(&(client->rb), CLIENT_RINGBUFFER_BYTES, buffer);
+	struct stream_parameters params;
+	params.head.type=R_MSG_STREAM_PARAMETERS;
+	params.head.payload=sizeof(struct stream_parameters)-sizeof(struct chunk_header);
+	params.samplerate=inRate;
+	params.nchannel=NPORT;
+	params.sampletype=SAMPLE_TYPE_FLOAT;
+	ringBuffer_write(&(client->rb), (uint32_t)sizeof(params), (uint8_t *)&params);
+	process_messages(client);
+	return client;
+}
+/// Benchmarks: shut down and free the connections of a benchmark
+static void bench_shutdown(bench_state * b)
+{
+	for(int i=0;i<b->nClients;++i)
+	{
+		client_shutdown(b->clients[i]);
+	}
+	b->nClients=0;
+	free_closed_clients(true);
+}
+/// Benchmarks: discard the output of resample() like the Jack thread would play it
+static void bench_drain(tcpClient * client)
+{
+	ringBuffer_read(&(client->audio), ringBuffer_availableRead(&(client->audio)), NULL);
+}
+/// Receive an audio chunk and process it with process_messages()
+static void bench_messages(void * arg, uint64_t iterations)
+{
+	bench_state * b=(bench_state *)arg;
+	tcpClient * client=b->clients[0];
+	struct chunk_header header;
+	header.type=R_MSG_AUDIO_CHUNK;
+	header.payload=b->frames*FRAME_BYTES;
+	for(uint64_t i=0;i<iterations;++i)
+	{
+		ringBuffer_write(&(client->rb), (uint32_t)sizeof(header), (uint8_t *)&header);
+		ringBuffer_write(&(client->rb), header.payload, (uint8_t *)b->chunk);
+		process_messages(client);
+		bench_drain(client);
+	}
+}
+/// Resample a chunk with resample()
+static void bench_resample(void * arg, uint64_t iterations)
+{
+	bench_state * b=(bench_state *)arg;
+	tcpClient * client=b->clients[0];
+	for(uint64_t i=0;i<iterations;++i)
+	{
+		ringBuffer_write(&(client->audioOriginal), b->frames*FRAME_BYTES, (uint8_t *)b->chunk);
+		resample(client);
+		bench_drain(client);
+	}
+}
+/// Play a period of all streams with the Jack process callback
+static void bench_callback(void * arg, uint64_t iterations)
+{
+	bench_state * b=(bench_state *)arg;
+	for(uint64_t i=0;i<iterations;++i)
+	{
+		for(int j=0;j<b->nClients;++j)
+		{
+			ringBuffer_write(&(b->clients[j]->audio), b->frames*FRAME_BYTES, NULL);
+		}
+		jack_process_frames_callback(b->frames, NULL);
+	}
+}
+/// Benchmarks: THD+N of a resampler in dB. One second of a sine is resampled in steps of RESAMPLE_BUFFER_SIZE samples like resample() does,
+/// then a sine of the same frequency is fitted to the output after the first 0.1 s. Everything else in the output is distortion and noise.
+static double bench_thdn(bool polyphase, uint32_t inRate, uint32_t outRate, double frequency)
+{
+	float * in=malloc(inRate*FRAME_BYTES);
+	float * out=malloc(2*outRate*FRAME_BYTES);
+	assert(in!=NULL && out!=NULL);
+	for(uint32_t i=0;i<inRate*NPORT;++i)
+	{
+		in[i]=0.5f*(float)sin(2.0*M_PI*frequency*(i/NPORT)/inRate);
+	}
+	polyphaseResampler p;
+	SpeexResamplerState * speex=NULL;
+	if(polyphase)
+	{
+		polyphaseResampler_create(&p, inRate, outRate);
+	}else
+	{
+		int err;
+		speex=speex_resampler_init(NPORT, inRate, outRate, 10, &err);
+		speex_resampler_skip_zeros(speex);
+	}
+	uint32_t consumed=0;
+	uint32_t produced=0;
+	while(consumed<inRate)
+	{
+		spx_uint32_t in_len=min_u32(inRate-consumed, RESAMPLE_BUFFER_SIZE/NPORT);
+		spx_uint32_t out_len=RESAMPLE_BUFFER_SIZE/NPORT;
+		if(polyphase)
+		{
+			polyphaseResampler_process(&p, in+consumed*NPORT, &in_len, out+produced*NPORT, &out_len);
 		}else
 		{
-			/// In case the message is not fully received yet then exit processing loop: the message will be processed when process_messages is next called
+			speex_resampler_process_interleaved_float(speex, in+consumed*NPORT, &in_len, out+produced*NPORT, &out_len);
+		}
+		if(in_len==0 && out_len==0)
+		{
 			break;
 		}
-		ar=ringBuffer_availableRead(&(client->rb));
+		consumed+=in_len;
+		produced+=out_len;
 	}
-	return false;
+	/// Least squares fit of a*sin+b*cos, the end of the output is left out because the filter did not see all of its input there
+	double ss=0.0, cc=0.0, sc=0.0, ys=0.0, yc=0.0;
+	uint32_t first=outRate/10;
+	uint32_t last=produced>first+RESAMPLE_BUFFER_SIZE?produced-RESAMPLE_BUFFER_SIZE:first;
+	for(uint32_t i=first;i<last;++i)
+	{
+		double t=2.0*M_PI*frequency*i/outRate;
+		ss+=sin(t)*sin(t);
+		cc+=cos(t)*cos(t);
+		sc+=sin(t)*cos(t);
+		ys+=out[i*NPORT]*sin(t);
+		yc+=out[i*NPORT]*cos(t);
+	}
+	double det=ss*cc-sc*sc;
+	double a=(ys*cc-yc*sc)/det;
+	double b=(yc*ss-ys*sc)/det;
+	double noise=0.0, signal=0.0;
+	for(uint32_t i=first;i<last;++i)
+	{
+		double t=2.0*M_PI*frequency*i/outRate;
+		double fit=a*sin(t)+b*cos(t);
+		noise+=(out[i*NPORT]-fit)*(out[i*NPORT]-fit);
+		signal+=fit*fit;
+	}
+	if(polyphase)
+	{
+		polyphaseResampler_destroy(&p);
+	}else
+	{
+		speex_resampler_destroy(speex);
+	}
+	free(in);
+	free(out);
+	return 10.0*log10((noise+1e-30)/(signal+1e-30));
+}
+/// Run the microbenchmarks of the server (-B) in headless mode and append the results to fileName. See bench.h
+static void run_benchmarks(const char * fileName)
+{
+	static bench_state b;
+	if(!bench_open(fileName))
+	{
+		exit(1);
+	}
+	headless=true;
+	samplerate=HEADLESS_SAMPLERATE;
+	asyncLog_start(NULL, samplerate);
+	for(uint32_t j=0;j<sizeof(b.chunk)/sizeof(b.chunk[0]);++j)
+	{
+		b.chunk[j]=0.25f*sinf(2.0f*(float)M_PI*440.0f*(j/NPORT)/samplerate);
+	}
+	bench_ringBuffer();
+
+	char params[64];
+	const uint32_t chunkFrames[]={ 64, 256, 1024 };
+	for(int playback=0;playback<2;++playback)
+	{
+		/// Parsing only (relay mode without playback) and parsing with resampling into the playback buffer
+		noPlayback=!playback;
+		for(size_t i=0;i<sizeof(chunkFrames)/sizeof(chunkFrames[0]);++i)
+		{
+			b.frames=chunkFrames[i];
+			b.clients[b.nClients++]=bench_connection(samplerate);
+			snprintf(params, sizeof(params), "frames=%u playback=%d", b.frames, playback);
+			bench_run("process_messages", params, b.frames*FRAME_BYTES, bench_messages, &b);
+			bench_shutdown(&b);
+		}
+	}
+	noPlayback=false;
+
+	/// The buffer of a benchmark stream is always short so its speed is corrected and the resampler is used even when the rates are equal
+	const uint32_t rates[][2]={ { 44100, 48000 }, { 48000, 48000 }, { 48000, 44100 }, { 96000, 48000 } };
+	b.frames=256;
+	for(int quality=0;quality<=10;++quality)
+	{
+		resamplerQuality=quality;
+		for(size_t i=0;i<sizeof(rates)/sizeof(rates[0]);++i)
+		{
+			samplerate=rates[i][1];
+			b.clients[b.nClients++]=bench_connection(rates[i][0]);
+			snprintf(params, sizeof(params), "quality=%d inRate=%u outRate=%u frames=%u", quality, rates[i][0], rates[i][1], b.frames);
+			bench_run("resample", params, b.frames*FRAME_BYTES, bench_resample, &b);
+			bench_shutdown(&b);
+		}
+	}
+	resamplerQuality=10;
+	usePolyphase=true;
+	for(size_t i=0;i<sizeof(rates)/sizeof(rates[0]);++i)
+	{
+		samplerate=rates[i][1];
+		b.clients[b.nClients++]=bench_connection(rates[i][0]);
+		snprintf(params, sizeof(params), "resampler=polyphase inRate=%u outRate=%u frames=%u", rates[i][0], rates[i][1], b.frames);
+		bench_run("resample", params, b.frames*FRAME_BYTES, bench_resample, &b);
+		bench_shutdown(&b);
+	}
+	usePolyphase=false;
+	samplerate=HEADLESS_SAMPLERATE;
+	/// Accuracy of the resamplers: speex at quality 10 and polyphase
+	const double frequencies[]={ 1000.0, 10000.0, 18000.0 };
+	for(int polyphase=0;polyphase<2;++polyphase)
+	{
+		for(size_t i=0;i<sizeof(rates)/sizeof(rates[0]);++i)
+		{
+			for(size_t k=0;k<sizeof(frequencies)/sizeof(frequencies[0]);++k)
+			{
+				snprintf(params, sizeof(params), "resampler=%s inRate=%u outRate=%u frequency=%.0f", polyphase?"polyphase":"speex",
+						rates[i][0], rates[i][1], frequencies[k]);
+				bench_value("resampler_thdn", params, "thdnDb", bench_thdn(polyphase, rates[i][0], rates[i][1], frequencies[k]));
+			}
+		}
+	}
+
+	const int streams[]={ 1, 16, 64 };
+	const uint32_t periodFrames[]={ 64, HEADLESS_PERIOD_FRAMES };
+	for(size_t i=0;i<sizeof(streams)/sizeof(streams[0]);++i)
+	{
+		for(size_t k=0;k<sizeof(periodFrames)/sizeof(periodFrames[0]);++k)
+		{
+			b.frames=periodFrames[k];
+			while(b.nClients<streams[i])
+			{
+				tcpClient * client=bench_connection(samplerate);
+				client->started=true;
+				b.clients[b.nClients++]=client;
+			}
+			snprintf(params, sizeof(params), "streams=%d frames=%u", streams[i], b.frames);
+			bench_run("jack_process_frames_callback", params, streams[i]*b.frames*FRAME_BYTES, bench_callback, &b);
+			bench_shutdown(&b);
+		}
+	}
+	asyncLog_stop();
+	bench_close();
 }
 /// Parse parameters, open Jack client, open TCP server and process epoll events (client connected, data on TCP streams).
 int main(int argc, char *argv[])
 {
-	int i;
-	int n;
 	int nfds;
 	int listen_sock;
-	int conn_sock;
-	int socklen;
 	struct sockaddr_in srv_addr;
-	struct sockaddr_in cli_addr;
 	struct epoll_event events[MAX_EVENTS];
 	int port=DEFAULT_PORT;
 	tcpServer server;
+	tcpServer shmServer={ -1 };
 
-	char *optstring = "b:h";
+	char *optstring = "b:hp:f:g:l:am:M:s:t:Hd:U:Ir:nc:B:w:R:o:O:P:A:";
 	struct option long_options[] = {
 		{ "help", 0, 0, 'h' },
 		{ "baseSourceName", 1, 0, 'b' },
 		{ "port", 1, 0, 'p' },
+		{ "fastStart", 1, 0, 'f' },
+		{ "growthRate", 1, 0, 'g' },
+		{ "latency", 1, 0, 'l' },
+		{ "adaptive", 0, 0, 'a' },
+		{ "minLatency", 1, 0, 'm' },
+		{ "maxLatency", 1, 0, 'M' },
+		{ "status", 1, 0, 's' },
+		{ "telemetry", 1, 0, 't' },
+		{ "headless", 0, 0, 'H' },
+		{ "drift", 1, 0, 'd' },
+		{ "unixSocket", 1, 0, 'U' },
+		{ "io_uring", 0, 0, 'I' },
+		{ "relay", 1, 0, 'r' },
+		{ "noPlayback", 0, 0, 'n' },
+		{ "corrector", 1, 0, 'c' },
+		{ "bench", 1, 0, 'B' },
+		{ "capture", 1, 0, 'w' },
+		{ "resampler", 1, 0, 'R' },
+		{ "record", 1, 0, 'o' },
+		{ "recordRotate", 1, 0, 'O' },
+		{ "realtime", 1, 0, 'P' },
+		{ "affinity", 1, 0, 'A' },
 		{ 0, 0, 0, 0 }
 	};
 	int longopt_index = 0;
@@ -432,7 +2570,159 @@ int main(int argc, char *argv[])
 			break;
 		case 'p':
 			printf("port: %s\n", optarg);
-			port=atoi(optstring);
+			port=atoi(optarg);
+			break;
+		case 'f':
+			fastStartSeconds=atof(optarg)/1000.0f;
+			printf("fast-start: %s ms\n", optarg);
+			break;
+		case 'g':
+			fastStartGrowth=atof(optarg)/100.0f;
+			/// The playback rate is 1-growth: it must stay positive and below nominal speed
+			if(!(fastStartGrowth>0.0f && fastStartGrowth<1.0f))
+			{
+				fprintf (stderr, "growth rate must be between 0 and 100 %%: %s\n", optarg);
+				show_usage++;
+			}
+			printf("fast-start growth rate: %s %%\n", optarg);
+			break;
+		case 'l':
+			bufferSeconds=atof(optarg)/1000.0f;
+			printf("buffer length: %s ms\n", optarg);
+			break;
+		case 'a':
+			adaptiveBuffer=true;
+			printf("adaptive buffer length\n");
+			break;
+		case 'm':
+			minBufferSeconds=atof(optarg)/1000.0f;
+			printf("minimum buffer length: %s ms\n", optarg);
+			break;
+		case 'M':
+			maxBufferSeconds=atof(optarg)/1000.0f;
+			printf("maximum buffer length: %s ms\n", optarg);
+			break;
+		case 's':
+			snprintf(statusFileName, sizeof(statusFileName), "%s", optarg);
+			printf("status file: %s\n", optarg);
+			break;
+		case 't':
+			snprintf(telemetryFileName, sizeof(telemetryFileName), "%s", optarg);
+			printf("telemetry file: %s\n", optarg);
+			break;
+		case 'H':
+			headless=true;
+			printf("headless mode\n");
+			break;
+		case 'd':
+			headlessDrift=atof(optarg);
+			printf("headless mode clock drift: %f ppm\n", headlessDrift);
+			break;
+		case 'U':
+			snprintf(shmSocketName, sizeof(shmSocketName), "%s", optarg);
+			printf("same-host shared memory transport socket: %s\n", optarg);
+			break;
+		case 'I':
+			useIoUring=true;
+			break;
+		case 'r':
+			if(nRelayTargets>=FANOUT_MAX_READERS)
+			{
+				fprintf (stderr, "at most %d relay servers are supported\n", FANOUT_MAX_READERS);
+				exit(1);
+			}
+			if(!serverConnection_parse(&relayTargets[nRelayTargets], optarg, false, DEFAULT_PORT))
+			{
+				exit(1);
+			}
+			for(int i=0;i<relayTargets[nRelayTargets].nServers;++i)
+			{
+				printf("relay to %shost: %s port: %d\n", i==0?"":"failover ", relayTargets[nRelayTargets].servers[i].hostname, relayTargets[nRelayTargets].servers[i].port);
+			}
+			nRelayTargets++;
+			break;
+		case 'n':
+			noPlayback=true;
+			printf("no local playback\n");
+			break;
+		case 'c':
+			if(strcmp(optarg, "wsola")==0)
+			{
+				stretchCorrector=true;
+			}else if(strcmp(optarg, "resampler")!=0)
+			{
+				fprintf (stderr, "unknown corrector: %s\n", optarg);
+				show_usage++;
+			}
+			printf("buffer length corrector: %s\n", stretchCorrector?"wsola":"resampler");
+			break;
+		case 'B':
+			snprintf(benchFileName, sizeof(benchFileName), "%s", optarg);
+			printf("benchmark results: %s\n", optarg);
+			break;
+		case 'w':
+			snprintf(captureFileName, sizeof(captureFileName), "%s", optarg);
+			printf("stream capture file: %s\n", optarg);
+			break;
+		case 'R':
+			if(strcmp(optarg, "polyphase")==0)
+			{
+				usePolyphase=true;
+			}else if(strcmp(optarg, "speex")!=0)
+			{
+				fprintf (stderr, "unknown resampler: %s\n", optarg);
+				show_usage++;
+			}
+			printf("resampler: %s\n", usePolyphase?"polyphase":"speex");
+			break;
+		case 'o':
+		{
+			char * comma=strchr(optarg, ',');
+			if(comma!=NULL)
+			{
+				*comma='\0';
+				recordMix=strcmp(comma+1, "mix")==0;
+				if(!recordMix)
+				{
+					fprintf (stderr, "unknown recording mode: %s\n", comma+1);
+					show_usage++;
+				}
+			}
+			snprintf(recordDirectory, sizeof(recordDirectory), "%s", optarg);
+			printf("recording %s into: %s\n", recordMix?"the mixed output":"each stream", recordDirectory);
+			break;
+		}
+		case 'O':
+		{
+			/// The file names have a resolution of one second, shorter files would overwrite each other
+			char * end;
+			long seconds=strtol(optarg, &end, 10);
+			if(end==optarg || *end!='\0' || seconds<1 || seconds>UINT32_MAX/2)
+			{
+				fprintf (stderr, "recording file length must be at least 1 s: %s\n", optarg);
+				show_usage++;
+			}else
+			{
+				recordRotateSeconds=(uint32_t)seconds;
+			}
+			printf("recording file length: %u s\n", recordRotateSeconds);
+			break;
+		}
+		case 'P':
+			if(!rtHardening_parsePriority(optarg))
+			{
+				fprintf (stderr, "invalid real-time priority: %s\n", optarg);
+				exit(1);
+			}
+			printf("real-time hardening, network thread priority: %s\n", optarg);
+			break;
+		case 'A':
+			if(!rtHardening_parseAffinity(optarg))
+			{
+				fprintf (stderr, "invalid CPU list: %s\n", optarg);
+				exit(1);
+			}
+			printf("network thread CPUs: %s\n", optarg);
 			break;
 		default:
 			fprintf (stderr, "error\n");
@@ -446,24 +2736,71 @@ int main(int argc, char *argv[])
 	}
 	printf("TCP port to start server on: %d\n", port);
 	if (show_usage) {
-		fprintf (stderr, "usage: jack-tcp-server [ -b baseSourceName ] [-p port]\n");
+		fprintf (stderr, "usage: jack-tcp-server [ -b baseSourceName ] [-p port] [-f fastStartMs] [-g growthRatePercent] [-l latencyMs] [-a [-m minLatencyMs] [-M maxLatencyMs]] [-s statusFile] [-t telemetryFile] [-H [-d driftPpm]] [-U unixSocketPath] [-I] [-r relayHost:port[,block|drop|disconnect]]... [-n] [-c resampler|wsola] [-B benchResultFile] [-w captureFile] [-R speex|polyphase] [-o recordDirectory[,mix] [-O rotateSeconds]] [-P priority[,fifo|rr]] [-A cpuList]\n");
 		exit (1);
 	}
+	if(benchFileName[0]!='\0')
+	{
+		run_benchmarks(benchFileName);
+		return 0;
+	}
 
 	listen_sock = socket(AF_INET, SOCK_STREAM, 0);
-
-	jackClient = jack_client_open ("TCP server", JackNullOption, NULL);
-	assert(jackClient != NULL);
+	server.fd = listen_sock;
 
 	signal(SIGINT, intHandler);
+	rtHardening_start();
 
-	jack_set_process_callback (jackClient, jack_process_frames_callback, NULL);
-	jack_on_shutdown (jackClient, jack_shutdown, NULL);
+	if(noPlayback)
+	{
+		samplerate = SAMPLERATE;
+	}else if(headless)
+	{
+		samplerate = HEADLESS_SAMPLERATE;
+		headless_start(samplerate, headlessDrift, jack_process_frames_callback);
+		rtHardening_thread(headless_thread(), "headless playback thread", 1, false);
+	}else
+	{
+		jackClient = jack_client_open ("TCP server", JackNullOption, NULL);
+		assert(jackClient != NULL);
+
+		jack_set_process_callback (jackClient, jack_process_frames_callback, NULL);
+		jack_on_shutdown (jackClient, jack_shutdown, NULL);
 
-	assert(!jack_activate (jackClient));
+		assert(!jack_activate (jackClient));
 
-	samplerate = jack_get_sample_rate(jackClient);
+		samplerate = jack_get_sample_rate(jackClient);
+	}
+	asyncLog_start(telemetryFileName[0]!='\0'?telemetryFileName:NULL, samplerate);
+	if(captureFileName[0]!='\0' && !streamCapture_start(captureFileName))
+	{
+		exit(1);
+	}
+	if(recordDirectory[0]!='\0')
+	{
+		if(noPlayback || !recordingTap_start(recordDirectory, samplerate, recordRotateSeconds))
+		{
+			fprintf (stderr, noPlayback?"nothing is played to record with -n\n":"cannot record into %s\n", recordDirectory);
+			exit(1);
+		}
+		recording=true;
+	}
+	if(nRelayTargets>0)
+	{
+		uint8_t * buffer=calloc(RELAY_RINGBUFFER_BYTES, 1);
+		assert(buffer!=NULL);
+		fanoutRing_create(&relay, RELAY_RINGBUFFER_BYTES, buffer);
+		for(int i=0;i<nRelayTargets;++i)
+		{
+			serverConnection_start(&relayTargets[i], &relay, i, ASYNC_LOG_CONNECTION(i), relay_parameters);
+			char name[32];
+			snprintf(name, sizeof(name), "relay %d thread", i);
+			rtHardening_thread(relayTargets[i].thread, name, 0, true);
+		}
+	}
 
+	int reuse=1;
+	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 	set_sockaddr(&srv_addr, port);
 	int err=bind(listen_sock, (struct sockaddr *)&srv_addr, sizeof(srv_addr));
 	assert(err==0);
@@ -473,72 +2810,100 @@ int main(int argc, char *argv[])
 
 	epfd = epoll_create(1);
 	epoll_ctl_add(epfd, listen_sock, EPOLLIN | EPOLLOUT | EPOLLET, &server);
+	if(shmSocketName[0]!='\0')
+	{
+		struct sockaddr_un un_addr;
+		memset(&un_addr, 0, sizeof(un_addr));
+		un_addr.sun_family=AF_UNIX;
+		snprintf(un_addr.sun_path, sizeof(un_addr.sun_path), "%s", shmSocketName);
+		shmServer.fd=socket(AF_UNIX, SOCK_STREAM, 0);
+		unlink(shmSocketName);
+		err=bind(shmServer.fd, (struct sockaddr *)&un_addr, sizeof(un_addr));
+		assert(err==0);
+		setnonblocking(shmServer.fd);
+		listen(shmServer.fd, 16);
+		epoll_ctl_add(epfd, shmServer.fd, EPOLLIN | EPOLLET, &shmServer);
+	}
+
+	if(useIoUring)
+	{
+		if(uringLoop_init(&uring, URING_ENTRIES, URING_BUFFER_COUNT, URING_BUFFER_SIZE))
+		{
+			uringLoop_poll(&uring, epfd, URING_EPOLL_USERDATA);
+			printf("io_uring network loop\n");
+		}else
+		{
+			printf("io_uring is not available (%s), using epoll\n", strerror(errno));
+			useIoUring=false;
+		}
+	}
 
-	socklen = sizeof(cli_addr);
+	/// The network loop runs in the main thread, the threads it would pass its priority to are already running
+	rtHardening_thread(pthread_self(), "network loop", 0, true);
+	rtHardening_report();
+	struct timespec lastStatus;
+	clock_gettime(CLOCK_MONOTONIC, &lastStatus);
 	while(!exitProgram) {
-		nfds = epoll_wait(epfd, events, MAX_EVENTS, 250);
-		for (i = 0; i < nfds; i++) {
-			if (events[i].data.ptr == &server) {
-				/* handle new connection */
-				conn_sock =
-				    accept(listen_sock,
-					   (struct sockaddr *)&cli_addr,
-					   &socklen);
-				setnonblocking(conn_sock);
-				openClient(conn_sock, &cli_addr);
-			} else if (events[i].events & EPOLLIN) {
-				tcpClient * client = events[i].data.ptr;
-				if(client!=NULL)
-				{
-					/* handle EPOLLIN event */
-					for (;;) {
-						uint32_t awW=ringBuffer_availableWrite(&(client->rb));
-						if(awW<1)
-						{
-							break;
-						}
-						uint8_t * buffer;
-			 		    int l =ringBuffer_accessWriteBuffer(&(client->rb), &buffer, awW);
-						n = read(client->fd, buffer, l);
-						if(n==0)
-						{
-							if(errno!=EAGAIN)
-							{
-								printf("Shutdown:\n");
-								client_shutdown(client);
-							}
-							break;
-						}else if (n < 0 /* || errno == EAGAIN */ )
-						{
-							if(errno!=EAGAIN)
-							{
-								printf("Shutdown 2 %d:\n", errno);
-								client_shutdown(client);
-							}
-							break;
-						} else {
-							ringBuffer_write(&(client->rb), n, NULL);
-							if(process_messages(client))
-							{
-								break;
-							}
-						}
-					}
-				}
-			} else if (events[i].events & (EPOLLRDHUP | EPOLLHUP)) {
-				tcpClient * client = events[i].data.ptr;
-				if(client!=NULL)
-				{
-					client_shutdown(client);
-				}
-			}
+		if(useIoUring)
+		{
+			uring_process_events(events, &server, &shmServer);
+		}else
+		{
+			TRACE_PROBE(loop_sleep);
+			nfds = epoll_wait(epfd, events, MAX_EVENTS, 250);
+			TRACE_PROBE1(loop_wake, nfds);
+			networkWakeups++;
+			networkSyscalls++;
+			handle_epoll_events(events, nfds, &server, &shmServer);
 		}
+		relay_publish();
+		send_time_requests();
+		send_flow_control();
+		if(statusFileName[0]!='\0' && elapsed_seconds(&lastStatus)>=STATUS_INTERVAL_SECONDS)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &lastStatus);
+			write_status();
+		}
+		free_closed_clients(false);
 	}
 	close(listen_sock);
 	while(tcpClients!=NULL)
 	{
 		client_shutdown((tcpClient *)tcpClients);
 	}
+	if(useIoUring)
+	{
+		networkSyscalls+=uring.enterCalls;
+		uringLoop_close(&uring);
+	}
+	free_closed_clients(true);
+	for(int i=0;i<nRelayTargets;++i)
+	{
+		serverConnection_stop(&relayTargets[i]);
+	}
+	if(shmServer.fd>=0)
+	{
+		close(shmServer.fd);
+		unlink(shmSocketName);
+	}
+	headless_stop();
+	streamCapture_stop();
+	recording=false;
+	recordingTap_stop();
+	asyncLog_stop();
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Network loop (%s): %llu wakeups, %llu system calls, CPU user %ld.%03ld s system %ld.%03ld s\n", useIoUring?"io_uring":"epoll",
+			(unsigned long long)networkWakeups, (unsigned long long)networkSyscalls,
+			(long)usage.ru_utime.tv_sec, (long)usage.ru_utime.tv_usec/1000, (long)usage.ru_stime.tv_sec, (long)usage.ru_stime.tv_usec/1000);
+	if(audioPayloadBytes>0)
+	{
+		printf("Audio copies per byte: %.2f (%llu bytes received)\n", (double)audioCopyBytes/audioPayloadBytes, (unsigned long long)audioPayloadBytes);
+	}
+	if(nRelayTargets>0)
+	{
+		printf("Relay: %u messages dropped\n", relayDrops);
+	}
 	printf("\nGraceful shutdown.\n");
 	return 0;
 }
@@ -0,0 +1,58 @@
+#include <string.h>
+#include "jitterEstimator.h"
+
+void jitterEstimator_init(jitterEstimator * j)
+{
+	memset(j, 0, sizeof(*j));
+}
+void jitterEstimator_update(jitterEstimator * j, double arrival, double chunkSeconds)
+{
+	if(!j->initialized)
+	{
+		j->initialized=true;
+		j->start=arrival;
+		j->mediaSeconds=0.0;
+		j->baseline=0.0;
+	}
+	double transit=arrival-j->start-j->mediaSeconds;
+	j->mediaSeconds+=chunkSeconds;
+	j->baseline+=JITTER_BASELINE_LEAK*chunkSeconds;
+	if(transit<j->baseline)
+	{
+		j->baseline=transit;
+	}
+	uint32_t bin=(uint32_t)((transit-j->baseline)/JITTER_BIN_SECONDS);
+	if(bin>=JITTER_BINS)
+	{
+		bin=JITTER_BINS-1;
+	}
+	j->histogram[bin]++;
+	j->count++;
+	if(j->count>=JITTER_HISTORY)
+	{
+		j->count=0;
+		for(int i=0;i<JITTER_BINS;++i)
+		{
+			j->histogram[i]/=2;
+			j->count+=j->histogram[i];
+		}
+	}
+}
+float jitterEstimator_percentile(jitterEstimator * j, float ratio)
+{
+	if(j->count==0)
+	{
+		return 0.0f;
+	}
+	uint32_t limit=(uint32_t)(ratio*j->count);
+	uint32_t sum=0;
+	for(int i=0;i<JITTER_BINS;++i)
+	{
+		sum+=j->histogram[i];
+		if(sum>limit)
+		{
+			return (i+1)*JITTER_BIN_SECONDS;
+		}
+	}
+	return JITTER_BINS*JITTER_BIN_SECONDS;
+}
@@ -0,0 +1,44 @@
+#ifndef JITTER_ESTIMATOR_H_
+#define JITTER_ESTIMATOR_H_
+
+/// Estimate network arrival jitter of an audio stream.
+/// The transit time of each chunk is measured as its arrival time minus the audio duration received before it.
+/// The minimum transit time is the baseline (a chunk that arrived without any lag). Jitter of a chunk is its transit time above the baseline.
+/// Jitter values are collected into a histogram that slowly forgets old values so percentiles follow the current network conditions.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Width of one histogram bin in seconds
+#define JITTER_BIN_SECONDS (0.002)
+/// Number of histogram bins. Jitter above the last bin is counted in the last bin.
+#define JITTER_BINS 2048
+/// When this many values are collected then all bins are halved so old values are forgotten gradually
+#define JITTER_HISTORY 4096
+/// The baseline may increase by this ratio of received audio duration. This follows clock drift between client and server and route changes.
+#define JITTER_BASELINE_LEAK (0.01)
+
+typedef struct {
+	/// true after the first chunk was registered
+	bool initialized;
+	/// Arrival time of the first chunk in seconds
+	double start;
+	/// Duration of audio received before the current chunk in seconds
+	double mediaSeconds;
+	/// Minimum transit time seen (slowly leaking upwards)
+	double baseline;
+	/// Number of values in the histogram
+	uint32_t count;
+	uint32_t histogram[JITTER_BINS];
+} jitterEstimator;
+
+/// Initialize the estimator to the state with no measurements
+void jitterEstimator_init(jitterEstimator * j);
+/// Register the arrival of a chunk
+/// @param arrival arrival time in seconds (monotonic clock)
+/// @param chunkSeconds duration of audio in the chunk
+void jitterEstimator_update(jitterEstimator * j, double arrival, double chunkSeconds);
+/// Get the jitter in seconds that is not exceeded by the given ratio of chunks (for example 0.99)
+float jitterEstimator_percentile(jitterEstimator * j, float ratio);
+
+#endif /* JITTER_ESTIMATOR_H_ */
@@ -0,0 +1,81 @@
+#!/bin/sh
+
+# Latency histograms of a running jack-tcp-server or jack-tcp-client from its static tracepoints (see traceProbes.h).
+# The program has to be built with make WITH_USDT=1. Needs bpftrace and root.
+# Prints after the given time:
+# - callback_us: duration of the Jack process callback, callback_max_us its worst case
+# - lock_wait_us, lock_hold_us: time waiting for and holding a mutex, per lock (0 tcpClients list, 1 relay)
+# - loop_busy_us: time the network loop works after a wakeup, loop_events: events per epoll wakeup (-1 for io_uring)
+# - resample_us: duration of a resample() call, resample_batch_frames: output frames per resampler step
+# - message_bytes: payload of the parsed messages, messages: count per message type
+# - client: capture drops and connects of the server connections
+# Usage: ./latency-trace.sh [seconds] [pid]
+# The pid defaults to the running jack-tcp-server, or jack-tcp-client when no server runs.
+
+DURATION=${1:-30}
+PID=${2:-$(pidof -s jack-tcp-server || pidof -s jack-tcp-client)}
+if [ -z "$PID" ]
+then
+	echo "no jack-tcp-server or jack-tcp-client is running"
+	exit 1
+fi
+BIN=$(readlink /proc/$PID/exe)
+if ! readelf -n "$BIN" | grep -q "Provider: jacktcp"
+then
+	echo "$BIN has no tracepoints, build it with make WITH_USDT=1"
+	exit 1
+fi
+
+PROGRAM="
+usdt:$BIN:jacktcp:process_start { @process[tid]=nsecs; }
+usdt:$BIN:jacktcp:process_end /@process[tid]/ {
+	\$us=(nsecs-@process[tid])/1000;
+	@callback_us=hist(\$us);
+	@callback_max_us=max(\$us);
+	delete(@process[tid]);
+}
+"
+CLEAR="clear(@process);"
+if readelf -n "$BIN" | grep -q "Name: resample_start"
+then
+	PROGRAM="$PROGRAM
+usdt:$BIN:jacktcp:lock_wait { @wait[tid, arg0]=nsecs; }
+usdt:$BIN:jacktcp:lock_acquired /@wait[tid, arg0]/ {
+	@lock_wait_us[arg0]=hist((nsecs-@wait[tid, arg0])/1000);
+	delete(@wait[tid, arg0]);
+	@held[tid, arg0]=nsecs;
+}
+usdt:$BIN:jacktcp:lock_release /@held[tid, arg0]/ {
+	@lock_hold_us[arg0]=hist((nsecs-@held[tid, arg0])/1000);
+	delete(@held[tid, arg0]);
+}
+usdt:$BIN:jacktcp:loop_wake { @woke[tid]=nsecs; @loop_events=hist(arg0); }
+usdt:$BIN:jacktcp:loop_sleep /@woke[tid]/ {
+	@loop_busy_us=hist((nsecs-@woke[tid])/1000);
+	delete(@woke[tid]);
+}
+usdt:$BIN:jacktcp:resample_start { @resampling[tid]=nsecs; }
+usdt:$BIN:jacktcp:resample_end /@resampling[tid]/ {
+	@resample_us=hist((nsecs-@resampling[tid])/1000);
+	delete(@resampling[tid]);
+}
+usdt:$BIN:jacktcp:resample_batch { @resample_batch_frames=hist(arg2); }
+usdt:$BIN:jacktcp:message { @message_bytes=hist(arg2); @messages[arg1 & 0xffff]=count(); }
+usdt:$BIN:jacktcp:client_create { printf(\"%d ms: client %d created\\n\", elapsed/1000000, arg0); }
+usdt:$BIN:jacktcp:client_start { printf(\"%d ms: client %d started playback\\n\", elapsed/1000000, arg0); }
+usdt:$BIN:jacktcp:client_shutdown { printf(\"%d ms: client %d shut down, %d underruns\\n\", elapsed/1000000, arg0, arg1); }
+"
+	CLEAR="$CLEAR clear(@wait); clear(@held); clear(@woke); clear(@resampling);"
+else
+	PROGRAM="$PROGRAM
+usdt:$BIN:jacktcp:capture_drop { @capture_drops=sum(arg0); }
+"
+fi
+PROGRAM="$PROGRAM
+usdt:$BIN:jacktcp:connection_connect { printf(\"%d ms: connection %d connected after %d ms\\n\", elapsed/1000000, arg0, arg1); }
+usdt:$BIN:jacktcp:connection_disconnect { printf(\"%d ms: connection %d disconnected\\n\", elapsed/1000000, arg0); }
+interval:s:$DURATION { exit(); }
+END { $CLEAR }
+"
+echo "tracing $BIN ($PID) for $DURATION seconds"
+bpftrace -p $PID -e "$PROGRAM"
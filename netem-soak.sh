@@ -0,0 +1,51 @@
+#!/bin/sh
+
+# Soak test of buffer and rate control settings through the network impairment emulator.
+# Runs a headless server, the emulator and a headless client on loopback for each scenario
+# and prints a report of underruns, overflow drops and latency.
+# Usage: ./netem-soak.sh [secondsPerScenario] [extra server options...]
+
+DURATION=${1:-60}
+[ $# -gt 0 ] && shift
+SERVER_OPTIONS="$*"
+SERVER_PORT=18080
+NETEM_PORT=18081
+OUT=${OUT:-/tmp/netem-soak}
+mkdir -p $OUT
+
+# name|jack-tcp-netem options
+SCENARIOS="
+lan|-d 1 -j 1
+wifi|-d 5 -j 30 -J exponential
+bad-wifi|-d 10 -j 80 -J pareto -i 10000 -s 300
+stalls|-d 2 -j 5 -i 5000 -s 800
+narrow|-d 20 -j 10 -J normal -r 3200
+"
+
+run_scenario() {
+	NAME=$1
+	NETEM_OPTIONS=$2
+	./jack-tcp-server -H -p $SERVER_PORT -s $OUT/$NAME.status $SERVER_OPTIONS >$OUT/$NAME.server.log 2>&1 &
+	SERVER=$!
+	sleep 0.5
+	./jack-tcp-netem -l $NETEM_PORT -u localhost:$SERVER_PORT -S 1 $NETEM_OPTIONS >$OUT/$NAME.netem.log 2>&1 &
+	NETEM=$!
+	sleep 0.5
+	./jack-tcp-client -H 48000 -u localhost:$NETEM_PORT >$OUT/$NAME.client.log 2>&1 &
+	CLIENT=$!
+	sleep $DURATION
+	cp $OUT/$NAME.status $OUT/$NAME.final 2>/dev/null
+	kill $CLIENT
+	sleep 0.5
+	kill -INT $NETEM $SERVER
+	wait $SERVER $NETEM 2>/dev/null
+	echo "== $NAME ($NETEM_OPTIONS)"
+	cat $OUT/$NAME.final 2>/dev/null
+	grep "netem report" $OUT/$NAME.netem.log | tail -n 1
+	grep "Time to first audio" $OUT/$NAME.server.log | head -n 1
+}
+
+echo "$SCENARIOS" | while IFS='|' read NAME NETEM_OPTIONS
+do
+	[ -n "$NAME" ] && run_scenario "$NAME" "$NETEM_OPTIONS"
+done
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+# Compare the epoll and the io_uring network loop of the server.
+# Runs a headless server with 10, 100 and 500 headless clients on loopback for each loop
+# and prints the wakeups, network system calls and CPU time logged by the server at exit.
+# Usage: ./netloop-bench.sh [seconds] [client counts...]
+
+DURATION=${1:-20}
+[ $# -gt 0 ] && shift
+COUNTS=${*:-10 100 500}
+SERVER_PORT=18082
+OUT=${OUT:-/tmp/netloop-bench}
+mkdir -p $OUT
+
+run_bench() {
+	LOOP=$1
+	N=$2
+	OPTIONS=""
+	[ $LOOP = io_uring ] && OPTIONS="-I"
+	./jack-tcp-server -H -p $SERVER_PORT -l 200 $OPTIONS >$OUT/$LOOP.$N.server.log 2>&1 &
+	SERVER=$!
+	sleep 0.5
+	CLIENTS=""
+	i=0
+	while [ $i -lt $N ]
+	do
+		./jack-tcp-client -H 48000 -u localhost:$SERVER_PORT >/dev/null 2>&1 &
+		CLIENTS="$CLIENTS $!"
+		i=$((i+1))
+	done
+	sleep $DURATION
+	kill -INT $SERVER
+	wait $SERVER 2>/dev/null
+	kill $CLIENTS 2>/dev/null
+	wait 2>/dev/null
+	echo "== $LOOP $N clients"
+	grep "Network loop" $OUT/$LOOP.$N.server.log
+	grep "Report TCP" $OUT/$LOOP.$N.server.log | awk '{ u+=$4 } END { print "underruns: " u }'
+}
+
+for N in $COUNTS
+do
+	run_bench epoll $N
+	run_bench io_uring $N
+done
@@ -0,0 +1,135 @@
+#include <string.h>
+#include <time.h>
+#include "opusCodec.h"
+#include "tcp-protocol.h"
+
+double opusCodec_cpuPercent(const opusCodec * c)
+{
+	if(c->frames==0)
+	{
+		return 0.0;
+	}
+	return c->cpuNs*1e-7/((double)c->frames/OPUS_SAMPLERATE);
+}
+double opusCodec_kbps(const opusCodec * c)
+{
+	if(c->frames==0)
+	{
+		return 0.0;
+	}
+	return c->bytes*8e-3/((double)c->frames/OPUS_SAMPLERATE);
+}
+
+#ifdef WITH_OPUS
+#include <opus.h>
+
+/// Thread CPU time in nanoseconds
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+
+bool opusCodec_available(void)
+{
+	return true;
+}
+bool opusCodec_createEncoder(opusCodec * c, int32_t bitrate)
+{
+	int err;
+	memset(c, 0, sizeof(*c));
+	OpusEncoder * encoder=opus_encoder_create(OPUS_SAMPLERATE, NPORT, OPUS_APPLICATION_AUDIO, &err);
+	if(encoder==NULL)
+	{
+		return false;
+	}
+	opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+	c->state=encoder;
+	c->encoder=true;
+	return true;
+}
+bool opusCodec_createDecoder(opusCodec * c)
+{
+	int err;
+	memset(c, 0, sizeof(*c));
+	c->state=opus_decoder_create(OPUS_SAMPLERATE, NPORT, &err);
+	return c->state!=NULL;
+}
+void opusCodec_destroy(opusCodec * c)
+{
+	if(c->state!=NULL)
+	{
+		if(c->encoder)
+		{
+			opus_encoder_destroy((OpusEncoder *)c->state);
+		}else
+		{
+			opus_decoder_destroy((OpusDecoder *)c->state);
+		}
+		c->state=NULL;
+	}
+}
+int32_t opusCodec_encode(opusCodec * c, const float * pcm, uint8_t * packet, uint32_t maxBytes)
+{
+	uint64_t start=thread_cpu_ns();
+	int32_t n=opus_encode_float((OpusEncoder *)c->state, pcm, OPUS_FRAME_FRAMES, packet, (opus_int32)maxBytes);
+	c->cpuNs+=thread_cpu_ns()-start;
+	if(n>0)
+	{
+		c->bytes+=n;
+		c->frames+=OPUS_FRAME_FRAMES;
+	}
+	return n;
+}
+int32_t opusCodec_packetFrames(const uint8_t * packet, uint32_t length)
+{
+	return opus_packet_get_nb_samples(packet, (opus_int32)length, OPUS_SAMPLERATE);
+}
+int32_t opusCodec_decode(opusCodec * c, const uint8_t * packet, uint32_t length, float * pcm, uint32_t maxFrames)
+{
+	uint64_t start=thread_cpu_ns();
+	int32_t n=opus_decode_float((OpusDecoder *)c->state, packet, (opus_int32)length, pcm, (int)maxFrames, 0);
+	c->cpuNs+=thread_cpu_ns()-start;
+	if(n>0)
+	{
+		c->bytes+=length;
+		c->frames+=n;
+	}
+	return n;
+}
+
+#else
+
+/// Built without libopus: Opus streams can not be encoded or decoded (a relay can still forward them)
+bool opusCodec_available(void)
+{
+	return false;
+}
+bool opusCodec_createEncoder(opusCodec * c, int32_t bitrate)
+{
+	memset(c, 0, sizeof(*c));
+	return false;
+}
+bool opusCodec_createDecoder(opusCodec * c)
+{
+	memset(c, 0, sizeof(*c));
+	return false;
+}
+void opusCodec_destroy(opusCodec * c)
+{
+}
+int32_t opusCodec_encode(opusCodec * c, const float * pcm, uint8_t * packet, uint32_t maxBytes)
+{
+	return -1;
+}
+int32_t opusCodec_packetFrames(const uint8_t * packet, uint32_t length)
+{
+	return -1;
+}
+int32_t opusCodec_decode(opusCodec * c, const uint8_t * packet, uint32_t length, float * pcm, uint32_t maxFrames)
+{
+	return -1;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef OPUS_CODEC_H_
+#define OPUS_CODEC_H_
+
+/// Opus encoder and decoder of NPORT channel float audio for SAMPLE_TYPE_OPUS streams, with CPU time and bitrate statistics.
+/// libopus is optional: it is used when compiled with WITH_OPUS (make WITH_OPUS=1), otherwise creating a codec fails.
+
+#include "simulator_types.h"
+
+/// Number of frames the client encodes into a single Opus packet (20 ms at OPUS_SAMPLERATE)
+#define OPUS_FRAME_FRAMES 960
+/// Maximum number of frames in an Opus packet (120 ms at OPUS_SAMPLERATE)
+#define OPUS_MAX_FRAMES 5760
+
+typedef struct {
+	/// OpusEncoder or OpusDecoder. NULL when the codec is not created.
+	void * state;
+	bool encoder;
+	/// Thread CPU time used by encoding or decoding in nanoseconds
+	uint64_t cpuNs;
+	/// Number of packet bytes produced or consumed
+	uint64_t bytes;
+	/// Number of frames encoded or decoded
+	uint64_t frames;
+} opusCodec;
+
+/// Is Opus support compiled in?
+bool opusCodec_available(void);
+/// Create an encoder for OPUS_SAMPLERATE, NPORT channels
+/// @param bitrate bits per second
+/// @return false when Opus is not available or the encoder could not be created
+bool opusCodec_createEncoder(opusCodec * c, int32_t bitrate);
+/// Create a decoder for OPUS_SAMPLERATE, NPORT channels
+/// @return false when Opus is not available or the decoder could not be created
+bool opusCodec_createDecoder(opusCodec * c);
+/// Free the encoder or decoder. Safe to call on a codec that was not created.
+void opusCodec_destroy(opusCodec * c);
+/// Encode OPUS_FRAME_FRAMES interleaved frames into a packet
+/// @return size of the packet in bytes or a negative value on error
+int32_t opusCodec_encode(opusCodec * c, const float * pcm, uint8_t * packet, uint32_t maxBytes);
+/// Number of frames in a packet
+/// @return negative value when the packet is invalid
+int32_t opusCodec_packetFrames(const uint8_t * packet, uint32_t length);
+/// Decode a packet into interleaved frames
+/// @param maxFrames size of pcm in frames
+/// @return number of frames decoded or a negative value on error
+int32_t opusCodec_decode(opusCodec * c, const uint8_t * packet, uint32_t length, float * pcm, uint32_t maxFrames);
+/// CPU time used by the codec in percent of the duration of the audio it processed
+double opusCodec_cpuPercent(const opusCodec * c);
+/// Average bitrate of the packets in kbit/s
+double opusCodec_kbps(const opusCodec * c);
+
+#endif /* OPUS_CODEC_H_ */
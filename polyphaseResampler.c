@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "polyphaseResampler.h"
+#if defined(__SSE__) && NPORT==2
+#include <xmmintrin.h>
+#endif
+
+/// Cutoff of the filter relative to the Nyquist frequency of the lower rate. The transition band of the filter
+/// is centered below the Nyquist frequency so little of it aliases.
+#define POLYPHASE_CUTOFF 0.92
+
+/// Modified Bessel function of the first kind, order 0 for the Kaiser window
+static double bessel_i0(double x)
+{
+	double sum=1.0;
+	double term=1.0;
+	for(int k=1;k<50 && term>sum*1e-12;++k)
+	{
+		term*=(x/(2.0*k))*(x/(2.0*k));
+		sum+=term;
+	}
+	return sum;
+}
+bool polyphaseResampler_create(polyphaseResampler * r, uint32_t inRate, uint32_t outRate)
+{
+	memset(r, 0, sizeof(*r));
+	void * coefficients;
+	if(posix_memalign(&coefficients, 16, (POLYPHASE_PHASES+1)*POLYPHASE_TAPS*sizeof(float))!=0)
+	{
+		return false;
+	}
+	r->coefficients=(float *)coefficients;
+	/// Cutoff in cycles per input frame
+	double cutoff=0.5*POLYPHASE_CUTOFF*(outRate<inRate?(double)outRate/inRate:1.0);
+	const double half=POLYPHASE_TAPS/2;
+	for(int p=0;p<=POLYPHASE_PHASES;++p)
+	{
+		float * h=r->coefficients+p*POLYPHASE_TAPS;
+		double sum=0.0;
+		for(int k=0;k<POLYPHASE_TAPS;++k)
+		{
+			/// Distance of the tap from the output position in input frames
+			double d=k-(half-1)-(double)p/POLYPHASE_PHASES;
+			double x=2.0*cutoff*d;
+			double sinc=fabs(x)<1e-9?1.0:sin(M_PI*x)/(M_PI*x);
+			double u=d/half;
+			double window=fabs(u)<1.0?bessel_i0(POLYPHASE_KAISER_BETA*sqrt(1.0-u*u))/bessel_i0(POLYPHASE_KAISER_BETA):0.0;
+			h[k]=(float)(2.0*cutoff*sinc*window);
+			sum+=h[k];
+		}
+		/// Unity gain at DC for each phase
+		for(int k=0;k<POLYPHASE_TAPS;++k)
+		{
+			h[k]=(float)(h[k]/sum);
+		}
+	}
+	polyphaseResampler_setRate(r, inRate, outRate);
+	polyphaseResampler_reset(r);
+	return true;
+}
+void polyphaseResampler_destroy(polyphaseResampler * r)
+{
+	free(r->coefficients);
+	r->coefficients=NULL;
+}
+void polyphaseResampler_setRate(polyphaseResampler * r, double inRate, uint32_t outRate)
+{
+	r->step=inRate/outRate;
+}
+void polyphaseResampler_reset(polyphaseResampler * r)
+{
+	memset(r->history, 0, sizeof(r->history));
+	/// The center of the filter is on the first input frame
+	r->position=POLYPHASE_HISTORY;
+}
+void polyphaseResampler_prime(polyphaseResampler * r, const float * frames)
+{
+	memcpy(r->history, frames, sizeof(r->history));
+	r->position=POLYPHASE_HISTORY;
+}
+#if defined(__SSE__) && NPORT==2
+/// Output frame of the filter at src with the coefficients interpolated between phase h0 and the following one
+static inline void filter(const float * src, const float * h0, float weight, float * out)
+{
+	const float * h1=h0+POLYPHASE_TAPS;
+	__m128 w=_mm_set1_ps(weight);
+	__m128 even=_mm_setzero_ps();
+	__m128 odd=_mm_setzero_ps();
+	for(int k=0;k<POLYPHASE_TAPS;k+=4)
+	{
+		__m128 a=_mm_load_ps(h0+k);
+		__m128 h=_mm_add_ps(a, _mm_mul_ps(w, _mm_sub_ps(_mm_load_ps(h1+k), a)));
+		/// 4 taps of 2 channels: each coefficient is used for the left and the right sample of its frame
+		even=_mm_add_ps(even, _mm_mul_ps(_mm_loadu_ps(src+2*k), _mm_unpacklo_ps(h, h)));
+		odd=_mm_add_ps(odd, _mm_mul_ps(_mm_loadu_ps(src+2*k+4), _mm_unpackhi_ps(h, h)));
+	}
+	/// Left and right sums of two frames in each lane pair
+	__m128 sum=_mm_add_ps(even, odd);
+	sum=_mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	_mm_storel_pi((__m64 *)out, sum);
+}
+#else
+/// Output frame of the filter at src with the coefficients interpolated between phase h0 and the following one
+static inline void filter(const float * src, const float * h0, float weight, float * out)
+{
+	const float * h1=h0+POLYPHASE_TAPS;
+	float sum[NPORT];
+	memset(sum, 0, sizeof(sum));
+	for(int k=0;k<POLYPHASE_TAPS;++k)
+	{
+		float h=h0[k]+weight*(h1[k]-h0[k]);
+		for(int c=0;c<NPORT;++c)
+		{
+			sum[c]+=src[k*NPORT+c]*h;
+		}
+	}
+	memcpy(out, sum, sizeof(sum));
+}
+#endif
+void polyphaseResampler_process(polyphaseResampler * r, const float * in, uint32_t * inLen, float * out, uint32_t * outLen)
+{
+	/// The input frames are numbered from the first history frame. Filters that start in the history read the history
+	/// followed by the first input frames from scratch, the others read the input in place.
+	const uint32_t n=*inLen;
+	float scratch[2*POLYPHASE_HISTORY*NPORT];
+	uint32_t head=n<POLYPHASE_HISTORY?n:POLYPHASE_HISTORY;
+	memcpy(scratch, r->history, sizeof(r->history));
+	memcpy(scratch+POLYPHASE_HISTORY*NPORT, in, head*NPORT*sizeof(float));
+	double position=r->position;
+	uint32_t produced=0;
+	while(produced<*outLen)
+	{
+		uint32_t base=(uint32_t)position;
+		uint32_t start=base-(POLYPHASE_TAPS/2-1);
+		if(start+POLYPHASE_TAPS>POLYPHASE_HISTORY+n)
+		{
+			break;
+		}
+		const float * src=start<POLYPHASE_HISTORY?scratch+start*NPORT:in+(start-POLYPHASE_HISTORY)*NPORT;
+		double phase=(position-base)*POLYPHASE_PHASES;
+		uint32_t p=(uint32_t)phase;
+		if(p>=POLYPHASE_PHASES)
+		{
+			p=POLYPHASE_PHASES-1;
+		}
+		filter(src, r->coefficients+p*POLYPHASE_TAPS, (float)(phase-p), out+produced*NPORT);
+		produced++;
+		position+=r->step;
+	}
+	/// Consume the input frames before the next filter start, the last POLYPHASE_HISTORY of them become the history
+	uint32_t start=(uint32_t)position-(POLYPHASE_TAPS/2-1);
+	uint32_t consumed=start<n?start:n;
+	if(consumed<POLYPHASE_HISTORY)
+	{
+		memmove(r->history, r->history+consumed*NPORT, (POLYPHASE_HISTORY-consumed)*NPORT*sizeof(float));
+		memcpy(r->history+(POLYPHASE_HISTORY-consumed)*NPORT, in, consumed*NPORT*sizeof(float));
+	}else
+	{
+		memcpy(r->history, in+(consumed-POLYPHASE_HISTORY)*NPORT, sizeof(r->history));
+	}
+	r->position=position-consumed;
+	*inLen=consumed;
+	*outLen=produced;
+}
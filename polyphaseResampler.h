@@ -0,0 +1,53 @@
+#ifndef POLYPHASE_RESAMPLER_H_
+#define POLYPHASE_RESAMPLER_H_
+
+/// Polyphase FIR resampler of NPORT channel interleaved float audio (jack-tcp-server -R polyphase).
+/// Alternative of the speex resampler specialized for the streams of this project: a fixed channel count and filter length
+/// known at compile time, a ratio that is set once per stream (typically 44100 to 48000 or 48000 to 48000) and corrected
+/// by a few percent all the time. The ratio is a double, so the speed correction is smooth and not rounded to 1 Hz.
+/// The filter is a Kaiser windowed sinc tabulated at POLYPHASE_PHASES fractional positions. The coefficients of the exact
+/// position of an output frame are interpolated linearly between the two nearest phases.
+/// The inner product uses SSE for 2 channels, other channel counts use the generic C code.
+
+#include "simulator_types.h"
+#include "tcp-protocol.h"
+
+/// Filter length in input frames. Must be a multiple of 4.
+#define POLYPHASE_TAPS 64
+/// Number of tabulated fractional positions between two input frames
+#define POLYPHASE_PHASES 256
+/// Kaiser window parameter: about 90 dB stopband attenuation
+#define POLYPHASE_KAISER_BETA 9.0
+/// Input frames kept from the previous call
+#define POLYPHASE_HISTORY (POLYPHASE_TAPS-1)
+
+typedef struct {
+	/// (POLYPHASE_PHASES+1)*POLYPHASE_TAPS coefficients, 16 byte aligned. NULL when the resampler is not created.
+	float * coefficients;
+	/// Input frames consumed per output frame
+	double step;
+	/// Position of the next output frame in the input. Counted from the first frame of history.
+	double position;
+	/// The last POLYPHASE_HISTORY input frames
+	float history[POLYPHASE_HISTORY*NPORT];
+} polyphaseResampler;
+
+/// Create a resampler. The filter cutoff is set for the given rates, later rate changes (speed correction) keep it.
+/// @return false when the memory can not be allocated
+bool polyphaseResampler_create(polyphaseResampler * r, uint32_t inRate, uint32_t outRate);
+/// Free the resampler. Safe to call on a resampler that was not created.
+void polyphaseResampler_destroy(polyphaseResampler * r);
+/// Change the ratio. The input rate may be fractional.
+void polyphaseResampler_setRate(polyphaseResampler * r, double inRate, uint32_t outRate);
+/// Forget the history. The next output frame is the first input frame: the filter delay is not added to the output.
+void polyphaseResampler_reset(polyphaseResampler * r);
+/// Continue after input frames that were not given to the resampler (passthrough of jack-tcp-server): like polyphaseResampler_reset(),
+/// but the history is the last POLYPHASE_HISTORY of these frames, so the filter of the first output frames sees the real input.
+/// @param frames POLYPHASE_HISTORY frames, the last one is the frame before the next input frame
+void polyphaseResampler_prime(polyphaseResampler * r, const float * frames);
+/// Resample interleaved frames like speex_resampler_process_interleaved_float()
+/// @param inLen number of input frames, set to the number of frames consumed
+/// @param outLen size of out in frames, set to the number of frames written
+void polyphaseResampler_process(polyphaseResampler * r, const float * in, uint32_t * inLen, float * out, uint32_t * outLen);
+
+#endif /* POLYPHASE_RESAMPLER_H_ */
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+#include "recordingTap.h"
+#include "ringBuffer.h"
+#include "tcp-protocol.h"
+
+/// Bytes of a frame in the files
+#define RECORDING_FRAME_BYTES (NPORT*sizeof(float))
+/// Size of the WAV header written in front of the frames
+#define WAV_HEADER_BYTES 44
+
+/// Record type: name of a stream, followed by nameLength bytes
+#define RECORD_OPEN 1
+/// Record type: played frames of a stream, followed by frames*RECORDING_FRAME_BYTES bytes
+#define RECORD_FRAMES 2
+
+/// Header of a record in the ringbuffer
+struct record {
+	/// Playback position of the first frame
+	uint64_t position;
+	uint32_t stream;
+	uint32_t frames;
+	uint8_t type;
+	uint8_t nameLength;
+};
+
+/// A stream being recorded and its current file
+typedef struct {
+	bool used;
+	uint32_t stream;
+	char name[128];
+	/// The file, -1 while no file is open
+	int fd;
+	/// Number of frame bytes in the file, written or collected
+	uint32_t dataBytes;
+	/// Playback position expected for the next frames
+	uint64_t nextPosition;
+	/// CLOCK_MONOTONIC time the file was started and of the last frames in nanoseconds
+	uint64_t startNs;
+	uint64_t lastNs;
+	/// Frames collected but not written yet
+	uint8_t * buffer;
+	uint32_t bufferLength;
+} recordingFile;
+
+/// Records not written yet. Written by the Jack thread, read by the writer thread.
+static ringBuffer_t records;
+/// Periods dropped because the ringbuffer was full
+static volatile uint32_t dropped=0;
+static recordingFile files[RECORDING_MAX_FILES];
+static char directory[256];
+static uint32_t samplerate;
+static uint32_t rotateSeconds;
+static pthread_t thread;
+static volatile bool running=false;
+/// Statistics of the writer thread: write() calls, bytes written and files created
+static uint64_t writeCalls=0;
+static uint64_t writtenBytes=0;
+static uint32_t createdFiles=0;
+
+/// CLOCK_MONOTONIC time in nanoseconds
+static uint64_t recording_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+static void put_u32(uint8_t * p, uint32_t v)
+{
+	p[0]=v;
+	p[1]=v>>8;
+	p[2]=v>>16;
+	p[3]=v>>24;
+}
+static void put_u16(uint8_t * p, uint16_t v)
+{
+	p[0]=v;
+	p[1]=v>>8;
+}
+/// WAV header of 32 bit float frames
+static void wav_header(uint8_t * h, uint32_t dataBytes)
+{
+	memcpy(h, "RIFF", 4);
+	put_u32(h+4, WAV_HEADER_BYTES-8+dataBytes);
+	memcpy(h+8, "WAVEfmt ", 8);
+	put_u32(h+16, 16);
+	/// WAVE_FORMAT_IEEE_FLOAT
+	put_u16(h+20, 3);
+	put_u16(h+22, NPORT);
+	put_u32(h+24, samplerate);
+	put_u32(h+28, samplerate*RECORDING_FRAME_BYTES);
+	put_u16(h+32, RECORDING_FRAME_BYTES);
+	put_u16(h+34, 32);
+	memcpy(h+36, "data", 4);
+	put_u32(h+40, dataBytes);
+}
+/// Write all of data, retrying short writes
+static void write_all(int fd, const uint8_t * data, uint32_t n)
+{
+	while(n>0)
+	{
+		ssize_t w=write(fd, data, n);
+		writeCalls++;
+		if(w<0 && errno==EINTR)
+		{
+			continue;
+		}
+		if(w<=0)
+		{
+			perror("recording write()");
+			return;
+		}
+		writtenBytes+=w;
+		data+=w;
+		n-=w;
+	}
+}
+/// Write the collected frames of a file and update its WAV header
+static void file_flush(recordingFile * f)
+{
+	if(f->fd<0)
+	{
+		return;
+	}
+	if(f->bufferLength>0)
+	{
+		write_all(f->fd, f->buffer, f->bufferLength);
+		f->bufferLength=0;
+	}
+	uint8_t header[WAV_HEADER_BYTES];
+	wav_header(header, f->dataBytes);
+	if(pwrite(f->fd, header, sizeof(header), 0)!=sizeof(header))
+	{
+		perror("recording pwrite()");
+	}
+}
+static void file_close(recordingFile * f)
+{
+	if(f->fd>=0)
+	{
+		file_flush(f);
+		close(f->fd);
+		f->fd=-1;
+	}
+}
+/// Start a new file of the stream named after the stream and the local time. When the file can not be created the frames
+/// of the stream are dropped until the next rotation.
+static void file_open(recordingFile * f)
+{
+	file_close(f);
+	f->startNs=recording_now();
+	char date[32];
+	char path[512];
+	time_t t=time(NULL);
+	struct tm local;
+	localtime_r(&t, &local);
+	strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &local);
+	snprintf(path, sizeof(path), "%s/%s-%s.wav", directory, f->name, date);
+	f->fd=open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(f->fd<0)
+	{
+		perror(path);
+		return;
+	}
+	uint8_t header[WAV_HEADER_BYTES];
+	wav_header(header, 0);
+	write_all(f->fd, header, sizeof(header));
+	f->dataBytes=0;
+	createdFiles++;
+}
+/// Find the recorded stream or start recording it
+static recordingFile * file_find(uint32_t stream)
+{
+	recordingFile * unused=NULL;
+	for(int i=0;i<RECORDING_MAX_FILES;++i)
+	{
+		if(files[i].used && files[i].stream==stream)
+		{
+			return &files[i];
+		}
+		if(!files[i].used && unused==NULL)
+		{
+			unused=&files[i];
+		}
+	}
+	if(unused!=NULL)
+	{
+		unused->used=true;
+		unused->stream=stream;
+		unused->fd=-1;
+		unused->nextPosition=0;
+		unused->startNs=0;
+		unused->bufferLength=0;
+		unused->lastNs=recording_now();
+		snprintf(unused->name, sizeof(unused->name), stream==RECORDING_MIX_STREAM?"mix":"stream%u", stream);
+	}
+	return unused;
+}
+/// Collect bytes of frames of a file, taken from the ringbuffer or silence
+static void file_append(recordingFile * f, uint32_t n, bool silence)
+{
+	while(n>0)
+	{
+		if(f->bufferLength==RECORDING_FILE_BUFFER_BYTES)
+		{
+			file_flush(f);
+		}
+		uint32_t m=RECORDING_FILE_BUFFER_BYTES-f->bufferLength;
+		m=m<n?m:n;
+		if(silence)
+		{
+			memset(f->buffer+f->bufferLength, 0, m);
+		}else
+		{
+			ringBuffer_read(&records, m, f->buffer+f->bufferLength);
+		}
+		f->bufferLength+=m;
+		f->dataBytes+=m;
+		n-=m;
+	}
+}
+/// Store the frames of a record into the file of its stream. The file is rotated or started again after a long gap,
+/// a short gap (dropped periods) is filled with silence.
+static void handle_frames(const struct record * r)
+{
+	uint32_t bytes=r->frames*RECORDING_FRAME_BYTES;
+	recordingFile * f=file_find(r->stream);
+	if(f==NULL)
+	{
+		ringBuffer_read(&records, bytes, NULL);
+		return;
+	}
+	if(f->buffer==NULL)
+	{
+		f->buffer=malloc(RECORDING_FILE_BUFFER_BYTES);
+		assert(f->buffer!=NULL);
+	}
+	uint64_t gap=r->position>f->nextPosition?r->position-f->nextPosition:0;
+	uint64_t now=recording_now();
+	if(f->startNs==0 || gap>(uint64_t)RECORDING_MAX_GAP_SECONDS*samplerate || now-f->startNs>=rotateSeconds*1000000000ull
+			|| f->dataBytes+(gap+r->frames)*RECORDING_FRAME_BYTES>RECORDING_MAX_FILE_BYTES)
+	{
+		file_open(f);
+		gap=0;
+	}
+	if(f->fd>=0)
+	{
+		file_append(f, gap*RECORDING_FRAME_BYTES, true);
+		file_append(f, bytes, false);
+	}else
+	{
+		ringBuffer_read(&records, bytes, NULL);
+	}
+	f->nextPosition=r->position+r->frames;
+	f->lastNs=now;
+}
+/// Process the complete records in the ringbuffer
+/// @return true when anything was processed
+static bool drain(void)
+{
+	bool any=false;
+	struct record r;
+	while(ringBuffer_peek(&records, sizeof(r), (uint8_t *)&r))
+	{
+		uint32_t length=r.type==RECORD_OPEN?r.nameLength:r.frames*RECORDING_FRAME_BYTES;
+		if(ringBuffer_availableRead(&records)<sizeof(r)+length)
+		{
+			break;
+		}
+		ringBuffer_read(&records, sizeof(r), NULL);
+		if(r.type==RECORD_OPEN)
+		{
+			recordingFile * f=file_find(r.stream);
+			char name[sizeof(f->name)];
+			ringBuffer_read(&records, length, (uint8_t *)name);
+			name[length]='\0';
+			if(f!=NULL)
+			{
+				/// Characters that do not belong into a file name are replaced
+				for(char * c=name;*c!='\0';++c)
+				{
+					if(*c=='/' || *c==':')
+					{
+						*c='_';
+					}
+				}
+				snprintf(f->name, sizeof(f->name), "%s", name);
+			}
+		}else
+		{
+			handle_frames(&r);
+		}
+		any=true;
+	}
+	return any;
+}
+/// Write the collected frames of all files and close the files of streams that stopped
+static void flush_files(bool all)
+{
+	uint64_t now=recording_now();
+	for(int i=0;i<RECORDING_MAX_FILES;++i)
+	{
+		recordingFile * f=&files[i];
+		if(!f->used)
+		{
+			continue;
+		}
+		if(all || now-f->lastNs>=RECORDING_IDLE_SECONDS*1000000000ull)
+		{
+			file_close(f);
+			free(f->buffer);
+			f->buffer=NULL;
+			f->used=false;
+		}else
+		{
+			file_flush(f);
+		}
+	}
+}
+static void * thread_main(void * arg)
+{
+	uint64_t lastFlush=recording_now();
+	while(running)
+	{
+		if(!drain())
+		{
+			usleep(RECORDING_PERIOD_US);
+		}
+		if(recording_now()-lastFlush>=RECORDING_FLUSH_SECONDS*1000000000ull)
+		{
+			flush_files(false);
+			lastFlush=recording_now();
+		}
+	}
+	drain();
+	flush_files(true);
+	return NULL;
+}
+bool recordingTap_start(const char * dir, uint32_t rate, uint32_t rotate)
+{
+	if(access(dir, W_OK)!=0)
+	{
+		perror(dir);
+		return false;
+	}
+	snprintf(directory, sizeof(directory), "%s", dir);
+	samplerate=rate;
+	rotateSeconds=rotate;
+	uint8_t * buffer=calloc(RECORDING_RINGBUFFER_BYTES, 1);
+	assert(buffer!=NULL);
+	ringBuffer_create(&records, RECORDING_RINGBUFFER_BYTES, buffer);
+	running=true;
+	int err=pthread_create(&thread, NULL, thread_main, NULL);
+	assert(err==0);
+	return true;
+}
+void recordingTap_stop(void)
+{
+	if(!running)
+	{
+		return;
+	}
+	running=false;
+	pthread_join(thread, NULL);
+	printf("Recording: %u files, %llu bytes in %llu writes, %u periods dropped\n", createdFiles, (unsigned long long)writtenBytes,
+			(unsigned long long)writeCalls, dropped);
+}
+bool recordingTap_open(uint32_t stream, const char * name)
+{
+	struct record r;
+	memset(&r, 0, sizeof(r));
+	r.type=RECORD_OPEN;
+	r.stream=stream;
+	size_t length=strlen(name);
+	r.nameLength=length<sizeof(files[0].name)-1?length:sizeof(files[0].name)-1;
+	if(ringBuffer_availableWrite(&records)<sizeof(r)+r.nameLength)
+	{
+		return false;
+	}
+	ringBuffer_write(&records, sizeof(r), (uint8_t *)&r);
+	ringBuffer_write(&records, r.nameLength, (uint8_t *)name);
+	return true;
+}
+bool recordingTap_begin(uint32_t stream, uint64_t position, uint32_t frames)
+{
+	struct record r;
+	memset(&r, 0, sizeof(r));
+	r.type=RECORD_FRAMES;
+	r.stream=stream;
+	r.position=position;
+	r.frames=frames;
+	if(ringBuffer_availableWrite(&records)<sizeof(r)+frames*RECORDING_FRAME_BYTES)
+	{
+		__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	ringBuffer_write(&records, sizeof(r), (uint8_t *)&r);
+	return true;
+}
+void recordingTap_append(const float * samples, uint32_t nSamples)
+{
+	uint32_t n=nSamples*sizeof(float);
+	if(samples!=NULL)
+	{
+		ringBuffer_write(&records, n, (uint8_t *)samples);
+		return;
+	}
+	while(n>0)
+	{
+		uint8_t * data;
+		uint32_t m=ringBuffer_accessWriteBuffer(&records, &data, n);
+		memset(data, 0, m);
+		ringBuffer_write(&records, m, NULL);
+		n-=m;
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef RECORDING_TAP_H_
+#define RECORDING_TAP_H_
+
+/// Recording tap: archive the audio the server played into WAV files, one file per stream or one file of the mixed output.
+/// The Jack thread copies the played frames of each period (after resampling, underruns and idle silence included as zeros)
+/// into a preallocated lock-free ringbuffer. A background thread collects them per file in large buffers and writes them with
+/// a few big write() calls, so file I/O never happens in the Jack thread or the network thread.
+/// When the ringbuffer is full the period is dropped and counted. The writer fills the missing frames with silence so the
+/// timeline of the file stays correct.
+///
+/// Files are 32 bit float WAV at the samplerate of the server with NPORT channels, named <directory>/<stream name>-<local time>.wav.
+/// A new file is started every rotation interval, after a gap longer than RECORDING_MAX_GAP_SECONDS and before the file would
+/// reach RECORDING_MAX_FILE_BYTES. The WAV header is updated at each flush so an interrupted recording is still readable.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Size of the ringbuffer between the Jack thread and the writer thread: several seconds of 8 streams
+#define RECORDING_RINGBUFFER_BYTES (16*1024*1024)
+/// Frames of a file collected before they are written
+#define RECORDING_FILE_BUFFER_BYTES (1024*1024)
+/// Collected frames are written at least this often and the WAV headers are updated
+#define RECORDING_FLUSH_SECONDS 1
+/// A file that did not get frames for this long is closed (its stream disconnected)
+#define RECORDING_IDLE_SECONDS 2
+/// Longer gaps in the played frames (nothing was playing) start a new file instead of being filled with silence
+#define RECORDING_MAX_GAP_SECONDS 5
+/// Files are rotated before they reach this size, the WAV sizes are 32 bit
+#define RECORDING_MAX_FILE_BYTES (2000u*1024*1024)
+/// Maximum number of files open at the same time
+#define RECORDING_MAX_FILES 64
+/// The background thread sleeps this long when there is nothing to write
+#define RECORDING_PERIOD_US (20l*1000l)
+/// Stream identifier of the mixed output
+#define RECORDING_MIX_STREAM 0xffffffffu
+
+/// Start the writer thread
+/// @param directory the files are created in this existing directory
+/// @param rotateSeconds length of the files in seconds
+/// @return false when the directory is not writable
+bool recordingTap_start(const char * directory, uint32_t samplerate, uint32_t rotateSeconds);
+/// Stop the writer thread after all frames were written and close the files
+void recordingTap_stop(void);
+/// Name a stream. Its frames are recorded into a file named after it. Called by the Jack thread before the first frames of the stream.
+/// @return false when the name was dropped because the ringbuffer was full
+bool recordingTap_open(uint32_t stream, const char * name);
+/// Start a period of frames of a stream. Called by the Jack thread, followed by recordingTap_append() calls of frames*NPORT samples in total.
+/// @param position playback position of the first frame in frames since the start of the server
+/// @return false when the period was dropped because the ringbuffer was full, then recordingTap_append() must not be called
+bool recordingTap_begin(uint32_t stream, uint64_t position, uint32_t frames);
+/// Add interleaved samples to the period started by recordingTap_begin()
+/// @param samples NULL for silence
+void recordingTap_append(const float * samples, uint32_t nSamples);
+
+#endif /* RECORDING_TAP_H_ */
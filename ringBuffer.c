@@ -226,6 +226,18 @@ void ringBuffer_clear(ringBuffer_t * ringBuffer)
   ringBuffer->ptrRead=0;
   ringBuffer->ptrWrite=0;
 }
+bool ringBuffer_moveTo(ringBuffer_t * ringBuffer, uint32_t bufferSize, uint8_t * buffer)
+{
+  uint32_t n=ringBuffer_availableRead(ringBuffer);
+  if(n>=bufferSize)
+  {
+    return false;
+  }
+  ringBuffer_read(ringBuffer, n, buffer);
+  ringBuffer_create(ringBuffer, bufferSize, buffer);
+  ringBuffer->ptrWrite=n;
+  return true;
+}
 bool ringBuffer_isCreated(ringBuffer_t * ringBuffer)
 {
   return ringBuffer->buffer!=NULL;
@@ -23,6 +23,10 @@ void ringBuffer_create(ringBuffer_t * ringBuffer, uint32_t bufferSize, uint8_t *
 
 /// Set buffer pointer to NULL - ringbuffer is in not usabe state - this is not standard feature of ringbuffer implementations
 void ringBuffer_clear(ringBuffer_t * ringBuffer);
+/// Move the content of the ringbuffer into a new buffer. Readable data is copied to the beginning of the new buffer.
+/// The old buffer is not freed - it is the responsibility of the caller.
+/// @return false means the readable data does not fit into the new buffer and the ringbuffer is unchanged
+bool ringBuffer_moveTo(ringBuffer_t * ringBuffer, uint32_t bufferSize, uint8_t * buffer);
 /// Is this ringbuffer in created state? - this is not standard of ringbuffer implementations
 bool ringBuffer_isCreated(ringBuffer_t * ringBuffer);
 
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "rtHardening.h"
+
+static bool enabled=false;
+static int policy=SCHED_FIFO;
+static int priority=0;
+static bool pinned=false;
+static cpu_set_t cpus;
+/// Number of settings that were applied and that failed
+static unsigned applied=0;
+static unsigned failed=0;
+
+bool rtHardening_parsePriority(const char * arg)
+{
+	char * end;
+	long p=strtol(arg, &end, 10);
+	if(end==arg || p<sched_get_priority_min(SCHED_FIFO) || p>=sched_get_priority_max(SCHED_FIFO))
+	{
+		return false;
+	}
+	if(*end==',')
+	{
+		if(strcmp(end+1, "rr")==0)
+		{
+			policy=SCHED_RR;
+		}else if(strcmp(end+1, "fifo")!=0)
+		{
+			return false;
+		}
+	}else if(*end!='\0')
+	{
+		return false;
+	}
+	priority=(int)p;
+	enabled=true;
+	return true;
+}
+bool rtHardening_parseAffinity(const char * arg)
+{
+	CPU_ZERO(&cpus);
+	const char * p=arg;
+	while(*p!='\0')
+	{
+		char * end;
+		long first=strtol(p, &end, 10);
+		long last=first;
+		if(end==p)
+		{
+			return false;
+		}
+		if(*end=='-')
+		{
+			p=end+1;
+			last=strtol(p, &end, 10);
+			if(end==p)
+			{
+				return false;
+			}
+		}
+		if(first<0 || last<first || last>=RT_HARDENING_MAX_CPUS)
+		{
+			return false;
+		}
+		for(long cpu=first;cpu<=last;++cpu)
+		{
+			CPU_SET(cpu, &cpus);
+		}
+		p=end;
+		if(*p==',')
+		{
+			p++;
+		}else if(*p!='\0')
+		{
+			return false;
+		}
+	}
+	pinned=CPU_COUNT(&cpus)>0;
+	return pinned;
+}
+/// Print the result of a setting and count it
+static void result(const char * what, int err, const char * hint)
+{
+	if(err==0)
+	{
+		applied++;
+		printf("Real-time hardening: %s\n", what);
+	}else
+	{
+		failed++;
+		printf("Real-time hardening: %s failed: %s%s\n", what, strerror(err), hint);
+	}
+}
+/// Current and maximum value of a resource limit as text for the failure messages
+static const char * limit_hint(int resource, const char * name, unsigned long divisor, const char * unit)
+{
+	static char hint[128];
+	struct rlimit limit;
+	if(getrlimit(resource, &limit)!=0)
+	{
+		return "";
+	}
+	if(limit.rlim_cur==RLIM_INFINITY)
+	{
+		snprintf(hint, sizeof(hint), " (%s unlimited)", name);
+	}else
+	{
+		snprintf(hint, sizeof(hint), " (%s %lu%s)", name, (unsigned long)limit.rlim_cur/divisor, unit);
+	}
+	return hint;
+}
+/// The locked memory limit does not apply or is large enough to lock the future mappings too
+static bool can_lock_future(void)
+{
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_MEMLOCK, &limit)==0 && (limit.rlim_cur==RLIM_INFINITY || limit.rlim_cur>=RT_HARDENING_MIN_MEMLOCK_BYTES))
+	{
+		return true;
+	}
+	/// CAP_IPC_LOCK is bit 14 of the effective capabilities
+	FILE * f=fopen("/proc/self/status", "r");
+	if(f==NULL)
+	{
+		return false;
+	}
+	char line[256];
+	unsigned long long caps=0;
+	while(fgets(line, sizeof(line), f)!=NULL)
+	{
+		if(sscanf(line, "CapEff: %llx", &caps)==1)
+		{
+			break;
+		}
+	}
+	fclose(f);
+	return (caps&(1ull<<14))!=0;
+}
+/// Locked memory of the process in kB, -1 when it is not known
+static long locked_kb(void)
+{
+	FILE * f=fopen("/proc/self/status", "r");
+	if(f==NULL)
+	{
+		return -1;
+	}
+	char line[256];
+	long kb=-1;
+	while(fgets(line, sizeof(line), f)!=NULL)
+	{
+		if(sscanf(line, "VmLck: %ld kB", &kb)==1)
+		{
+			break;
+		}
+	}
+	fclose(f);
+	return kb;
+}
+void rtHardening_prefaultStack(void)
+{
+	if(!enabled)
+	{
+		return;
+	}
+	volatile unsigned char stack[RT_HARDENING_STACK_BYTES];
+	for(size_t i=0;i<sizeof(stack);i+=4096)
+	{
+		stack[i]=0;
+	}
+}
+void rtHardening_start(void)
+{
+	if(!enabled)
+	{
+		if(pinned)
+		{
+			printf("Real-time hardening is disabled, -A only sets the CPU affinity of the network threads\n");
+		}
+		return;
+	}
+	/// Memory freed by a disconnected client stays in the heap and is reused locked by the next one
+	bool heap=mallopt(M_TRIM_THRESHOLD, -1)==1 && mallopt(M_MMAP_MAX, 0)==1;
+	result("malloc without trimming and mmap", heap?0:EINVAL, "");
+	const char * hint=limit_hint(RLIMIT_MEMLOCK, "RLIMIT_MEMLOCK", 1024, " kB");
+	bool future=can_lock_future();
+	int err=mlockall(future?MCL_CURRENT|MCL_FUTURE:MCL_CURRENT)==0?0:errno;
+	if(err!=0)
+	{
+		/// A failed mlockall() can leave MCL_FUTURE set, then every later mapping would count against the limit
+		munlockall();
+	}
+	char what[64];
+	snprintf(what, sizeof(what), "mlockall (%ld kB locked)", err==0?locked_kb():0);
+	result(err==0?what:"mlockall", err, hint);
+	if(err==0 && !future)
+	{
+		result("locking of future allocations", ENOMEM, hint);
+	}
+	rtHardening_prefaultStack();
+}
+bool rtHardening_thread(pthread_t thread, const char * name, int priorityOffset, bool pin)
+{
+	char what[128];
+	int err=0;
+	if(enabled)
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority=priority+priorityOffset;
+		snprintf(what, sizeof(what), "%s %s priority %d", name, policy==SCHED_RR?"SCHED_RR":"SCHED_FIFO", param.sched_priority);
+		err=pthread_setschedparam(thread, policy, &param);
+		result(what, err, limit_hint(RLIMIT_RTPRIO, "RLIMIT_RTPRIO", 1, ""));
+	}
+	if(pin && pinned)
+	{
+		snprintf(what, sizeof(what), "%s on %d CPUs", name, CPU_COUNT(&cpus));
+		int pinErr=pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+		result(what, pinErr, "");
+		err=err!=0?err:pinErr;
+	}
+	return err==0;
+}
+void rtHardening_report(void)
+{
+	if(enabled || pinned)
+	{
+		printf("Real-time hardening: %u settings applied, %u could not be applied\n", applied, failed);
+	}
+}
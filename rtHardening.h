@@ -0,0 +1,43 @@
+#ifndef RT_HARDENING_H_
+#define RT_HARDENING_H_
+
+/// Real-time hardening mode (-P): keep the audio path of the program away from page faults, swapping and normal priority tasks.
+/// - mlockall(MCL_CURRENT|MCL_FUTURE): all memory is locked and populated when it is mapped, so the buffers allocated at connect time
+///   are faulted in by the allocation in the network thread and not by the Jack callback
+/// - malloc keeps freed memory instead of returning it to the kernel and does not use mmap, so a reconnect reuses locked pages
+/// - the stacks of the network threads are touched before they process audio
+/// - the network threads get a SCHED_FIFO or SCHED_RR priority, below the Jack thread, and optionally a CPU affinity (-A)
+/// The background threads of logging, stream capture and recording keep the normal priority.
+/// Each setting that can not be applied is printed at startup with the reason (usually RLIMIT_MEMLOCK or RLIMIT_RTPRIO, see limits.conf).
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/// Bytes of the stack of each network thread that are touched at startup
+#define RT_HARDENING_STACK_BYTES (256*1024)
+/// Future mappings are only locked when RLIMIT_MEMLOCK allows this much (or CAP_IPC_LOCK ignores the limit):
+/// each thread stack is 8 MB, a smaller limit would make thread creation and the buffer allocations of later connections fail
+#define RT_HARDENING_MIN_MEMLOCK_BYTES (256ul*1024*1024)
+/// Highest CPU number of the -A list
+#define RT_HARDENING_MAX_CPUS 1024
+
+/// Parse the -P argument: priority[,fifo|rr]. Enables the hardened mode.
+/// @return false when the argument is invalid
+bool rtHardening_parsePriority(const char * arg);
+/// Parse the -A argument: list of CPUs and CPU ranges of the network threads, for example 2,3 or 2-3
+/// @return false when the argument is invalid
+bool rtHardening_parseAffinity(const char * arg);
+/// Lock the memory and prefault the stack of the calling thread when the hardened mode is enabled. Print what could not be applied.
+/// Called before any thread is created, so the stacks of all threads are locked.
+void rtHardening_start(void);
+/// Touch the stack of the calling thread so it does not page fault later. Does nothing when the hardened mode is disabled.
+void rtHardening_prefaultStack(void);
+/// Apply the real-time priority and the CPU affinity (-A) to a thread. Print what could not be applied.
+/// @param priorityOffset added to the -P priority: the headless playback thread stands in for the Jack thread and runs 1 above the network threads
+/// @param pin apply the CPU affinity
+/// @return false when a setting could not be applied
+bool rtHardening_thread(pthread_t thread, const char * name, int priorityOffset, bool pin);
+/// Print the number of settings that could not be applied, once all threads were started
+void rtHardening_report(void);
+
+#endif /* RT_HARDENING_H_ */
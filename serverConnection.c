@@ -0,0 +1,983 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "serverConnection.h"
+#include "tcp-protocol.h"
+#include "asyncLog.h"
+#include "opusCodec.h"
+#include "socketTuning.h"
+#include "traceProbes.h"
+#include "rtHardening.h"
+
+/// A connection lagging this much behind the writer of the fan-out ring is handled by its policy
+#define CONNECTION_MAX_LAG(ring) ((ring)->bufferSize/2)
+/// The drop policy drops old messages until the connection lags no more than this
+#define CONNECTION_DROP_TARGET(ring) ((ring)->bufferSize/4)
+/// Flow control: a float audio chunk is silent when no sample exceeds this magnitude
+#define FLOW_SILENCE_THRESHOLD (0.001f)
+/// Socket tuning: the bitrate of Opus streams is not in their parameters, the highest Opus bitrate is assumed
+#define OPUS_MAX_BYTES_PER_SECOND (510000/8)
+
+/// Set up the fd to be handled non-blocking
+static int setnonblocking(int sockfd)
+{
+	if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK) ==
+	    -1) {
+		assert(false);
+		return -1;
+	}
+	return 0;
+}
+/// Name of the server for log messages
+static const char * connection_name(serverConnection * c)
+{
+	return c->unixSocket[0]!='\0'?c->unixSocket:c->servers[c->current].hostname;
+}
+/// CLOCK_MONOTONIC time in nanoseconds
+static uint64_t connection_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+/// Resolve the name of a server when it has no cached addresses or they are older than SERVER_CONNECTION_RESOLVE_SECONDS.
+/// IPv4 and IPv6 addresses are cached in the order of getaddrinfo(). When the resolution fails the old addresses are kept.
+static void connection_resolve(serverConnection * c, serverConnection_server * server)
+{
+	uint64_t now=connection_now();
+	if(server->nAddresses>0 && now-server->resolvedNs<SERVER_CONNECTION_RESOLVE_SECONDS*1000000000ull)
+	{
+		return;
+	}
+	struct addrinfo hints;
+	struct addrinfo * result;
+	char service[16];
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family=AF_UNSPEC;
+	hints.ai_socktype=SOCK_STREAM;
+	hints.ai_flags=AI_ADDRCONFIG;
+	snprintf(service, sizeof(service), "%d", server->port);
+	int err=getaddrinfo(server->hostname, service, &hints, &result);
+	server->resolvedNs=now;
+	if(err!=0)
+	{
+		asyncLog_text(c->logChannel, "%s: can not resolve host name\n", server->hostname, 0, 0, 0);
+		return;
+	}
+	server->nAddresses=0;
+	for(struct addrinfo * ai=result;ai!=NULL && server->nAddresses<SERVER_CONNECTION_MAX_ADDRESSES;ai=ai->ai_next)
+	{
+		if(ai->ai_addrlen<=sizeof(struct sockaddr_storage))
+		{
+			memcpy(&server->addresses[server->nAddresses], ai->ai_addr, ai->ai_addrlen);
+			server->addressLengths[server->nAddresses]=ai->ai_addrlen;
+			server->nAddresses++;
+		}
+	}
+	freeaddrinfo(result);
+}
+/// Wait before the next connection attempt round: a random value between half and all of the backoff, which is doubled for the
+/// next round. So the clients of a restarted server do not reconnect in lockstep.
+/// @return the wait in milliseconds
+static uint32_t connection_backoff_ms(serverConnection * c)
+{
+	uint32_t wait=c->backoffMs/2+(uint32_t)(rand_r(&c->seed)%(c->backoffMs/2+1));
+	c->backoffMs=c->backoffMs*2<SERVER_CONNECTION_BACKOFF_MAX_MS?c->backoffMs*2:SERVER_CONNECTION_BACKOFF_MAX_MS;
+	return wait;
+}
+/// Log a failed connect unless it failed the same way as the previous one, so an unreachable server does not flood the log
+static void connection_connect_failed(serverConnection * c, int server, int err)
+{
+	if(err!=c->lastConnectErrno[server])
+	{
+		asyncLog_text(c->logChannel, "connect(): %s (server %lld)\n", strerror(err), server, 0, 0);
+		c->lastConnectErrno[server]=err;
+	}
+}
+/// A non-blocking connect in progress
+typedef struct {
+	int server;
+	int address;
+	/// CLOCK_MONOTONIC time in nanoseconds when it is abandoned
+	uint64_t deadline;
+} connection_attempt;
+/// Connect to one of the TCP servers. The state machine goes through the cached addresses of the servers in rounds, starting with
+/// the server connected last. Each address gets a non-blocking connect. The next address is tried when the connect failed or did not
+/// complete in SERVER_CONNECTION_ATTEMPT_DELAY_MS, the earlier connects stay in progress until SERVER_CONNECTION_CONNECT_TIMEOUT_MS and
+/// the first one that completes is used. So a server that does not answer delays the failover by the attempt delay only.
+/// Rounds are repeated after the backoff, addresses with a connect in progress are skipped.
+/// @return the connected socket, or -1 when the connection was stopped
+static int connect_tcp(serverConnection * c)
+{
+	struct pollfd pfds[SERVER_CONNECTION_MAX_SERVERS*SERVER_CONNECTION_MAX_ADDRESSES];
+	connection_attempt attempts[SERVER_CONNECTION_MAX_SERVERS*SERVER_CONNECTION_MAX_ADDRESSES];
+	int nAttempts=0;
+	/// Next address of the round, the server is counted from the one connected last
+	int server=0;
+	int address=0;
+	int sockfd=-1;
+	uint64_t nextAttempt=connection_now();
+	while(!c->stop && sockfd<0)
+	{
+		uint64_t now=connection_now();
+		if(now>=nextAttempt)
+		{
+			if(server==c->nServers)
+			{
+				server=0;
+				address=0;
+			}
+			int index=(c->current+server)%c->nServers;
+			serverConnection_server * target=&c->servers[index];
+			if(address==0)
+			{
+				connection_resolve(c, target);
+			}
+			if(address>=target->nAddresses)
+			{
+				server++;
+				address=0;
+				if(server==c->nServers)
+				{
+					nextAttempt=now+connection_backoff_ms(c)*1000000ull;
+				}
+				continue;
+			}
+			bool inProgress=false;
+			for(int i=0;i<nAttempts;++i)
+			{
+				inProgress|=attempts[i].server==index && attempts[i].address==address;
+			}
+			struct sockaddr * addr=(struct sockaddr *)&target->addresses[address];
+			socklen_t addrLength=target->addressLengths[address];
+			address++;
+			if(inProgress)
+			{
+				continue;
+			}
+			int fd=socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			int err=fd<0?-1:connect(fd, addr, addrLength);
+			c->attempts++;
+			if(err==0)
+			{
+				sockfd=fd;
+				c->current=index;
+				break;
+			}
+			if(fd>=0 && errno==EINPROGRESS)
+			{
+				pfds[nAttempts].fd=fd;
+				pfds[nAttempts].events=POLLOUT;
+				attempts[nAttempts].server=index;
+				attempts[nAttempts].address=address-1;
+				attempts[nAttempts].deadline=now+SERVER_CONNECTION_CONNECT_TIMEOUT_MS*1000000ull;
+				nAttempts++;
+				nextAttempt=now+SERVER_CONNECTION_ATTEMPT_DELAY_MS*1000000ull;
+			}else
+			{
+				/// Refused or unreachable at once: go on with the next address without waiting
+				connection_connect_failed(c, index, errno);
+				if(fd>=0)
+				{
+					close(fd);
+				}
+			}
+			continue;
+		}
+		uint64_t until=nextAttempt;
+		for(int i=0;i<nAttempts;++i)
+		{
+			if(attempts[i].deadline<until)
+			{
+				until=attempts[i].deadline;
+			}
+		}
+		int timeout=until>now?(int)((until-now)/1000000)+1:0;
+		/// Wake up regularly to notice a stop request
+		poll(pfds, nAttempts, timeout<100?timeout:100);
+		now=connection_now();
+		for(int i=0;i<nAttempts;)
+		{
+			int err=0;
+			if(pfds[i].revents!=0)
+			{
+				socklen_t len=sizeof(err);
+				if(getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len)!=0)
+				{
+					err=errno;
+				}
+				if(err==0)
+				{
+					sockfd=pfds[i].fd;
+					c->current=attempts[i].server;
+				}
+			}else if(now>=attempts[i].deadline)
+			{
+				err=ETIMEDOUT;
+			}else
+			{
+				++i;
+				continue;
+			}
+			if(err!=0)
+			{
+				connection_connect_failed(c, attempts[i].server, err);
+				close(pfds[i].fd);
+				/// The failed connect does not hold back the next address of the round any more
+				if(server<c->nServers)
+				{
+					nextAttempt=now;
+				}
+			}
+			pfds[i]=pfds[nAttempts-1];
+			attempts[i]=attempts[nAttempts-1];
+			nAttempts--;
+			if(sockfd>=0)
+			{
+				break;
+			}
+		}
+	}
+	for(int i=0;i<nAttempts;++i)
+	{
+		close(pfds[i].fd);
+	}
+	return sockfd;
+}
+/// Same-host transport: release the shared ring and the eventfd
+static void disconnect_shm(serverConnection * c)
+{
+	if(c->shmEventFd>=0)
+	{
+		close(c->shmEventFd);
+		c->shmEventFd=-1;
+		munmap(c->shmRing.header, c->shmRing.mappingSize);
+	}
+}
+/// Same-host transport: connect to the Unix socket of the server and hand over a new shared ring and an eventfd.
+/// @return the connected Unix socket or -1 on error
+static int connect_shm(serverConnection * c)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", c->unixSocket);
+	int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd<0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))!=0)
+	{
+		asyncLog_text(c->logChannel, "connect(): %s\n", strerror(errno), 0, 0, 0);
+		if(fd>=0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	size_t size=shmRing_mappingSize(SHM_RINGBUFFER_BYTES);
+	int memfd=memfd_create("jack-tcp-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	void * mapping=MAP_FAILED;
+	/// The server only maps a memfd whose size is sealed
+	if(memfd>=0 && ftruncate(memfd, size)==0 && fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)==0)
+	{
+		mapping=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	}
+	c->shmEventFd=eventfd(0, EFD_CLOEXEC);
+	if(mapping==MAP_FAILED || c->shmEventFd<0)
+	{
+		/// Out of memory or descriptors: retried with the backoff like a failed connect
+		asyncLog_text(c->logChannel, "shared memory: %s\n", strerror(errno), 0, 0, 0);
+		if(mapping!=MAP_FAILED)
+		{
+			munmap(mapping, size);
+		}
+		if(memfd>=0)
+		{
+			close(memfd);
+		}
+		if(c->shmEventFd>=0)
+		{
+			close(c->shmEventFd);
+			c->shmEventFd=-1;
+		}
+		close(fd);
+		return -1;
+	}
+	shmRing_create(&c->shmRing, mapping, SHM_RINGBUFFER_BYTES);
+
+	char byte=0;
+	struct iovec iov={ &byte, 1 };
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(2*sizeof(int))];
+	} control;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control.buf;
+	msg.msg_controllen=sizeof(control.buf);
+	struct cmsghdr * cmsg=CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level=SOL_SOCKET;
+	cmsg->cmsg_type=SCM_RIGHTS;
+	cmsg->cmsg_len=CMSG_LEN(2*sizeof(int));
+	int fds[2]={ memfd, c->shmEventFd };
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	ssize_t n=sendmsg(fd, &msg, 0);
+	close(memfd);
+	if(n!=1)
+	{
+		asyncLog_text(c->logChannel, "sendmsg(): %s\n", strerror(errno), 0, 0, 0);
+		close(fd);
+		disconnect_shm(c);
+		return -1;
+	}
+	return fd;
+}
+/// Write data to the server of the connection (TCP socket or shared ring)
+/// @return number of bytes accepted, 0 when the server can not accept more now, -1 on error
+static int connection_write(serverConnection * c, int sockfd, uint8_t * data, uint32_t len)
+{
+	if(c->shmEventFd>=0)
+	{
+		uint32_t n=shmRing_availableWrite(&c->shmRing);
+		if(n>len)
+		{
+			n=len;
+		}
+		shmRing_write(&c->shmRing, n, data);
+		return n;
+	}
+	ssize_t written = write(sockfd, data, len);
+	if(written>0)
+	{
+		c->writes++;
+	}
+	if(written==0)
+	{
+		return -1;
+	}else if(written<0)
+	{
+		if(errno==EAGAIN)
+		{
+			return 0;
+		}
+		asyncLog_text(c->logChannel, "TCP write: %s\n", strerror(errno), 0, 0, 0);
+		return -1;
+	}
+	return written;
+}
+/// Remember the parameters of a stream from its R_MSG_STREAM_PARAMETERS message
+static void connection_parameters(serverConnection * c, const struct stream_parameters * params)
+{
+	uint32_t s=R_MSG_STREAM(params->head.type);
+	if(s<MAX_STREAMS && params->head.payload==sizeof(struct stream_parameters)-sizeof(struct chunk_header))
+	{
+		c->streams[s]=*params;
+	}
+}
+/// Data rate of the streams of the connection in bytes per second, from the stream parameters seen so far
+static uint32_t connection_bytes_per_second(serverConnection * c)
+{
+	uint32_t rate=0;
+	for(int s=0;s<MAX_STREAMS;++s)
+	{
+		if(c->streams[s].nchannel>0)
+		{
+			rate+=c->streams[s].sampletype==SAMPLE_TYPE_OPUS?OPUS_MAX_BYTES_PER_SECOND:c->streams[s].samplerate*c->streams[s].nchannel*sizeof(float);
+		}
+	}
+	return rate;
+}
+/// Consume nBytes sent from the fan-out ring and keep track of the next message boundary
+static void connection_consume(serverConnection * c, uint32_t nBytes)
+{
+	while(c->boundary<nBytes)
+	{
+		struct chunk_header header;
+		fanoutRing_peek(c->ring, c->reader, c->boundary, sizeof(header), (uint8_t *)&header);
+		if(R_MSG_TYPE(header.type)==R_MSG_STREAM_PARAMETERS)
+		{
+			struct stream_parameters params;
+			if(fanoutRing_peek(c->ring, c->reader, c->boundary, sizeof(params), (uint8_t *)&params))
+			{
+				connection_parameters(c, &params);
+			}
+		}
+		c->boundary+=sizeof(header)+header.payload;
+	}
+	c->boundary-=nBytes;
+	fanoutRing_skip(c->ring, c->reader, nBytes);
+}
+/// Record the time the publishes between the read positions from and to waited in the fan-out ring before they were sent
+static void connection_measure_delay(serverConnection * c, uint64_t from, uint64_t to)
+{
+	fanoutRing_mark marks[FANOUT_MARKS];
+	uint32_t n=fanoutRing_marks(c->ring, marks);
+	uint64_t now=connection_now();
+	for(uint32_t i=0;i<n;++i)
+	{
+		if(marks[i].pos>from && marks[i].pos<=to)
+		{
+			uint64_t delay=now-marks[i].timeNs;
+			c->delaySum+=delay;
+			c->delayCount++;
+			if(delay>c->delayMax)
+			{
+				c->delayMax=delay;
+			}
+		}
+	}
+}
+/// Drop policy: drop the oldest data of a lagging connection. A partially sent message is moved to the pending buffer
+/// so it can be completed, then the data up to the oldest publish within CONNECTION_DROP_TARGET of the writer is dropped.
+/// The writer publishes whole periods (client) or whole messages (relay), so the connection continues at such a boundary.
+static void connection_drop_oldest(serverConnection * c)
+{
+	if(c->boundary>0)
+	{
+		if(c->pendingLength>0 || c->boundary>sizeof(c->pending))
+		{
+			return;
+		}
+		fanoutRing_peek(c->ring, c->reader, 0, c->boundary, c->pending);
+		c->pendingLength=c->boundary;
+		c->pendingSent=0;
+		fanoutRing_skip(c->ring, c->reader, c->boundary);
+		c->boundary=0;
+	}
+	fanoutRing_mark marks[FANOUT_MARKS];
+	uint32_t n=fanoutRing_marks(c->ring, marks);
+	uint64_t readPos=fanoutRing_readPosition(c->ring, c->reader);
+	uint64_t writePos=readPos+fanoutRing_availableRead(c->ring, c->reader);
+	uint64_t target=readPos;
+	for(uint32_t i=0;i<n;++i)
+	{
+		if(marks[i].pos>readPos && marks[i].pos<=writePos && writePos-marks[i].pos<=CONNECTION_DROP_TARGET(c->ring))
+		{
+			target=marks[i].pos;
+			break;
+		}
+	}
+	while(readPos<target)
+	{
+		struct chunk_header header;
+		fanoutRing_peek(c->ring, c->reader, 0, sizeof(header), (uint8_t *)&header);
+		fanoutRing_skip(c->ring, c->reader, sizeof(header)+header.payload);
+		readPos+=sizeof(header)+header.payload;
+		c->droppedChunks++;
+	}
+}
+/// Flow control: a budget of frames to drop is active for a stream
+static bool connection_flow_active(serverConnection * c)
+{
+	for(int s=0;s<MAX_STREAMS;++s)
+	{
+		if(c->flowExcess[s]>0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+/// Flow control: number of frames of the audio chunk of stream s at offset in the fan-out ring
+/// @return 0 when it is unknown
+static uint32_t connection_chunk_frames(serverConnection * c, uint32_t s, uint32_t offset, uint32_t payload)
+{
+	if(c->streams[s].nchannel==0)
+	{
+		return 0;
+	}
+	if(c->streams[s].sampletype==SAMPLE_TYPE_FLOAT)
+	{
+		return payload/(c->streams[s].nchannel*sizeof(float));
+	}
+	uint8_t packet[OPUS_MAX_PACKET_BYTES];
+	if(c->streams[s].sampletype!=SAMPLE_TYPE_OPUS || payload>sizeof(packet) || !fanoutRing_peek(c->ring, c->reader, offset, payload, packet))
+	{
+		return 0;
+	}
+	int32_t frames=opusCodec_packetFrames(packet, payload);
+	return frames>0?(uint32_t)frames:0;
+}
+/// Flow control: the float audio chunk at offset in the fan-out ring is silent. Opus packets are never considered silent.
+static bool connection_chunk_silent(serverConnection * c, uint32_t s, uint32_t offset, uint32_t payload)
+{
+	if(c->streams[s].sampletype!=SAMPLE_TYPE_FLOAT)
+	{
+		return false;
+	}
+	float samples[256];
+	for(uint32_t done=0;done<payload;)
+	{
+		uint32_t n=payload-done<sizeof(samples)?payload-done:sizeof(samples);
+		fanoutRing_peek(c->ring, c->reader, offset+done, n, (uint8_t *)samples);
+		for(uint32_t i=0;i<n/sizeof(float);++i)
+		{
+			if(samples[i]>FLOW_SILENCE_THRESHOLD || samples[i]<-FLOW_SILENCE_THRESHOLD)
+			{
+				return false;
+			}
+		}
+		done+=n;
+	}
+	return true;
+}
+/// Flow control: drop the audio chunks at the read position (at a message boundary) that the server asked for.
+/// A chunk of a stream with a budget is dropped when it fits into the budget and it is silent or the server overflowed.
+/// The R_MSG_TIMESTAMP of a chunk is dropped with it.
+static void connection_flow_drop(serverConnection * c)
+{
+	while(true)
+	{
+		struct chunk_header header;
+		uint32_t offset=0;
+		if(!fanoutRing_peek(c->ring, c->reader, offset, sizeof(header), (uint8_t *)&header))
+		{
+			return;
+		}
+		uint32_t s=R_MSG_STREAM(header.type);
+		if(R_MSG_TYPE(header.type)==R_MSG_TIMESTAMP)
+		{
+			offset=sizeof(header)+header.payload;
+			if(!fanoutRing_peek(c->ring, c->reader, offset, sizeof(header), (uint8_t *)&header) || R_MSG_STREAM(header.type)!=s)
+			{
+				return;
+			}
+		}
+		if(R_MSG_TYPE(header.type)!=R_MSG_AUDIO_CHUNK || s>=MAX_STREAMS || c->flowExcess[s]==0)
+		{
+			return;
+		}
+		uint32_t frames=connection_chunk_frames(c, s, offset+sizeof(header), header.payload);
+		if(frames==0 || frames>c->flowExcess[s] || (!c->flowOverflow[s] && !connection_chunk_silent(c, s, offset+sizeof(header), header.payload)))
+		{
+			return;
+		}
+		fanoutRing_skip(c->ring, c->reader, offset+sizeof(header)+header.payload);
+		c->flowExcess[s]-=frames;
+		c->flowDroppedChunks++;
+		c->flowDroppedFrames+=frames;
+	}
+}
+/// Flow control: handle an R_MSG_FLOW message. The budget is replaced, not accumulated: the server reports its whole excess.
+static void connection_flow(serverConnection * c, const struct flow_control * flow)
+{
+	uint32_t s=R_MSG_STREAM(flow->head.type);
+	if(s>=MAX_STREAMS)
+	{
+		return;
+	}
+	if(flow->excessFrames>0 && c->flowExcess[s]==0 && !c->flowOverflow[s])
+	{
+		asyncLog_int(c->logChannel, "Flow control stream %lld: server has %lld frames too much\n", s, flow->excessFrames, 0, 0);
+	}
+	c->flowExcess[s]=flow->excessFrames;
+	c->flowOverflow[s]=flow->excessFrames>0 && (c->flowOverflow[s] || flow->overflowChunks!=c->flowOverflowChunks[s]);
+	c->flowOverflowChunks[s]=flow->overflowChunks;
+}
+/// Log the queueing delay statistics and start a new interval
+static void connection_report(serverConnection * c)
+{
+	if(c->delayCount>0)
+	{
+		asyncLog_text(c->logChannel, "%s: queue delay avg: %lld us max: %lld us dropped chunks: %lld\n", connection_name(c),
+				(long long)(c->delaySum/c->delayCount/1000), (long long)(c->delayMax/1000), c->droppedChunks);
+	}
+	uint64_t now=connection_now();
+	if(c->sendQueueCount>0 && c->bytesPerSecond>0 && now>c->reportStart)
+	{
+		/// The audio in the kernel send queue (unsent and not yet acknowledged) converted to its duration
+		asyncLog_text(c->logChannel, "%s: kernel send queue avg: %lld us max: %lld us writes: %lld/s\n", connection_name(c),
+				(long long)(c->sendQueueSum*1000000ull/c->sendQueueCount/c->bytesPerSecond), (long long)(c->sendQueueMax*1000000ull/c->bytesPerSecond),
+				(long long)(c->writes*1000000000ull/(now-c->reportStart)));
+	}
+	c->sendQueueSum=0;
+	c->sendQueueMax=0;
+	c->sendQueueCount=0;
+	c->writes=0;
+	c->reportStart=now;
+	if(c->flowDroppedChunks>0)
+	{
+		asyncLog_text(c->logChannel, "%s: flow control dropped chunks: %lld frames: %lld\n", connection_name(c), c->flowDroppedChunks, (long long)c->flowDroppedFrames, 0);
+	}
+	c->delaySum=0;
+	c->delayMax=0;
+	c->delayCount=0;
+}
+/// Parse the data received from the server. A clock synchronization request is answered at the next message boundary.
+/// A flow control message sets the budget of audio to drop.
+static void connection_receive(serverConnection * c, const uint8_t * data, uint32_t n)
+{
+	for(uint32_t i=0;i<n;++i)
+	{
+		if(c->inboxSkip>0)
+		{
+			c->inboxSkip--;
+			continue;
+		}
+		c->inbox[c->inboxLength++]=data[i];
+		if(c->inboxLength<sizeof(struct chunk_header))
+		{
+			continue;
+		}
+		struct chunk_header header;
+		memcpy(&header, c->inbox, sizeof(header));
+		if((R_MSG_TYPE(header.type)!=R_MSG_TIME_REQUEST && R_MSG_TYPE(header.type)!=R_MSG_FLOW) || sizeof(header)+header.payload>sizeof(c->inbox))
+		{
+			c->inboxSkip=header.payload;
+			c->inboxLength=0;
+		}else if(c->inboxLength==sizeof(header)+header.payload && R_MSG_TYPE(header.type)==R_MSG_FLOW)
+		{
+			struct flow_control flow;
+			memset(&flow, 0, sizeof(flow));
+			memcpy(&flow, c->inbox, c->inboxLength<sizeof(flow)?c->inboxLength:sizeof(flow));
+			connection_flow(c, &flow);
+			c->inboxLength=0;
+		}else if(c->inboxLength==sizeof(header)+header.payload)
+		{
+			memcpy(&c->reply, c->inbox, c->inboxLength);
+			c->reply.head.type=R_MSG_TIME_RESPONSE;
+			c->reply.head.payload=sizeof(struct time_sync)-sizeof(struct chunk_header);
+			c->reply.t2=(int64_t)connection_now();
+			c->replyPending=true;
+			c->inboxLength=0;
+		}
+	}
+}
+/// Send the control messages and then the data of the fan-out ring until the connection breaks
+static void connection_send(serverConnection * c, int sockfd)
+{
+	int log=c->logChannel;
+	c->pendingSent=0;
+	c->boundary=0;
+	c->inboxLength=0;
+	c->inboxSkip=0;
+	c->replyPending=false;
+	memset(c->streams, 0, sizeof(c->streams));
+	memset(c->flowExcess, 0, sizeof(c->flowExcess));
+	memset(c->flowOverflow, 0, sizeof(c->flowOverflow));
+	memset(c->flowOverflowChunks, 0, sizeof(c->flowOverflowChunks));
+	fanoutRing_attach(c->ring, c->reader);
+	c->pendingLength=c->control(c->pending, sizeof(c->pending));
+	for(uint32_t at=0;at+sizeof(struct chunk_header)<=c->pendingLength;)
+	{
+		struct chunk_header header;
+		memcpy(&header, c->pending+at, sizeof(header));
+		if(R_MSG_TYPE(header.type)==R_MSG_STREAM_PARAMETERS && at+sizeof(struct stream_parameters)<=c->pendingLength)
+		{
+			struct stream_parameters params;
+			memcpy(&params, c->pending+at, sizeof(params));
+			connection_parameters(c, &params);
+		}
+		at+=sizeof(header)+header.payload;
+	}
+	bool tcpBroken=false;
+	setnonblocking(sockfd);
+	c->bytesPerSecond=connection_bytes_per_second(c);
+	if(c->shmEventFd<0 && !socketTuning_apply(sockfd, true, c->latencySeconds, c->bytesPerSecond))
+	{
+		asyncLog_text(log, "socket tuning: %s\n", strerror(errno), 0, 0, 0);
+	}
+	asyncLog_text(log, "Connected to server %s\n", connection_name(c), 0, 0, 0);
+	c->reportStart=connection_now();
+	uint64_t reportTime=connection_now();
+	while(!c->stop && !tcpBroken) {
+		if(fanoutRing_availableRead(c->ring, c->reader)>CONNECTION_MAX_LAG(c->ring))
+		{
+			if(c->policy==POLICY_DISCONNECT)
+			{
+				asyncLog_text(log, "Server %s is too slow, disconnecting\n", connection_name(c), 0, 0, 0);
+				break;
+			}else if(c->policy==POLICY_DROP)
+			{
+				uint32_t dropped=c->droppedChunks;
+				connection_drop_oldest(c);
+				if(c->droppedChunks!=dropped)
+				{
+					asyncLog_text(log, "Server %s is too slow, dropped %lld chunks\n", connection_name(c), c->droppedChunks-dropped, 0, 0);
+				}
+			}
+		}
+		if(c->replyPending && c->boundary==0 && c->pendingLength+sizeof(c->reply)<=sizeof(c->pending))
+		{
+			c->reply.t3=(int64_t)connection_now();
+			memcpy(c->pending+c->pendingLength, &c->reply, sizeof(c->reply));
+			c->pendingLength+=sizeof(c->reply);
+			c->replyPending=false;
+		}
+		bool sent=false;
+		while(c->pendingSent<c->pendingLength)
+		{
+			int n=connection_write(c, sockfd, c->pending+c->pendingSent, c->pendingLength-c->pendingSent);
+			if(n<=0)
+			{
+				tcpBroken=n<0;
+				break;
+			}
+			c->pendingSent+=n;
+			sent=true;
+		}
+		if(c->pendingSent==c->pendingLength)
+		{
+			c->pendingLength=0;
+			c->pendingSent=0;
+			uint64_t readPos=fanoutRing_readPosition(c->ring, c->reader);
+			while(!tcpBroken)
+			{
+				/// A waiting clock synchronization response is sent at the next message boundary
+				if(c->replyPending && c->boundary==0)
+				{
+					break;
+				}
+				uint32_t maxLen=c->replyPending?c->boundary:UINT32_MAX;
+				/// Flow control: send one message at a time so each message at the read position can be dropped
+				if(connection_flow_active(c))
+				{
+					struct chunk_header header;
+					if(c->boundary==0)
+					{
+						connection_flow_drop(c);
+					}
+					maxLen=c->boundary>0?c->boundary:fanoutRing_peek(c->ring, c->reader, 0, sizeof(header), (uint8_t *)&header)?sizeof(header)+header.payload:0;
+				}
+				uint8_t * buf;
+				uint32_t len=fanoutRing_accessReadBuffer(c->ring, c->reader, &buf, maxLen);
+				if(len==0)
+				{
+					break;
+				}
+				int n=connection_write(c, sockfd, buf, len);
+				if(n<=0)
+				{
+					tcpBroken=n<0;
+					break;
+				}
+				connection_consume(c, n);
+				sent=true;
+			}
+			if(fanoutRing_readPosition(c->ring, c->reader)!=readPos)
+			{
+				connection_measure_delay(c, readPos, fanoutRing_readPosition(c->ring, c->reader));
+			}
+		}
+		if(c->shmEventFd<0)
+		{
+			int32_t queued=socketTuning_sendQueue(sockfd);
+			if(queued>=0)
+			{
+				c->sendQueueSum+=queued;
+				c->sendQueueCount++;
+				if((uint32_t)queued>c->sendQueueMax)
+				{
+					c->sendQueueMax=queued;
+				}
+			}
+		}
+		if(sent && c->shmEventFd>=0)
+		{
+			uint64_t one=1;
+			if(write(c->shmEventFd, &one, sizeof(one))<0)
+			{
+				tcpBroken=true;
+			}
+		}
+		while(true)
+		{
+			uint8_t buf[32];
+			ssize_t nread=read(sockfd, buf, sizeof(buf));
+			if(nread==0)
+			{
+				tcpBroken=true;
+				break;
+			}
+			if(nread<0)
+			{
+				if(errno == EAGAIN)
+				{
+					break;
+				}else
+				{
+					asyncLog_text(log, "TCP read: %s\n", strerror(errno), 0, 0, 0);
+					tcpBroken=true;
+					break;
+				}
+			}else
+			{
+				connection_receive(c, buf, nread);
+			}
+		}
+		if(connection_now()-reportTime>=SERVER_CONNECTION_REPORT_SECONDS*1000000000ull)
+		{
+			connection_report(c);
+			reportTime=connection_now();
+		}
+		/// Wait for the next period. A message from the server ends the wait so clock synchronization requests are timestamped on arrival.
+		struct pollfd pfd={ sockfd, POLLIN, 0 };
+		poll(&pfd, 1, CLIENT_PERIOD_TIME_US/1000);
+	}
+	fanoutRing_detach(c->ring, c->reader);
+	connection_report(c);
+	asyncLog_text(log, "Disconnected from server %s, dropped chunks: %lld flow control dropped chunks: %lld\n", connection_name(c), c->droppedChunks, c->flowDroppedChunks, 0);
+}
+/// Thread of a server connection: open client TCP socket (or same-host shared memory transport) and process connection.
+/// After a disconnect the connection is retried at once, then after each failed round with the backoff. The time from the
+/// disconnect (or the start) to the next connection is logged.
+static void * connection_thread(void * arg)
+{
+	serverConnection * c=(serverConnection *)arg;
+	rtHardening_prefaultStack();
+	c->seed=(unsigned int)(connection_now()^(uintptr_t)c);
+	c->backoffMs=SERVER_CONNECTION_BACKOFF_MIN_MS;
+	c->outageStart=connection_now();
+	c->attempts=0;
+	while(!c->stop)
+	{
+		int sockfd;
+		if(c->unixSocket[0]!='\0')
+		{
+			sockfd=connect_shm(c);
+			c->attempts++;
+		}else
+		{
+			sockfd=connect_tcp(c);
+		}
+		if(sockfd<0)
+		{
+			uint64_t until=connection_now()+connection_backoff_ms(c)*1000000ull;
+			while(!c->stop && connection_now()<until)
+			{
+				usleep(10*1000);
+			}
+			continue;
+		}
+		uint64_t outage=(connection_now()-c->outageStart)/1000000;
+		TRACE_PROBE2(connection_connect, c->reader, outage);
+		asyncLog_text(c->logChannel, "%s: connected after %lld ms, %lld connect attempts\n", connection_name(c), (long long)outage, c->attempts, 0);
+		connection_send(c, sockfd);
+		TRACE_PROBE1(connection_disconnect, c->reader);
+		close(sockfd);
+		disconnect_shm(c);
+		c->backoffMs=SERVER_CONNECTION_BACKOFF_MIN_MS;
+		c->outageStart=connection_now();
+		c->attempts=0;
+		memset(c->lastConnectErrno, 0, sizeof(c->lastConnectErrno));
+	}
+	return NULL;
+}
+/// Parse host:port or [IPv6 address]:port into a server
+static bool connection_parse_server(serverConnection_server * server, char * address, int defaultPort)
+{
+	server->port=defaultPort;
+	char * host=address;
+	char * colon;
+	if(address[0]=='[')
+	{
+		char * bracket=strchr(address, ']');
+		if(bracket==NULL)
+		{
+			fprintf (stderr, "missing ] in address: %s\n", address);
+			return false;
+		}
+		*bracket='\0';
+		host=address+1;
+		colon=bracket[1]==':'?bracket+1:NULL;
+	}else
+	{
+		colon=strchr(address, ':');
+	}
+	if(colon!=NULL)
+	{
+		*colon='\0';
+		server->port=atoi(colon+1);
+	}
+	if(strlen(host)>=sizeof(server->hostname))
+	{
+		fprintf (stderr, "host name too long: %s\n", host);
+		return false;
+	}
+	memcpy(server->hostname, host, strlen(host)+1);
+	return true;
+}
+bool serverConnection_parse(serverConnection * c, const char * arg, bool unixSocket, int defaultPort)
+{
+	memset(c, 0, sizeof(*c));
+	c->shmEventFd=-1;
+	c->policy=POLICY_DROP;
+	c->latencySeconds=SERVER_CONNECTION_LATENCY_SECONDS;
+	char address[256];
+	snprintf(address, sizeof(address), "%s", arg);
+	char * comma=strchr(address, ',');
+	if(comma!=NULL)
+	{
+		*comma='\0';
+		if(strcmp(comma+1, "block")==0)
+		{
+			c->policy=POLICY_BLOCK;
+		}else if(strcmp(comma+1, "disconnect")==0)
+		{
+			c->policy=POLICY_DISCONNECT;
+		}else if(strcmp(comma+1, "drop")!=0)
+		{
+			fprintf (stderr, "unknown policy: %s\n", comma+1);
+			return false;
+		}
+	}
+	if(unixSocket)
+	{
+		if(strlen(address)>=sizeof(c->unixSocket))
+		{
+			fprintf (stderr, "Unix socket path too long: %s\n", address);
+			return false;
+		}
+		memcpy(c->unixSocket, address, strlen(address)+1);
+		return true;
+	}
+	for(char * next=address;next!=NULL;)
+	{
+		char * server=next;
+		next=strchr(server, '/');
+		if(next!=NULL)
+		{
+			*next++='\0';
+		}
+		if(c->nServers==SERVER_CONNECTION_MAX_SERVERS)
+		{
+			fprintf (stderr, "at most %d servers can be given for a connection\n", SERVER_CONNECTION_MAX_SERVERS);
+			return false;
+		}
+		if(!connection_parse_server(&c->servers[c->nServers++], server, defaultPort))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+void serverConnection_start(serverConnection * c, fanoutRing_t * ring, int reader, int logChannel, serverConnection_controlFunction control)
+{
+	c->ring=ring;
+	c->reader=reader;
+	c->logChannel=logChannel;
+	c->control=control;
+	c->stop=false;
+	pthread_create(&c->thread, NULL, connection_thread, c);
+}
+void serverConnection_stop(serverConnection * c)
+{
+	c->stop=true;
+	pthread_join(c->thread, NULL);
+}
@@ -0,0 +1,150 @@
+#ifndef SERVER_CONNECTION_H_
+#define SERVER_CONNECTION_H_
+
+/// Connection to a jack-tcp-server that sends the messages of a fanoutRing.
+/// Each connection runs in its own thread so a slow or unreachable server does not stall the others:
+/// it connects (TCP or same-host shared memory transport), sends the control messages (stream parameters)
+/// and then the data of the fan-out ring from its own read cursor. The connection is retried after it failed: non-blocking connects
+/// to the cached addresses of the servers (a primary and failover servers), with an exponential backoff with random jitter between rounds.
+/// Clock synchronization requests of the server are answered with the local CLOCK_MONOTONIC time.
+/// Flow control messages of the server make the connection drop audio chunks of the stream before sending them.
+/// Used by jack-tcp-client and by the relay mode of jack-tcp-server.
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include "simulator_types.h"
+#include "fanoutRing.h"
+#include "shmRing.h"
+#include "tcp-protocol.h"
+
+/// Size of the pending buffer of a connection. A single message must fit into it.
+#define SERVER_CONNECTION_PENDING_BYTES 65536
+/// Interval of logging the queueing delay statistics of a connection
+#define SERVER_CONNECTION_REPORT_SECONDS 10
+/// Default latency target of a connection. The kernel queues of TCP connections are sized to hold about this much audio (see socketTuning.h).
+#define SERVER_CONNECTION_LATENCY_SECONDS (0.1f)
+/// Maximum number of TCP servers of a connection (primary and failover servers)
+#define SERVER_CONNECTION_MAX_SERVERS 4
+/// Maximum number of cached addresses of a server
+#define SERVER_CONNECTION_MAX_ADDRESSES 4
+/// Resolved addresses are used for this long before the name is resolved again
+#define SERVER_CONNECTION_RESOLVE_SECONDS 60
+/// A connect that did not complete for this long is started on the next address in parallel (like Happy Eyeballs, RFC 8305)
+#define SERVER_CONNECTION_ATTEMPT_DELAY_MS 150
+/// A connection attempt round is abandoned after this long
+#define SERVER_CONNECTION_CONNECT_TIMEOUT_MS 2000
+/// Wait between failed attempt rounds: doubled after each round from the first to the longest, a random part of it is cut off
+#define SERVER_CONNECTION_BACKOFF_MIN_MS 50
+#define SERVER_CONNECTION_BACKOFF_MAX_MS 500
+
+/// What to do with a server connection that can not keep up with the fan-out ring
+typedef enum {
+	/// Wait for the server: while its data fills the fan-out ring new data is dropped for all servers by the writer
+	POLICY_BLOCK,
+	/// Drop the oldest periods of this server only
+	POLICY_DROP,
+	/// Close the connection and reconnect
+	POLICY_DISCONNECT
+} serverConnection_policy;
+
+/// Write the control messages to send after each connect (before the fan-out ring data) into buffer.
+/// Called by the connection thread after its read cursor was attached to the fan-out ring.
+/// @return length of the messages in bytes
+typedef uint32_t (*serverConnection_controlFunction)(uint8_t * buffer, uint32_t size);
+
+/// A TCP server of a connection and its cached addresses
+typedef struct {
+	char hostname[128];
+	int port;
+	struct sockaddr_storage addresses[SERVER_CONNECTION_MAX_ADDRESSES];
+	socklen_t addressLengths[SERVER_CONNECTION_MAX_ADDRESSES];
+	int nAddresses;
+	/// CLOCK_MONOTONIC time of the last name resolution in nanoseconds, 0 before the first
+	uint64_t resolvedNs;
+} serverConnection_server;
+
+typedef struct {
+	/// TCP servers in the order of preference. The connection goes to the first one reachable, starting with the last one connected.
+	serverConnection_server servers[SERVER_CONNECTION_MAX_SERVERS];
+	int nServers;
+	/// Index of the server connected last
+	int current;
+	/// Same-host shared memory transport: Unix socket path of the server. Empty means TCP is used.
+	char unixSocket[108];
+	serverConnection_policy policy;
+	/// Latency target of the connection used for the socket tuning
+	float latencySeconds;
+	/// Data source and its reader index used by this connection
+	fanoutRing_t * ring;
+	int reader;
+	/// asyncLog channel of the connection thread
+	int logChannel;
+	serverConnection_controlFunction control;
+	pthread_t thread;
+	/// Stop requested by serverConnection_stop()
+	volatile bool stop;
+	/// Same-host shared memory transport: the ring shared with the server
+	shmRing_t shmRing;
+	/// Same-host shared memory transport: eventfd to signal the server that data was written into the ring
+	int shmEventFd;
+	/// Data of this connection only that is sent before the fan-out ring data: control messages or the rest of a partially sent message
+	uint8_t pending[SERVER_CONNECTION_PENDING_BYTES];
+	uint32_t pendingLength;
+	uint32_t pendingSent;
+	/// Offset of the next message boundary from the read position in the fan-out ring
+	uint32_t boundary;
+	/// Number of messages dropped because the server was too slow
+	uint32_t droppedChunks;
+	/// Time data waited in the fan-out ring before it was sent (nanoseconds) since the last report
+	uint64_t delaySum;
+	uint64_t delayMax;
+	uint32_t delayCount;
+	/// Data rate of the streams in bytes per second. Set when the connection is established.
+	uint32_t bytesPerSecond;
+	/// Bytes in the kernel send queue of the TCP socket sampled once per loop since the last report
+	uint64_t sendQueueSum;
+	uint32_t sendQueueMax;
+	uint32_t sendQueueCount;
+	/// Number of successful write() calls on the TCP socket and the start of the report interval (CLOCK_MONOTONIC ns)
+	uint32_t writes;
+	uint64_t reportStart;
+	/// Reconnection: wait after the next failed round, start of the current outage (CLOCK_MONOTONIC ns), connect() calls during it
+	/// and the seed of the random jitter
+	uint32_t backoffMs;
+	uint64_t outageStart;
+	uint32_t attempts;
+	unsigned int seed;
+	/// Reconnection: error of the last connect failure logged for each server
+	int lastConnectErrno[SERVER_CONNECTION_MAX_SERVERS];
+	/// Message received from the server. Only R_MSG_TIME_REQUEST and R_MSG_FLOW are handled, the bytes of other messages are skipped.
+	/// The size is the longest of them.
+	uint8_t inbox[sizeof(struct time_sync)];
+	uint32_t inboxLength;
+	uint32_t inboxSkip;
+	/// Response to a clock synchronization request. Sent at the next message boundary of the fan-out ring data.
+	struct time_sync reply;
+	bool replyPending;
+	/// Stream parameters of each stream id seen in the control messages or in the fan-out ring data. nchannel is 0 for unknown streams.
+	struct stream_parameters streams[MAX_STREAMS];
+	/// Flow control: number of frames of each stream that may still be dropped, and whether the server dropped audio of the stream
+	/// (then any audio is dropped, otherwise only silent chunks)
+	uint32_t flowExcess[MAX_STREAMS];
+	bool flowOverflow[MAX_STREAMS];
+	uint32_t flowOverflowChunks[MAX_STREAMS];
+	/// Flow control: audio chunks and frames dropped at the request of the server
+	uint32_t flowDroppedChunks;
+	uint64_t flowDroppedFrames;
+} serverConnection;
+
+/// Initialize a connection from a command line argument: host:port or Unix socket path, optionally followed by ,block ,drop or ,disconnect.
+/// Failover servers are appended with / (host1:port/host2:port), IPv6 addresses are written in brackets ([::1]:port).
+/// @param defaultPort used when the port is not given
+/// @return false means the argument is invalid
+bool serverConnection_parse(serverConnection * c, const char * arg, bool unixSocket, int defaultPort);
+/// Start the connection thread
+/// @param reader reader index of the connection in the fan-out ring. Each connection of a ring must use a different one.
+void serverConnection_start(serverConnection * c, fanoutRing_t * ring, int reader, int logChannel, serverConnection_controlFunction control);
+/// Stop the connection thread and wait for it
+void serverConnection_stop(serverConnection * c);
+
+#endif /* SERVER_CONNECTION_H_ */
@@ -0,0 +1,101 @@
+#include <string.h>
+#include "shmRing.h"
+
+size_t shmRing_mappingSize(uint32_t bufferSize)
+{
+	return sizeof(shmRing_header)+bufferSize;
+}
+void shmRing_create(shmRing_t * ring, void * mapping, uint32_t bufferSize)
+{
+	ring->header=(shmRing_header *)mapping;
+	ring->buffer=((uint8_t *)mapping)+sizeof(shmRing_header);
+	ring->mappingSize=shmRing_mappingSize(bufferSize);
+	ring->bufferSize=bufferSize;
+	ring->header->bufferSize=bufferSize;
+	ring->header->ptrRead=0;
+	ring->header->ptrWrite=0;
+	__atomic_store_n(&ring->header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+}
+bool shmRing_attach(shmRing_t * ring, void * mapping, size_t mappingSize)
+{
+	shmRing_header * header=(shmRing_header *)mapping;
+	if(mappingSize<sizeof(shmRing_header) || __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE)!=SHM_RING_MAGIC
+			|| shmRing_mappingSize(header->bufferSize)>mappingSize || header->bufferSize<2)
+	{
+		return false;
+	}
+	ring->header=header;
+	ring->buffer=((uint8_t *)mapping)+sizeof(shmRing_header);
+	ring->mappingSize=mappingSize;
+	ring->bufferSize=header->bufferSize;
+	return true;
+}
+bool shmRing_isValid(shmRing_t * ring)
+{
+	return ring->header->ptrRead<ring->bufferSize && ring->header->ptrWrite<ring->bufferSize;
+}
+uint32_t shmRing_availableRead(shmRing_t * ring)
+{
+	uint32_t size=ring->bufferSize;
+	uint32_t ret=__atomic_load_n(&ring->header->ptrWrite, __ATOMIC_ACQUIRE)+size-__atomic_load_n(&ring->header->ptrRead, __ATOMIC_ACQUIRE);
+	if(ret>=size)
+	{
+		ret-=size;
+	}
+	return ret;
+}
+uint32_t shmRing_availableWrite(shmRing_t * ring)
+{
+	return ring->bufferSize-1-shmRing_availableRead(ring);
+}
+bool shmRing_write(shmRing_t * ring, uint32_t nBytes, const uint8_t * data)
+{
+	if(shmRing_availableWrite(ring)<nBytes)
+	{
+		return false;
+	}
+	uint32_t size=ring->bufferSize;
+	uint32_t at=ring->header->ptrWrite;
+	uint32_t first=size-at;
+	if(first>nBytes)
+	{
+		first=nBytes;
+	}
+	memcpy(&ring->buffer[at], data, first);
+	memcpy(&ring->buffer[0], data+first, nBytes-first);
+	at+=nBytes;
+	if(at>=size)
+	{
+		at-=size;
+	}
+	__atomic_store_n(&ring->header->ptrWrite, at, __ATOMIC_RELEASE);
+	return true;
+}
+uint32_t shmRing_accessReadBuffer(shmRing_t * ring, uint8_t ** ptrBuffer, uint32_t maxBytes)
+{
+	uint32_t nBytes=shmRing_availableRead(ring);
+	if(nBytes>maxBytes)
+	{
+		nBytes=maxBytes;
+	}
+	uint32_t at=ring->header->ptrRead;
+	if(at>=ring->bufferSize)
+	{
+		return 0u;
+	}
+	*ptrBuffer=&ring->buffer[at];
+	if(at+nBytes>ring->bufferSize)
+	{
+		return ring->bufferSize-at;
+	}
+	return nBytes;
+}
+void shmRing_skip(shmRing_t * ring, uint32_t nBytes)
+{
+	uint32_t at=ring->header->ptrRead+nBytes;
+	if(at>=ring->bufferSize)
+	{
+		at-=ring->bufferSize;
+	}
+	__atomic_store_n(&ring->header->ptrRead, at, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,56 @@
+#ifndef SHM_RING_H_
+#define SHM_RING_H_
+
+/// Single producer single consumer ringbuffer in memory shared between two processes (memfd mapping).
+/// Same semantics as ringBuffer.h but the read and write pointers are stored in the shared memory
+/// and the data buffer is addressed relative to the mapping so it works at different addresses in the two processes.
+
+#include "simulator_types.h"
+#include <stddef.h>
+
+/// Magic number stored in the header. Used to check that the mapping really contains a ring.
+#define SHM_RING_MAGIC 0x52534154u
+
+/// Header at the beginning of the shared mapping. Data follows the header.
+typedef struct
+{
+	uint32_t magic;
+	uint32_t bufferSize;
+	//! ptrRead==ptrWrite means empty
+	volatile uint32_t ptrRead;
+	volatile uint32_t ptrWrite;
+} shmRing_header;
+
+/// Process local view of a shared ring
+typedef struct
+{
+	shmRing_header * header;
+	uint8_t * buffer;
+	/// Size of the data buffer. Copied from the header when attaching so the other process can not change it later.
+	uint32_t bufferSize;
+	/// Size of the whole mapping in bytes
+	size_t mappingSize;
+} shmRing_t;
+
+/// Size of the mapping required for a ring that stores bufferSize bytes
+size_t shmRing_mappingSize(uint32_t bufferSize);
+/// Initialize an empty ring in a new mapping (producer side)
+void shmRing_create(shmRing_t * ring, void * mapping, uint32_t bufferSize);
+/// Attach to a ring initialized by the other process (consumer side)
+/// @return false means the mapping does not contain a valid ring
+bool shmRing_attach(shmRing_t * ring, void * mapping, size_t mappingSize);
+/// Check that the read and write pointers in the shared header are in range.
+/// The consumer must check this before accessing data because the other process can write anything into the shared header.
+bool shmRing_isValid(shmRing_t * ring);
+/// Get the number of available bytes to write
+uint32_t shmRing_availableWrite(shmRing_t * ring);
+/// Get the number of available bytes to read
+uint32_t shmRing_availableRead(shmRing_t * ring);
+/// Write data. @return false means there was not enough space and nothing was written.
+bool shmRing_write(shmRing_t * ring, uint32_t nBytes, const uint8_t * data);
+/// Access data in the read part of the ring. See ringBuffer_accessReadBuffer()
+uint32_t shmRing_accessReadBuffer(shmRing_t * ring, uint8_t ** ptrBuffer, uint32_t maxBytes);
+/// Advance the read pointer after the data accessed by shmRing_accessReadBuffer() was processed
+void shmRing_skip(shmRing_t * ring, uint32_t nBytes);
+
+#endif /* SHM_RING_H_ */
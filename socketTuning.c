@@ -0,0 +1,57 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
+#include <errno.h>
+#include "socketTuning.h"
+
+/// Set an integer socket option, remember the first failure
+static void set_option(int fd, int level, int name, int value, int * err)
+{
+	if(setsockopt(fd, level, name, &value, sizeof(value))!=0 && *err==0)
+	{
+		*err=errno;
+	}
+}
+bool socketTuning_apply(int fd, bool sender, float latencySeconds, uint32_t bytesPerSecond)
+{
+	int err=0;
+	int queue=(int)(latencySeconds*bytesPerSecond);
+	if(queue<SOCKET_MIN_QUEUE_BYTES)
+	{
+		queue=SOCKET_MIN_QUEUE_BYTES;
+	}
+	float timeout=SOCKET_TIMEOUT_FACTOR*latencySeconds;
+	if(timeout<SOCKET_MIN_TIMEOUT_SECONDS)
+	{
+		timeout=SOCKET_MIN_TIMEOUT_SECONDS;
+	}
+	set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, &err);
+	if(sender)
+	{
+		set_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, queue, &err);
+		set_option(fd, SOL_SOCKET, SO_SNDBUF, 2*queue, &err);
+	}else
+	{
+		set_option(fd, SOL_SOCKET, SO_RCVBUF, 2*queue, &err);
+	}
+	/// Probe an idle connection every second. The user timeout also ends the probing, see tcp(7).
+	set_option(fd, SOL_SOCKET, SO_KEEPALIVE, 1, &err);
+	set_option(fd, IPPROTO_TCP, TCP_KEEPIDLE, 1, &err);
+	set_option(fd, IPPROTO_TCP, TCP_KEEPINTVL, 1, &err);
+	set_option(fd, IPPROTO_TCP, TCP_KEEPCNT, (int)timeout, &err);
+	set_option(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, (int)(timeout*1000), &err);
+	errno=err;
+	return err==0;
+}
+int32_t socketTuning_sendQueue(int fd)
+{
+	int bytes;
+	if(ioctl(fd, SIOCOUTQ, &bytes)!=0)
+	{
+		return -1;
+	}
+	return bytes;
+}
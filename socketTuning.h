@@ -0,0 +1,32 @@
+#ifndef SOCKET_TUNING_H_
+#define SOCKET_TUNING_H_
+
+/// TCP socket options of the audio connections derived from their latency target.
+/// The default socket buffers grow to megabytes, so a stalled connection can hide seconds of audio in the kernel queues
+/// where neither the drop policy of the client nor the buffer control of the server can see it.
+/// The queues are sized to hold about the latency target of audio instead:
+/// - TCP_NODELAY: chunks and clock synchronization messages are sent at once, the programs batch the writes themselves
+/// - TCP_NOTSENT_LOWAT (sender): write() accepts no more unsent data than the latency target, the rest waits in the fan-out ring
+/// - SO_SNDBUF (sender) and SO_RCVBUF (receiver): twice the latency target, for the data in flight
+/// - keepalive and TCP_USER_TIMEOUT: a dead peer is detected after a few seconds instead of many minutes
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Smallest queue size so very short targets or low bitrates do not throttle the stream
+#define SOCKET_MIN_QUEUE_BYTES (16*1024)
+/// A peer that does not acknowledge data or keepalive probes for max(SOCKET_MIN_TIMEOUT_SECONDS, SOCKET_TIMEOUT_FACTOR*latency) is dead
+#define SOCKET_MIN_TIMEOUT_SECONDS 2
+#define SOCKET_TIMEOUT_FACTOR 4
+
+/// Set the options of a connected TCP socket
+/// @param sender the audio is sent on the socket (client, relay), otherwise it is received (server)
+/// @param latencySeconds latency target of the connection
+/// @param bytesPerSecond data rate of the audio on the connection
+/// @return false when an option could not be set (errno is set), the others are set anyway
+bool socketTuning_apply(int fd, bool sender, float latencySeconds, uint32_t bytesPerSecond);
+/// Number of bytes in the send queue of the socket that were not acknowledged yet (sent and unsent)
+/// @return -1 when it is not available
+int32_t socketTuning_sendQueue(int fd);
+
+#endif /* SOCKET_TUNING_H_ */
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+#include "streamCapture.h"
+#include "ringBuffer.h"
+
+/// Records not written yet. Written by the network thread, read by the background thread.
+static ringBuffer_t records;
+/// Number of records dropped because the ringbuffer was full
+static volatile uint32_t dropped=0;
+static FILE * file;
+static pthread_t thread;
+static volatile bool running=false;
+/// CLOCK_MONOTONIC time of the start of the capture in nanoseconds
+static uint64_t startNs;
+
+/// CLOCK_MONOTONIC time in nanoseconds
+static uint64_t capture_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+/// Write out the records in the ringbuffer. The bytes are written unchanged, the ringbuffer contains the records in file format.
+/// @return true when anything was written
+static bool drain(void)
+{
+	bool any=false;
+	while(true)
+	{
+		uint8_t * data;
+		uint32_t n=ringBuffer_accessReadBuffer(&records, &data, ringBuffer_availableRead(&records));
+		if(n==0)
+		{
+			break;
+		}
+		fwrite(data, 1, n, file);
+		ringBuffer_read(&records, n, NULL);
+		any=true;
+	}
+	if(any)
+	{
+		fflush(file);
+	}
+	return any;
+}
+static void * thread_main(void * arg)
+{
+	while(running)
+	{
+		if(!drain())
+		{
+			usleep(STREAM_CAPTURE_PERIOD_US);
+		}
+	}
+	drain();
+	return NULL;
+}
+bool streamCapture_start(const char * fileName)
+{
+	file=fopen(fileName, "wb");
+	if(file==NULL)
+	{
+		perror(fileName);
+		return false;
+	}
+	struct streamCapture_header header;
+	memcpy(header.magic, STREAM_CAPTURE_MAGIC, sizeof(header.magic));
+	header.recordSize=sizeof(struct streamCapture_record);
+	fwrite(&header, sizeof(header), 1, file);
+	uint8_t * buffer=calloc(STREAM_CAPTURE_RINGBUFFER_BYTES, 1);
+	assert(buffer!=NULL);
+	ringBuffer_create(&records, STREAM_CAPTURE_RINGBUFFER_BYTES, buffer);
+	startNs=capture_now();
+	running=true;
+	int err=pthread_create(&thread, NULL, thread_main, NULL);
+	assert(err==0);
+	return true;
+}
+void streamCapture_stop(void)
+{
+	if(!running)
+	{
+		return;
+	}
+	running=false;
+	pthread_join(thread, NULL);
+	fclose(file);
+	file=NULL;
+	if(dropped>0)
+	{
+		printf("Stream capture: %u records dropped\n", dropped);
+	}
+}
+bool streamCapture_enabled(void)
+{
+	return running;
+}
+bool streamCapture_record(uint32_t connection, uint8_t type, const uint8_t * data, uint32_t length)
+{
+	if(!running)
+	{
+		return false;
+	}
+	if(ringBuffer_availableWrite(&records)<sizeof(struct streamCapture_record)+length)
+	{
+		__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	struct streamCapture_record record;
+	record.timeNs=capture_now()-startNs;
+	record.connection=connection;
+	record.type=type;
+	record.length=length;
+	ringBuffer_write(&records, sizeof(record), (uint8_t *)&record);
+	if(length>0)
+	{
+		ringBuffer_write(&records, length, (uint8_t *)data);
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+#ifndef STREAM_CAPTURE_H_
+#define STREAM_CAPTURE_H_
+
+/// Stream capture: record the raw bytes received from each client with their arrival time, so the exact byte stream and timing
+/// the server saw can be replayed later (see jack-tcp-replay.c).
+/// The network thread only copies the records into a preallocated lock-free ringbuffer, a background thread writes them into the file.
+/// When the ringbuffer is full the record is dropped and counted, and the recording of that connection ends.
+///
+/// File format: struct streamCapture_header followed by records. Each record is a struct streamCapture_record followed by length bytes:
+/// the name of the client for STREAM_CAPTURE_CONNECT, the received bytes for STREAM_CAPTURE_DATA, nothing for the others.
+/// All numbers are in host byte order.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// File header magic
+#define STREAM_CAPTURE_MAGIC "JTCPCAP1"
+/// Size of the ringbuffer between the network thread and the writer thread
+#define STREAM_CAPTURE_RINGBUFFER_BYTES (8*1024*1024)
+/// The background thread sleeps this long when there is nothing to write
+#define STREAM_CAPTURE_PERIOD_US (10l*1000l)
+
+/// Record type: a client connected
+#define STREAM_CAPTURE_CONNECT 1
+/// Record type: bytes received from the client
+#define STREAM_CAPTURE_DATA 2
+/// Record type: the client disconnected
+#define STREAM_CAPTURE_CLOSE 3
+/// Record type: the client disconnected, but data of it was dropped from the capture so its recording ended early
+#define STREAM_CAPTURE_LOST 4
+
+/// Header of the capture file
+struct streamCapture_header {
+	char magic[8];
+	/// Size of struct streamCapture_record in bytes
+	uint32_t recordSize;
+} __attribute__((packed));
+
+/// Header of a record
+struct streamCapture_record {
+	/// Arrival time in nanoseconds since the capture was started (CLOCK_MONOTONIC)
+	uint64_t timeNs;
+	/// Identifier of the connection, unique within the file
+	uint32_t connection;
+	/// STREAM_CAPTURE_... record type
+	uint8_t type;
+	/// Number of bytes following the header
+	uint32_t length;
+} __attribute__((packed));
+
+/// Create the capture file and start the background thread
+/// @return false when the file can not be created
+bool streamCapture_start(const char * fileName);
+/// Stop the background thread after all records were written and close the file
+void streamCapture_stop(void);
+/// Is the capture running?
+bool streamCapture_enabled(void);
+/// Record a record of the given type. Called by a single thread (the network thread).
+/// @return false when the record was dropped because the ringbuffer was full or the capture is not running
+bool streamCapture_record(uint32_t connection, uint8_t type, const uint8_t * data, uint32_t length);
+
+#endif /* STREAM_CAPTURE_H_ */
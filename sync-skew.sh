@@ -0,0 +1,54 @@
+#!/bin/sh
+
+# Measures the playout skew between two servers that play the same capture.
+# Runs two headless servers on loopback, the second one with a drifting clock (-d ppm),
+# and a headless client that sends to both of them, once without and once with synchronized playback (-S).
+# Prints the buffered length and the sync error of both servers every second and the skew in milliseconds:
+# the difference of the sync errors when synchronized, the difference of the buffered lengths otherwise.
+# Usage: ./sync-skew.sh [secondsPerRun] [driftPpm] [extra server options...]
+
+DURATION=${1:-60}
+[ $# -gt 0 ] && shift
+DRIFT=${1:-300}
+[ $# -gt 0 ] && shift
+SERVER_OPTIONS="$*"
+PORT_A=18090
+PORT_B=18091
+OUT=${OUT:-/tmp/sync-skew}
+mkdir -p $OUT
+
+# Value of a key=value field of the first line of a status file
+field() {
+	head -n 1 $1 2>/dev/null | tr ' ' '\n' | sed -n "s/^$2=//p"
+}
+
+run() {
+	NAME=$1
+	CLIENT_OPTIONS=$2
+	rm -f $OUT/$NAME.a.status $OUT/$NAME.b.status
+	./jack-tcp-server -H -p $PORT_A -s $OUT/$NAME.a.status $SERVER_OPTIONS >$OUT/$NAME.a.log 2>&1 &
+	SERVER_A=$!
+	./jack-tcp-server -H -d $DRIFT -p $PORT_B -s $OUT/$NAME.b.status $SERVER_OPTIONS >$OUT/$NAME.b.log 2>&1 &
+	SERVER_B=$!
+	sleep 0.5
+	./jack-tcp-client -H 48000 $CLIENT_OPTIONS -u localhost:$PORT_A -u localhost:$PORT_B >$OUT/$NAME.client.log 2>&1 &
+	CLIENT=$!
+	echo "== $NAME (client $CLIENT_OPTIONS, server B drift $DRIFT ppm)"
+	echo "second bufferedA bufferedB syncErrorA(ms) syncErrorB(ms) skew(ms)"
+	for SECOND in $(seq 1 $DURATION)
+	do
+		sleep 1
+		BA=$(field $OUT/$NAME.a.status buffered)
+		BB=$(field $OUT/$NAME.b.status buffered)
+		EA=$(field $OUT/$NAME.a.status syncError)
+		EB=$(field $OUT/$NAME.b.status syncError)
+		echo "$SECOND ${BA:-0} ${BB:-0} ${EA:-0} ${EB:-0}" | awk -v sync="$CLIENT_OPTIONS" '{ printf("%d %s %s %.3f %.3f %.3f\n", $1, $2, $3, $4*1000, $5*1000, (sync!="" ? $4-$5 : $2-$3)*1000) }'
+	done
+	kill $CLIENT
+	sleep 0.5
+	kill -INT $SERVER_A $SERVER_B
+	wait $SERVER_A $SERVER_B 2>/dev/null
+}
+
+run unsynchronized ""
+run synchronized "-S"
@@ -4,8 +4,9 @@
 
 #define DEFAULT_PORT    8080
 
-/// The target length of buffered data on the server (which plays the sound on real hardware)
+/// The default target length of buffered data on the server (which plays the sound on real hardware)
 /// Playback speed is controlled so that this length is maintained on the long run
+/// The server can override it by command line option or adapt the target to the measured network jitter
 #define SERVER_BUFFER_SECONDS (1.0f)
 
 /// Number of ports (stereo) to connect
@@ -25,30 +26,86 @@
 /// Client main loop timing is driven by a sleep. This is the timeout of this sleep.
 #define CLIENT_PERIOD_TIME_US (10l*1000l)
 
-/// Number of bytes size of the server ringbuffer. The server aims to buffer SERVER_BUFFER_SECONDS of audio data.
-/// Size is twice the aimed buffer length.
-#define SERVER_RINGBUFFER_BYTES ((int)(SAMPLERATE*NPORT*SAMPLE_SIZE_BYTES*SERVER_BUFFER_SECONDS*2))
+/// Same-host shared memory transport: size of the data buffer of the shared ring in bytes
+/// The client connects to the Unix socket of the server and sends a single byte with two file descriptors (SCM_RIGHTS):
+/// a memfd that contains a shmRing (see shmRing.h) and is sealed with F_SEAL_SHRINK, and an eventfd. The client writes the same message stream into the ring
+/// as it would send on TCP and increments the eventfd after each write. Server to client messages are sent on the Unix socket.
+/// Closing the Unix socket ends the stream.
+#define SHM_RINGBUFFER_BYTES (1024*1024)
 
 /// Message type Audio samples. Format is struct chunk_header + jack_default_audio_sample_t samples. Samples from channels are interleaved.
 #define R_MSG_AUDIO_CHUNK 1
 /// Message type set stream parameters. Must be the first message to send. Format is: struct stream_parameters
 #define R_MSG_STREAM_PARAMETERS 2
+/// Message type capture time of the first frame of the next audio chunk of the stream. Format is: struct media_timestamp
+/// Sent only by clients in synchronized playback mode (jack-tcp-client -S).
+#define R_MSG_TIMESTAMP 3
+/// Message type clock synchronization request. Sent by the server to a client that sends timestamps. Format is: struct time_sync, only t1 is set
+#define R_MSG_TIME_REQUEST 4
+/// Message type clock synchronization response of the client. Format is: struct time_sync
+#define R_MSG_TIME_RESPONSE 5
+/// Message type flow control. Sent by the server when it has more audio of a stream than it can use and once more when the backlog is gone.
+/// The client drops audio of the stream before sending it. Format is: struct flow_control
+#define R_MSG_FLOW 6
+
+/// Multiplexed streams: a connection can carry several independent streams, each with its own R_MSG_STREAM_PARAMETERS.
+/// The lower 16 bits of chunk_header.type are the message type, the upper 16 bits are the stream id.
+/// Stream 0 is the default stream so a single stream sender just uses the plain R_MSG_... values.
+#define R_MSG_TYPE(type) ((type) & 0xffffu)
+#define R_MSG_STREAM(type) ((type) >> 16)
+#define R_MSG_MAKE(msgType, stream) ((uint32_t)(msgType) | ((uint32_t)(stream) << 16))
+/// Maximum number of streams on a single connection
+#define MAX_STREAMS 8
 
 /// On the TCP stream all messages are prefixed with this.
 struct chunk_header {
-	/// Type of this message. See R_MSG_... constants
+	/// Type of this message. See R_MSG_... constants and R_MSG_MAKE()
 	uint32_t type;
 	/// Size of the payload of this message
 	uint32_t payload;
 } __attribute__((packed));
 
+/// stream_parameters.sampletype: R_MSG_AUDIO_CHUNK payloads are interleaved jack_default_audio_sample_t samples
+#define SAMPLE_TYPE_FLOAT 0
+/// stream_parameters.sampletype: each R_MSG_AUDIO_CHUNK payload is a single Opus packet of nchannel channels.
+/// The samplerate must be OPUS_SAMPLERATE. An R_MSG_TIMESTAMP applies to the first frame of the packet.
+#define SAMPLE_TYPE_OPUS 1
+/// Samplerate of Opus streams
+#define OPUS_SAMPLERATE 48000
+/// Maximum payload size of an Opus audio chunk
+#define OPUS_MAX_PACKET_BYTES 4000
+
 /// The R_MSG_STREAM_PARAMETERS message structure
 struct stream_parameters {
 	struct chunk_header head;
 	uint32_t samplerate;
 	uint32_t nchannel;
+	/// Encoding of the audio chunks. See SAMPLE_TYPE_... constants
 	uint32_t sampletype;
 } __attribute__((packed));
 
+/// The R_MSG_TIMESTAMP message structure. Times are CLOCK_MONOTONIC nanoseconds of the sender.
+struct media_timestamp {
+	struct chunk_header head;
+	int64_t timeNs;
+} __attribute__((packed));
+
+/// The R_MSG_FLOW message structure
+struct flow_control {
+	struct chunk_header head;
+	/// Input frames of the stream buffered above the target length. 0 means the backlog is gone.
+	uint32_t excessFrames;
+	/// Number of audio chunks of the stream the server dropped because its buffer was full
+	uint32_t overflowChunks;
+} __attribute__((packed));
+
+/// The R_MSG_TIME_REQUEST and R_MSG_TIME_RESPONSE message structure. NTP style exchange of CLOCK_MONOTONIC nanoseconds:
+/// t1 is the time the server sent the request, t2 the time the client received it and t3 the time the client sent the response.
+struct time_sync {
+	struct chunk_header head;
+	int64_t t1;
+	int64_t t2;
+	int64_t t3;
+} __attribute__((packed));
 
 #endif /* TCP_PROTOCOL_H_ */
@@ -0,0 +1,179 @@
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "timeStretch.h"
+
+/// Rising half of the Hann window. The falling half is 1-rise so overlapped windows add up to 1.
+static float rise[TIME_STRETCH_HOP];
+static bool riseReady=false;
+/// Coarse search: every COARSE_STEP-th offset is tried on every COARSE_STEP-th frame, then the best one is refined
+#define COARSE_STEP 4
+
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec*1000000000ull+now.tv_nsec;
+}
+
+void timeStretch_init(timeStretch * t)
+{
+	memset(t, 0, sizeof(*t));
+	if(!riseReady)
+	{
+		for(int i=0;i<TIME_STRETCH_HOP;++i)
+		{
+			float s=sinf((float)M_PI*0.5f*i/TIME_STRETCH_HOP);
+			rise[i]=s*s;
+		}
+		riseReady=true;
+	}
+}
+uint32_t timeStretch_space(timeStretch * t)
+{
+	uint32_t keep=t->cursor>TIME_STRETCH_HISTORY?t->cursor-TIME_STRETCH_HISTORY:0;
+	return TIME_STRETCH_FRAMES-t->length+keep;
+}
+void timeStretch_write(timeStretch * t, const float * frames, uint32_t n)
+{
+	if(t->length+n>TIME_STRETCH_FRAMES)
+	{
+		/// Drop the history that is not needed anymore
+		uint32_t shift=t->cursor-TIME_STRETCH_HISTORY;
+		memmove(t->buffer, t->buffer+shift*NPORT, (t->length-shift)*NPORT*sizeof(float));
+		t->length-=shift;
+		t->cursor-=shift;
+		t->nominal-=shift;
+	}
+	memcpy(t->buffer+t->length*NPORT, frames, n*NPORT*sizeof(float));
+	t->length+=n;
+}
+bool timeStretch_busy(timeStretch * t)
+{
+	return t->stretching || t->cursor<t->length;
+}
+/// Similarity of the segment at q to the segment at target: correlation normalized by the energy of the candidate
+static float similarity(const timeStretch * t, uint32_t q, uint32_t target, int step)
+{
+	const float * a=t->buffer+q*NPORT;
+	const float * b=t->buffer+target*NPORT;
+	float correlation=0.0f;
+	float energy=1e-9f;
+	for(int j=0;j<TIME_STRETCH_HOP*NPORT;j+=step*NPORT)
+	{
+		for(int i=0;i<NPORT;++i)
+		{
+			correlation+=a[j+i]*b[j+i];
+			energy+=a[j+i]*a[j+i];
+		}
+	}
+	return correlation/sqrtf(energy);
+}
+/// Find the segment start around nominal position center that continues the waveform at cursor best.
+/// The segment does not start before the previous one (one hop before cursor) so the input is never played backwards.
+static uint32_t search(const timeStretch * t, uint32_t center)
+{
+	uint32_t first=center-TIME_STRETCH_SEARCH;
+	if(first<t->cursor-TIME_STRETCH_HOP)
+	{
+		first=t->cursor-TIME_STRETCH_HOP;
+	}
+	uint32_t best=first;
+	float bestScore=-INFINITY;
+	for(uint32_t q=first;q<=center+TIME_STRETCH_SEARCH;q+=COARSE_STEP)
+	{
+		float score=similarity(t, q, t->cursor, COARSE_STEP);
+		if(score>bestScore)
+		{
+			bestScore=score;
+			best=q;
+		}
+	}
+	uint32_t coarse=best;
+	bestScore=-INFINITY;
+	for(uint32_t q=coarse>first+COARSE_STEP?coarse-COARSE_STEP+1:first;q<coarse+COARSE_STEP;++q)
+	{
+		float score=similarity(t, q, t->cursor, 1);
+		if(score>bestScore)
+		{
+			bestScore=score;
+			best=q;
+		}
+	}
+	return best;
+}
+uint32_t timeStretch_process(timeStretch * t, double speed, float * out, uint32_t maxFrames, uint64_t * consumed)
+{
+	bool nominalSpeed=fabs(speed-1.0)<TIME_STRETCH_MIN_CORRECTION;
+	if(!t->stretching)
+	{
+		if(nominalSpeed || t->cursor<TIME_STRETCH_HISTORY)
+		{
+			/// Copy
+			uint32_t n=t->length-t->cursor;
+			if(n>maxFrames)
+			{
+				n=maxFrames;
+			}
+			memcpy(out, t->buffer+t->cursor*NPORT, n*NPORT*sizeof(float));
+			t->cursor+=n;
+			*consumed+=n;
+			return n;
+		}
+		/// Start stretching: the played output ends at cursor, so the previous segment is taken to start one hop before it
+		if(t->length-t->cursor<TIME_STRETCH_HOP)
+		{
+			return 0;
+		}
+		for(int j=0;j<TIME_STRETCH_HOP;++j)
+		{
+			for(int i=0;i<NPORT;++i)
+			{
+				t->overlap[j*NPORT+i]=t->buffer[(t->cursor+j)*NPORT+i]*(1.0f-rise[j]);
+			}
+		}
+		t->nominal=t->cursor-TIME_STRETCH_HOP;
+		t->stretching=true;
+	}
+	if(maxFrames<TIME_STRETCH_HOP)
+	{
+		return 0;
+	}
+	if(nominalSpeed)
+	{
+		/// Stop stretching: the segment at cursor completes the overlap exactly to the input, so the input is copied
+		if(t->length-t->cursor<TIME_STRETCH_HOP)
+		{
+			return 0;
+		}
+		memcpy(out, t->buffer+t->cursor*NPORT, TIME_STRETCH_HOP*NPORT*sizeof(float));
+		t->cursor+=TIME_STRETCH_HOP;
+		*consumed+=TIME_STRETCH_HOP;
+		t->stretching=false;
+		return TIME_STRETCH_HOP;
+	}
+	double nominal=t->nominal+TIME_STRETCH_HOP*speed;
+	uint32_t center=(uint32_t)lround(nominal);
+	if(center<TIME_STRETCH_SEARCH+COARSE_STEP || center+TIME_STRETCH_SEARCH+COARSE_STEP+2*TIME_STRETCH_HOP>t->length)
+	{
+		/// Wait for more input
+		return 0;
+	}
+	uint64_t start=thread_cpu_ns();
+	uint32_t q=search(t, center);
+	const float * segment=t->buffer+q*NPORT;
+	for(int j=0;j<TIME_STRETCH_HOP;++j)
+	{
+		for(int i=0;i<NPORT;++i)
+		{
+			out[j*NPORT+i]=t->overlap[j*NPORT+i]+segment[j*NPORT+i]*rise[j];
+			t->overlap[j*NPORT+i]=segment[(TIME_STRETCH_HOP+j)*NPORT+i]*(1.0f-rise[j]);
+		}
+	}
+	*consumed+=q+TIME_STRETCH_HOP-t->cursor;
+	t->cursor=q+TIME_STRETCH_HOP;
+	t->nominal=nominal;
+	t->cpuNs+=thread_cpu_ns()-start;
+	t->stretchedFrames+=TIME_STRETCH_HOP;
+	return TIME_STRETCH_HOP;
+}
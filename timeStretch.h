@@ -0,0 +1,56 @@
+#ifndef TIME_STRETCH_H_
+#define TIME_STRETCH_H_
+
+/// Pitch preserving time-stretch of NPORT channel interleaved float audio with WSOLA (waveform similarity overlap-add).
+/// Used instead of the resampler to correct the buffer length of a stream that has the local samplerate.
+/// At nominal speed the input is copied. When the speed differs, output is built from Hann windowed segments of
+/// TIME_STRETCH_HOP*2 frames overlapped by half: each segment is taken from around its nominal input position,
+/// at the offset where it is most similar to the natural continuation of the previous segment, so the waveform stays continuous.
+/// Switching between copying and stretching is seamless because the windows add up to 1.
+
+#include "simulator_types.h"
+#include "tcp-protocol.h"
+
+/// Output frames added by a segment (half of the window length)
+#define TIME_STRETCH_HOP 512
+/// A segment is searched this many frames before and after its nominal position
+#define TIME_STRETCH_SEARCH 256
+/// Size of the input buffer in frames
+#define TIME_STRETCH_FRAMES 4096
+/// Frames kept before the cursor to search segments in
+#define TIME_STRETCH_HISTORY (2*TIME_STRETCH_SEARCH+TIME_STRETCH_HOP+64)
+/// A speed closer to 1 than this is played by copying
+#define TIME_STRETCH_MIN_CORRECTION (0.0005)
+
+typedef struct {
+	/// Input frames. Frames before cursor were played (history), frames from cursor are waiting.
+	float buffer[TIME_STRETCH_FRAMES*NPORT];
+	/// Number of frames in buffer
+	uint32_t length;
+	/// Next input frame to play. While stretching, the frames from cursor are the natural continuation of the previous segment.
+	uint32_t cursor;
+	/// Stretching: overlap holds the falling half of the previous segment
+	bool stretching;
+	/// Stretching: nominal input position of the previous segment
+	double nominal;
+	float overlap[TIME_STRETCH_HOP*NPORT];
+	/// Thread CPU time used by stretching in nanoseconds and the number of frames produced by stretching
+	uint64_t cpuNs;
+	uint64_t stretchedFrames;
+} timeStretch;
+
+/// Initialize an empty stretcher
+void timeStretch_init(timeStretch * t);
+/// Number of frames that can be written
+uint32_t timeStretch_space(timeStretch * t);
+/// Append input frames
+void timeStretch_write(timeStretch * t, const float * frames, uint32_t n);
+/// The stretcher holds input frames that were not played yet. Other paths must not consume input until they are played.
+bool timeStretch_busy(timeStretch * t);
+/// Produce output frames at the given speed
+/// @param speed input frames consumed per output frame
+/// @param consumed the number of input frames that were played is added to it
+/// @return number of frames written into out. Stretching produces TIME_STRETCH_HOP frames at a time and waits for enough input.
+uint32_t timeStretch_process(timeStretch * t, double speed, float * out, uint32_t maxFrames, uint64_t * consumed);
+
+#endif /* TIME_STRETCH_H_ */
@@ -0,0 +1,41 @@
+#ifndef TRACE_PROBES_H_
+#define TRACE_PROBES_H_
+
+/// Static tracepoints (USDT) of the real-time and network paths, provider "jacktcp". Build with make WITH_USDT=1 (needs sys/sdt.h
+/// from systemtap-sdt-dev or systemtap-sdt-devel) and attach with bpftrace or perf, see latency-trace.sh.
+/// A probe is a single nop instruction plus an ELF note until a tracer attaches to it. Without WITH_USDT the macros expand to nothing.
+///
+/// Probes of jack-tcp-server:
+/// - process_start(nframes), process_end(nframes): Jack process callback
+/// - lock_wait(lock), lock_acquired(lock), lock_release(lock): the mutexes, see TRACE_LOCK_CLIENTS and TRACE_LOCK_RELAY
+/// - loop_sleep(), loop_wake(events): the network loop waits in epoll_wait() or io_uring_enter() and wakes up (events is -1 for io_uring)
+/// - message(client, type, payload): a message header was parsed
+/// - resample_start(client, frames), resample_batch(client, inFrames, outFrames), resample_end(client): resample() call and each resampler step
+/// - client_create(client), client_start(client), client_shutdown(client, underruns): stream lifecycle
+/// Probes of jack-tcp-client:
+/// - process_start(nframes), process_end(nframes): Jack process callback
+/// - capture_drop(periods): captured periods dropped because the fan-out ring was full
+/// - connection_connect(reader, milliseconds), connection_disconnect(reader): server connections of the client and of relays
+
+#ifdef WITH_USDT
+#include <sys/sdt.h>
+#define TRACE_PROBE(name) DTRACE_PROBE(jacktcp, name)
+#define TRACE_PROBE1(name, a) DTRACE_PROBE1(jacktcp, name, a)
+#define TRACE_PROBE2(name, a, b) DTRACE_PROBE2(jacktcp, name, a, b)
+#define TRACE_PROBE3(name, a, b, c) DTRACE_PROBE3(jacktcp, name, a, b, c)
+#else
+#define TRACE_PROBE(name) do {} while(0)
+#define TRACE_PROBE1(name, a) do {} while(0)
+#define TRACE_PROBE2(name, a, b) do {} while(0)
+#define TRACE_PROBE3(name, a, b, c) do {} while(0)
+#endif
+
+/// Lock identifiers of the lock probes
+#define TRACE_LOCK_CLIENTS 0
+#define TRACE_LOCK_RELAY 1
+
+/// pthread_mutex_lock() and pthread_mutex_unlock() with the lock probes
+#define TRACE_MUTEX_LOCK(mutex, lock) do { TRACE_PROBE1(lock_wait, lock); pthread_mutex_lock(mutex); TRACE_PROBE1(lock_acquired, lock); } while(0)
+#define TRACE_MUTEX_UNLOCK(mutex, lock) do { pthread_mutex_unlock(mutex); TRACE_PROBE1(lock_release, lock); } while(0)
+
+#endif /* TRACE_PROBES_H_ */
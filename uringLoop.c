@@ -0,0 +1,294 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uringLoop.h"
+
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+
+/// Buffer group id of the provided buffers
+#define URING_BUFFER_GROUP 0
+
+static int io_uring_setup(uint32_t entries, struct io_uring_params * p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+static int io_uring_enter(int fd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags, void * arg, size_t argSize)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+static int io_uring_register(int fd, uint32_t opcode, void * arg, uint32_t nArgs)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nArgs);
+}
+
+bool uringLoop_init(uringLoop_t * u, uint32_t entries, uint32_t bufferCount, uint32_t bufferSize)
+{
+	struct io_uring_params p;
+	memset(u, 0, sizeof(*u));
+	u->fd=-1;
+	memset(&p, 0, sizeof(p));
+	/// Completions are only needed when the loop waits for them: let the kernel defer the work until then
+	p.flags=IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	p.cq_entries=entries*4;
+	u->fd=io_uring_setup(entries, &p);
+	if(u->fd<0 && errno==EINVAL)
+	{
+		memset(&p, 0, sizeof(p));
+		p.flags=IORING_SETUP_CQSIZE;
+		p.cq_entries=entries*4;
+		u->fd=io_uring_setup(entries, &p);
+	}
+	if(u->fd<0)
+	{
+		return false;
+	}
+	if(!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG))
+	{
+		close(u->fd);
+		u->fd=-1;
+		errno=ENOSYS;
+		return false;
+	}
+	size_t sqSize=p.sq_off.array+p.sq_entries*sizeof(uint32_t);
+	size_t cqSize=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+	u->ringMappingSize=sqSize>cqSize?sqSize:cqSize;
+	u->ringMapping=mmap(NULL, u->ringMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	u->sqesSize=p.sq_entries*sizeof(struct io_uring_sqe);
+	u->sqes=mmap(NULL, u->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if(u->ringMapping==MAP_FAILED || u->sqes==MAP_FAILED)
+	{
+		uringLoop_close(u);
+		return false;
+	}
+	uint8_t * ring=u->ringMapping;
+	u->sqHead=(uint32_t *)(ring+p.sq_off.head);
+	u->sqTail=(uint32_t *)(ring+p.sq_off.tail);
+	u->sqMask=*(uint32_t *)(ring+p.sq_off.ring_mask);
+	u->sqArray=(uint32_t *)(ring+p.sq_off.array);
+	u->cqHead=(uint32_t *)(ring+p.cq_off.head);
+	u->cqTail=(uint32_t *)(ring+p.cq_off.tail);
+	u->cqMask=*(uint32_t *)(ring+p.cq_off.ring_mask);
+	u->cqes=(struct io_uring_cqe *)(ring+p.cq_off.cqes);
+
+	u->bufferCount=bufferCount;
+	u->bufferSize=bufferSize;
+	u->bufRingSize=bufferCount*sizeof(struct io_uring_buf);
+	u->bufRing=mmap(NULL, u->bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	u->buffers=malloc((size_t)bufferCount*bufferSize);
+	if(u->bufRing==MAP_FAILED || u->buffers==NULL)
+	{
+		uringLoop_close(u);
+		return false;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr=(uint64_t)(uintptr_t)u->bufRing;
+	reg.ring_entries=bufferCount;
+	reg.bgid=URING_BUFFER_GROUP;
+	if(io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1)!=0)
+	{
+		uringLoop_close(u);
+		return false;
+	}
+	for(uint32_t i=0;i<bufferCount;++i)
+	{
+		uringLoop_releaseBuffer(u, i);
+	}
+	return true;
+}
+void uringLoop_close(uringLoop_t * u)
+{
+	if(u->fd>=0)
+	{
+		close(u->fd);
+		u->fd=-1;
+	}
+	if(u->ringMapping!=NULL && u->ringMapping!=MAP_FAILED)
+	{
+		munmap(u->ringMapping, u->ringMappingSize);
+	}
+	if(u->sqes!=NULL && u->sqes!=MAP_FAILED)
+	{
+		munmap(u->sqes, u->sqesSize);
+	}
+	if(u->bufRing!=NULL && u->bufRing!=MAP_FAILED)
+	{
+		munmap(u->bufRing, u->bufRingSize);
+	}
+	free(u->buffers);
+	u->ringMapping=NULL;
+	u->sqes=NULL;
+	u->bufRing=NULL;
+	u->buffers=NULL;
+}
+/// Get a free submission queue entry. Submits the queued entries first when the queue is full.
+static struct io_uring_sqe * get_sqe(uringLoop_t * u)
+{
+	uint32_t tail=*u->sqTail;
+	if(tail-__atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE)>u->sqMask)
+	{
+		u->enterCalls++;
+		if(io_uring_enter(u->fd, u->toSubmit, 0, 0, NULL, 0)<0)
+		{
+			return NULL;
+		}
+		u->toSubmit=0;
+		if(tail-__atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE)>u->sqMask)
+		{
+			return NULL;
+		}
+	}
+	uint32_t index=tail & u->sqMask;
+	struct io_uring_sqe * sqe=&u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sqArray[index]=index;
+	return sqe;
+}
+/// Make the entry returned by get_sqe() visible to the kernel. It is submitted by the next io_uring_enter().
+static void queue_sqe(uringLoop_t * u)
+{
+	__atomic_store_n(u->sqTail, *u->sqTail+1, __ATOMIC_RELEASE);
+	u->toSubmit++;
+}
+bool uringLoop_recv(uringLoop_t * u, int fd, uint64_t userData)
+{
+	struct io_uring_sqe * sqe=get_sqe(u);
+	if(sqe==NULL)
+	{
+		return false;
+	}
+	sqe->opcode=IORING_OP_RECV;
+	sqe->fd=fd;
+	sqe->ioprio=IORING_RECV_MULTISHOT;
+	sqe->flags=IOSQE_BUFFER_SELECT;
+	sqe->buf_group=URING_BUFFER_GROUP;
+	sqe->user_data=userData;
+	queue_sqe(u);
+	return true;
+}
+bool uringLoop_poll(uringLoop_t * u, int fd, uint64_t userData)
+{
+	struct io_uring_sqe * sqe=get_sqe(u);
+	if(sqe==NULL)
+	{
+		return false;
+	}
+	sqe->opcode=IORING_OP_POLL_ADD;
+	sqe->fd=fd;
+	sqe->poll32_events=POLLIN;
+	sqe->len=IORING_POLL_ADD_MULTI;
+	sqe->user_data=userData;
+	queue_sqe(u);
+	return true;
+}
+bool uringLoop_cancel(uringLoop_t * u, uint64_t userData, uint64_t cancelUserData)
+{
+	struct io_uring_sqe * sqe=get_sqe(u);
+	if(sqe==NULL)
+	{
+		return false;
+	}
+	sqe->opcode=IORING_OP_ASYNC_CANCEL;
+	sqe->fd=-1;
+	sqe->addr=userData;
+	sqe->cancel_flags=IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data=cancelUserData;
+	queue_sqe(u);
+	return true;
+}
+bool uringLoop_wait(uringLoop_t * u, int timeoutMs)
+{
+	struct __kernel_timespec ts;
+	ts.tv_sec=timeoutMs/1000;
+	ts.tv_nsec=(timeoutMs%1000)*1000000LL;
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts=(uint64_t)(uintptr_t)&ts;
+	u->enterCalls++;
+	int ret=io_uring_enter(u->fd, u->toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if(ret>=0)
+	{
+		u->toSubmit-=ret;
+		return true;
+	}
+	return errno==ETIME || errno==EINTR || errno==EBUSY;
+}
+bool uringLoop_next(uringLoop_t * u, uringLoop_completion * c)
+{
+	uint32_t head=*u->cqHead;
+	if(head==__atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE))
+	{
+		return false;
+	}
+	struct io_uring_cqe * cqe=&u->cqes[head & u->cqMask];
+	c->userData=cqe->user_data;
+	c->res=cqe->res;
+	c->more=(cqe->flags & IORING_CQE_F_MORE)!=0;
+	c->bufferId=-1;
+	c->data=NULL;
+	if(cqe->flags & IORING_CQE_F_BUFFER)
+	{
+		c->bufferId=cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		c->data=u->buffers+(size_t)c->bufferId*u->bufferSize;
+	}
+	__atomic_store_n(u->cqHead, head+1, __ATOMIC_RELEASE);
+	return true;
+}
+void uringLoop_releaseBuffer(uringLoop_t * u, int32_t bufferId)
+{
+	if(bufferId<0)
+	{
+		return;
+	}
+	struct io_uring_buf * buf=&u->bufRing->bufs[u->bufTail & (u->bufferCount-1)];
+	buf->addr=(uint64_t)(uintptr_t)(u->buffers+(size_t)bufferId*u->bufferSize);
+	buf->len=u->bufferSize;
+	buf->bid=(uint16_t)bufferId;
+	u->bufTail++;
+	__atomic_store_n(&u->bufRing->tail, u->bufTail, __ATOMIC_RELEASE);
+}
+
+#else
+
+/// The kernel headers are too old for multishot recv: the epoll loop is used
+bool uringLoop_init(uringLoop_t * u, uint32_t entries, uint32_t bufferCount, uint32_t bufferSize)
+{
+	memset(u, 0, sizeof(*u));
+	u->fd=-1;
+	errno=ENOSYS;
+	return false;
+}
+void uringLoop_close(uringLoop_t * u)
+{
+}
+bool uringLoop_recv(uringLoop_t * u, int fd, uint64_t userData)
+{
+	return false;
+}
+bool uringLoop_poll(uringLoop_t * u, int fd, uint64_t userData)
+{
+	return false;
+}
+bool uringLoop_cancel(uringLoop_t * u, uint64_t userData, uint64_t cancelUserData)
+{
+	return false;
+}
+bool uringLoop_wait(uringLoop_t * u, int timeoutMs)
+{
+	return false;
+}
+bool uringLoop_next(uringLoop_t * u, uringLoop_completion * c)
+{
+	return false;
+}
+void uringLoop_releaseBuffer(uringLoop_t * u, int32_t bufferId)
+{
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef URING_LOOP_H_
+#define URING_LOOP_H_
+
+/// Minimal io_uring event loop for receiving from many sockets with few system calls.
+/// Multishot recv requests pick buffers from a ring of provided buffers, so a single io_uring_enter()
+/// can return the data of many sockets at once. Uses the raw system calls, liburing is not required.
+/// Requires Linux 6.0 or newer. uringLoop_init() fails on older kernels or when io_uring is disabled
+/// and the caller is expected to fall back to epoll.
+
+#include "simulator_types.h"
+#include <stddef.h>
+
+/// A completed request returned by uringLoop_next()
+typedef struct
+{
+	/// userData of the request
+	uint64_t userData;
+	/// Number of bytes received, 0 at end of stream or -errno
+	int32_t res;
+	/// The request is still armed and will produce more completions
+	bool more;
+	/// Received data when bufferId>=0. Valid until uringLoop_releaseBuffer() is called.
+	uint8_t * data;
+	/// Provided buffer that holds the data or -1
+	int32_t bufferId;
+} uringLoop_completion;
+
+typedef struct
+{
+	int fd;
+	/// Submission queue
+	uint32_t * sqHead;
+	uint32_t * sqTail;
+	uint32_t sqMask;
+	uint32_t * sqArray;
+	struct io_uring_sqe * sqes;
+	/// Number of queued submissions not yet passed to the kernel
+	uint32_t toSubmit;
+	/// Completion queue
+	uint32_t * cqHead;
+	uint32_t * cqTail;
+	uint32_t cqMask;
+	struct io_uring_cqe * cqes;
+	/// Provided buffers
+	struct io_uring_buf_ring * bufRing;
+	uint8_t * buffers;
+	uint32_t bufferCount;
+	uint32_t bufferSize;
+	uint16_t bufTail;
+	/// Mappings to release in uringLoop_close()
+	void * ringMapping;
+	size_t ringMappingSize;
+	size_t sqesSize;
+	size_t bufRingSize;
+	/// Number of io_uring_enter() calls. Used to compare system call counts with the epoll loop.
+	uint64_t enterCalls;
+} uringLoop_t;
+
+/// Create the io_uring instance and register bufferCount (power of 2) provided buffers of bufferSize bytes
+/// @return false means io_uring is not available
+bool uringLoop_init(uringLoop_t * u, uint32_t entries, uint32_t bufferCount, uint32_t bufferSize);
+/// Release the io_uring instance and the buffers
+void uringLoop_close(uringLoop_t * u);
+/// Queue a multishot recv on a socket. Completions carry data in provided buffers.
+bool uringLoop_recv(uringLoop_t * u, int fd, uint64_t userData);
+/// Queue a multishot poll for readability of fd (for example an epoll fd)
+bool uringLoop_poll(uringLoop_t * u, int fd, uint64_t userData);
+/// Queue cancellation of all requests with the given userData. The cancel request itself completes with cancelUserData.
+bool uringLoop_cancel(uringLoop_t * u, uint64_t userData, uint64_t cancelUserData);
+/// Submit the queued requests and wait until there is at least one completion or timeout elapses
+/// @return false on error other than timeout or signal
+bool uringLoop_wait(uringLoop_t * u, int timeoutMs);
+/// Get the next completion. @return false when there are no more completions
+bool uringLoop_next(uringLoop_t * u, uringLoop_completion * c);
+/// Give a provided buffer back to the kernel after its data was consumed
+void uringLoop_releaseBuffer(uringLoop_t * u, int32_t bufferId);
+
+#endif /* URING_LOOP_H_ */